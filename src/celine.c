@@ -1,48 +1,63 @@
 #include<string.h>
 #include<dlfcn.h>
+#include<pthread.h>
+#include<unistd.h>
 
 #include "celine.h"
 
-#define CLN_FTABLE_INITIAL_CAPACITY     20
+#if defined(__unix__) || defined(__APPLE__)
+#define CLN_GLOBALS_MMAP
+#include<sys/mman.h>
+#endif
+
+#define CLN_SLOTS_INITIAL_CAPACITY      4
+#define CLN_AST_INITIAL_CAPACITY        64
+#define CLN_FIELD_CACHES_INITIAL_CAPACITY   64
+#define CLN_SHAPE_LINEAR_MAX            8
+#define CLN_ATOMS_INITIAL_CAPACITY      256     // a power of two
 #define CLN_BUFLEN                      256
-#define CLN_PATHLEN                     250
+#ifndef CLN_FRAME_CHUNK_WORDS
+#define CLN_FRAME_CHUNK_WORDS           (16 << 10)  // call frame stack grows by this many Values
+#endif
+
+Options clnOptions = {.jitThreshold = CLN_JIT_THRESHOLD};
+_Thread_local jmp_buf *clnPanicHandler;
 
 // -*-----------------------------------------------------------------*-
 // -*- Type -> (IDTable)                                             -*-
 // -*-----------------------------------------------------------------*-
 // -
-void cln_checktype(Object *obj, enum Type type){
-    if(obj->type != type){
-        cln_panic("TypeError: expected %d, got %d\n", type, obj->type);
-    }
+void cln_typeerror(Value v, enum Type type){
+    cln_panic("TypeError: expected %d, got %d\n", type, cln_typeof(v));
 }
 
 // -*-
-char* cln_toString(const Object *self){
+char* cln_toString(Value self){
     char *buffer;
     int rc;
+    enum Type type = cln_typeof(self);
     buffer = cln_alloc(sizeof(char)*CLN_BUFLEN);
-    switch(self->type){
+    switch(type){
     case TY_INTEGER:
-        rc = sprintf(buffer, "%ld", self->val.integer);
+        rc = sprintf(buffer, "%ld", cln_as_integer(self));
         if(rc < 0){
-            cln_panic("ValueError: unable to convert %ld to a string\n", self->val.integer);
+            cln_panic("ValueError: unable to convert %ld to a string\n", cln_as_integer(self));
         }
         break;
     case TY_FLOAT:
-        rc = sprintf(buffer, "%lg", self->val.real);
+        rc = sprintf(buffer, "%lg", cln_as_float(self));
         if(rc < 0){
-            cln_panic("ValueError: unable to convert %lg to a string\n", self->val.real);
+            cln_panic("ValueError: unable to convert %lg to a string\n", cln_as_float(self));
         }
         break;
     case TY_STRING:
-        if(strlen(self->val.cstr) >= CLN_BUFLEN){
+        if(strlen(cln_as_object(self)->val.cstr) >= CLN_BUFLEN){
             cln_panic(
                 "Too long string to output: '%s', maximum buffer size is %d\n",
-                self->val.cstr, CLN_BUFLEN
+                cln_as_object(self)->val.cstr, CLN_BUFLEN
             );
         }
-        strcpy(buffer, self->val.cstr);
+        strcpy(buffer, cln_as_object(self)->val.cstr);
         break;
     case TY_ARRAY:
         strcpy(buffer, "[array]");
@@ -54,7 +69,7 @@ char* cln_toString(const Object *self){
         strcpy(buffer, "[object]");
         break;
     default:
-        cln_panic("Invalid data type: %d\n", self->type);
+        cln_panic("Invalid data type: %d\n", type);
         break;
     }
 
@@ -63,44 +78,34 @@ char* cln_toString(const Object *self){
 
 // -*-
 Object* cln_new(){
-    Object *self = cln_alloc(sizeof(Object));
-    self->fields = (Field**)cln_alloc(sizeof(Field*)*CLN_FTABLE_INITIAL_CAPACITY);
-    self->ftcap = CLN_FTABLE_INITIAL_CAPACITY;
-    self->nfield = 0;
-    memset(self->fields, 0, sizeof(Field*)*CLN_FTABLE_INITIAL_CAPACITY);
+    Object *self = cln_gc_new_object();
+    self->shape = cln_root_shape();
+    self->slots = NULL;
+    self->slotcap = 0;
     return self;
 }
 
-// -*-
-Object* cln_new_integer(long num){
+// -*- integers that do not fit an immediate Value
+Object* cln_box_integer(long num){
     Object *self = cln_new();
     self->type = TY_INTEGER;
     self->val.integer = num;
     return self;
 }
-
-// -*-
-Object* cln_new_float(double num){
-    Object *self = cln_new();
-    self->type = TY_FLOAT;
-    self->val.real = num;
-    return self;
-}
-
 // -*-
 Object* cln_new_string(char *cstr){
     Object *self = cln_new();
     self->type = TY_STRING;
     self->val.cstr = cstr;
+    cln_gc_account(self, strlen(cstr)+1);
     return self;
 }
 
-// -*-
-Object* cln_new_fun(int *args, int narg, Ast *code){
+// -*- takes ownership of `args`
+Object* cln_new_fun(int narg, Ast *code){
     Object *self = cln_new();
     self->type = TY_FUN;
     self->val.fun.narg = narg;
-    self->val.fun.args = args;
     self->val.fun.code = code;
 
     return self;
@@ -111,100 +116,377 @@ Object* cln_new_array(size_t len){
     Object *self = cln_new();
     self->type = TY_ARRAY;
     self->val.array.len = len;
-    self->val.array.data = (Object**)cln_alloc(sizeof(Object*)*len);
-    cln_set_field(self, "len", cln_new_integer(len));
+    self->val.array.data = (Value*)cln_slab_alloc(sizeof(Value)*len);
+    cln_gc_account(self, sizeof(Value)*len);
+    cln_set_field(self, CLN_ATOM(LEN), cln_new_integer(len));
     // ... OTHER API ...
     return self;
 }
 
+// -*---------------------------------------------------------------*-
+// -*- Atom                                                        -*-
+// -*---------------------------------------------------------------*-
+Atom clnAtoms[] = {
+#define CLN_DEF(id, name)       {name, sizeof(name)-1, 0},
+    CLN_ATOMS
+#undef CLN_DEF
+};
+
+// -*- open addressing over every atom, kept at most half full; atoms
+// -*- are never freed
+static Atom **clnAtomIndex;
+static uint32_t clnAtomMask;
+static uint32_t clnAtomCount;
+
 // -*-
-uint32_t cln_hash(const char* cstr, size_t tableLen){
-    size_t len = strlen(cstr);
-    uint32_t result = 0;
-    for(int i=0; i < len; ++i){
-        result = (result * 31 + cstr[i]) % tableLen;
+static void _cln_atom_insert(Atom *atom){
+    uint32_t index = atom->hash & clnAtomMask;
+    while(clnAtomIndex[index]){
+        index = (index + 1) & clnAtomMask;
     }
+    clnAtomIndex[index] = atom;
+}
 
-    return result;
+// -*- the first call also interns the atoms of CLN_ATOMS
+static void _cln_atom_grow(){
+    Atom **index = clnAtomIndex;
+    uint32_t size = index ? clnAtomMask + 1 : 0;
+    uint32_t grown = size ? 2*size : CLN_ATOMS_INITIAL_CAPACITY;
+    clnAtomIndex = (Atom**)cln_alloc(sizeof(Atom*)*grown);
+    clnAtomMask = grown - 1;
+    for(uint32_t i=0; i < size; ++i){
+        if(index[i]){
+            _cln_atom_insert(index[i]);
+        }
+    }
+    cln_dealloc(index);
+    if(!size){
+        for(size_t i=0; i < sizeof(clnAtoms)/sizeof(clnAtoms[0]); ++i){
+            clnAtoms[i].hash = cln_hash(clnAtoms[i].name, clnAtoms[i].len);
+            _cln_atom_insert(&clnAtoms[i]);
+            ++clnAtomCount;
+        }
+    }
+}
+
+// -*- `name` need not be NUL terminated
+Atom* cln_atom_slice(const char *name, size_t len){
+    if(!clnAtomIndex){
+        _cln_atom_grow();
+    }
+    uint32_t hash = cln_hash(name, len);
+    for(uint32_t index = hash & clnAtomMask; clnAtomIndex[index]; index = (index + 1) & clnAtomMask){
+        Atom *atom = clnAtomIndex[index];
+        if(atom->hash == hash && atom->len == len && memcmp(atom->name, name, len)==0){
+            return atom;
+        }
+    }
+    if(2*(clnAtomCount + 1) > clnAtomMask + 1){
+        _cln_atom_grow();
+    }
+    Atom *atom = (Atom*)cln_alloc(sizeof(Atom));
+    atom->name = strndup(name, len);
+    atom->len = (uint32_t)len;
+    atom->hash = hash;
+    _cln_atom_insert(atom);
+    ++clnAtomCount;
+    return atom;
 }
 
 // -*-
-static uint32_t _cln_get_field_index(Object *self, const char* fieldname){
-    uint32_t index = cln_hash(fieldname, self->ftcap);
-    while(self->fields[index] && strcmp(self->fields[index]->name, fieldname)!=0){
-        ++index;
-        if(index >= self->ftcap){
-            index = 0;
+Atom* cln_atom(const char *name){
+    return cln_atom_slice(name, strlen(name));
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Shape                                                       -*-
+// -*---------------------------------------------------------------*-
+// -*- Objects built by the same sequence of field additions share a
+// -*- Shape; the object itself only keeps a slot vector. Small shapes
+// -*- are searched along the parent chain, larger ones through a
+// -*- name -> slot table that every shape of one transition chain
+// -*- shares (entries past a shape's nslot belong to its descendants).
+
+struct shapetable{
+    Atom **names;               // open addressing, NULL for empty
+    uint32_t *slots;
+    size_t cap;                 // a power of two
+    size_t count;               // slots [0, count) are present
+};
+
+static Shape clnRootShape;
+uint32_t clnProtoEpoch;
+
+// -*-
+Shape* cln_root_shape(){
+    return &clnRootShape;
+}
+
+// -*- atoms are unique, their address is the key
+static size_t _cln_shape_table_index(ShapeTable *table, Atom *name){
+    return (size_t)(((uintptr_t)name >> 4)*0x9e3779b97f4a7c15u >> 32) & (table->cap - 1);
+}
+
+// -*-
+static void _cln_shape_table_insert(ShapeTable *table, Atom *name, uint32_t slot){
+    size_t index = _cln_shape_table_index(table, name);
+    while(table->names[index]){
+        index = (index + 1) & (table->cap - 1);
+    }
+    table->names[index] = name;
+    table->slots[index] = slot;
+    ++table->count;
+}
+
+// -*- `cap` is rounded up to a power of two
+static ShapeTable* _cln_shape_table_new(size_t cap){
+    ShapeTable *table = (ShapeTable*)cln_alloc(sizeof(ShapeTable));
+    table->cap = 1;
+    while(table->cap < cap){
+        table->cap *= 2;
+    }
+    cap = table->cap;
+    table->names = (Atom**)cln_alloc(sizeof(Atom*)*cap);
+    table->slots = (uint32_t*)cln_alloc(sizeof(uint32_t)*cap);
+    table->count = 0;
+    return table;
+}
+
+// -*- rebuild a table holding exactly the chain ending at `shape`
+static ShapeTable* _cln_shape_table_build(Shape *shape, size_t cap){
+    ShapeTable *table = _cln_shape_table_new(cap);
+    for(Shape *node = shape; node->parent; node = node->parent){
+        _cln_shape_table_insert(table, node->name, node->nslot-1);
+    }
+    return table;
+}
+
+// -*- slot of `name` in objects of this shape, -1 when absent
+int cln_shape_lookup(Shape *shape, Atom *name){
+    if(shape->nslot <= CLN_SHAPE_LINEAR_MAX){
+        for(Shape *node = shape; node->parent; node = node->parent){
+            if(node->name == name){
+                return (int)node->nslot-1;
+            }
         }
+        return -1;
     }
-    return index;
+    if(!shape->table){
+        shape->table = _cln_shape_table_build(shape, 4*shape->nslot);
+    }
+    ShapeTable *table = shape->table;
+    size_t index = _cln_shape_table_index(table, name);
+    while(table->names[index]){
+        if(table->names[index] == name){
+            return table->slots[index] < shape->nslot ? (int)table->slots[index] : -1;
+        }
+        index = (index + 1) & (table->cap - 1);
+    }
+    return -1;
 }
 
-// -
-static void _cln_rehash(Object *self){
-    size_t cap = self->ftcap;
-    self->ftcap *= 2;
-    Field **fields = self->fields;
-    self->fields = (Field**)cln_alloc(sizeof(Field*)*self->ftcap);
-    memset(self->fields, 0, sizeof(Field*)*self->ftcap);
-    self->nfield = 0;
-    uint32_t hash;
-    Field *field;
-    for(size_t i=0; i < cap; ++i){
-        field = fields[i];
-        if(field){
-            cln_set_field(self, field->name, field->obj);
-            cln_dealloc(field);
+// -*- shape reached from `shape` by adding `name`
+static Shape* _cln_shape_transition(Shape *shape, Atom *name){
+    for(uint32_t i=0; i < shape->ntransition; ++i){
+        if(shape->transitions[i]->name == name){
+            return shape->transitions[i];
+        }
+    }
+    Shape *child = (Shape*)cln_slab_alloc(sizeof(Shape));
+    child->parent = shape;
+    child->name = name;
+    child->nslot = shape->nslot + 1;
+    // - inherit the table while this chain is its tip, growing it at 0.5 load
+    ShapeTable *table = shape->table;
+    if(table && table->count == shape->nslot){
+        if(2*(table->count+1) > table->cap){
+            ShapeTable *grown = _cln_shape_table_build(shape, 2*table->cap);
+            shape->table = grown;
+            table = grown;
+        }
+        _cln_shape_table_insert(table, child->name, child->nslot-1);
+        child->table = table;
+    }
+    if(shape->ntransition == shape->transitioncap){
+        shape->transitioncap = shape->transitioncap ? 2*shape->transitioncap : 2;
+        shape->transitions = (Shape**)realloc(shape->transitions, sizeof(Shape*)*shape->transitioncap);
+        if(!shape->transitions){
+            cln_panic("CelineError: memory allocation failure\n");
         }
     }
-    cln_dealloc(fields);
+    shape->transitions[shape->ntransition++] = child;
+    return child;
+}
+
+// -*- the slot vector is only allocated once the first field is set
+void cln_reserve_slots(Object *self, uint32_t nslot){
+    if(nslot <= self->slotcap){
+        return;
+    }
+    uint32_t cap = self->slotcap ? self->slotcap : CLN_SLOTS_INITIAL_CAPACITY;
+    while(cap < nslot){
+        cap *= 2;
+    }
+    self->slots = (Value*)cln_slab_realloc(self->slots, sizeof(Value)*self->slotcap, sizeof(Value)*cap);
+    cln_gc_account(self, sizeof(Value)*(cap - self->slotcap));
+    self->slotcap = cap;
 }
 
 // -*-
-void cln_set_field(Object *self, const char* name, Object *obj){
-    /* rehash if the load factor is greater than 0.75 */
-    if(5*self->nfield > 3*self->ftcap){
-        _cln_rehash(self);
-    }
-    uint32_t index = _cln_get_field_index(self, name);
-    Field *field = (Field*)cln_alloc(sizeof(Field));
-    char* fname = (char*)cln_alloc(sizeof(char)*(strlen(name)+1));
-    strcpy(fname, name);
-    field->name = fname;
-    field->obj = obj;
-    if(!self->fields[index]){
-        ++self->nfield;
-    }else if(!obj){
-        --self->nfield;
-    }else{
-        cln_dealloc(self->fields[index]->name);
-        cln_dealloc(self->fields[index]);
+void cln_set_field(Object *self, Atom *name, Value obj){
+    int slot = cln_shape_lookup(self->shape, name);
+    bool isLink = name == CLN_ATOM(PROTOTYPE);
+    if(self->isPrototype && (slot < 0 || isLink)){
+        ++clnProtoEpoch;
+    }
+    if(slot < 0){
+        self->shape = _cln_shape_transition(self->shape, name);
+        slot = (int)self->shape->nslot-1;
+        cln_reserve_slots(self, self->shape->nslot);
     }
-    self->fields[index] = field;
+    if(isLink && cln_is_object(obj)){
+        cln_as_object(obj)->isPrototype = true;
+    }
+    self->slots[slot] = obj;
+    cln_gc_barrier(self, obj);
 }
 
 // -*-
-Object* cln_get_field_generic(Object *self, const char* name, bool checkproto){
-    uint32_t index = _cln_get_field_index(self, name);
-    if(self->fields[index]){
-        return self->fields[index]->obj;
+Value cln_get_field_generic(Object *self, Atom *name, bool checkproto){
+    int slot = cln_shape_lookup(self->shape, name);
+    if(slot >= 0){
+        return self->slots[slot];
     }
 
     if(checkproto){
-        Object *proto = cln_get_field_generic(self, CLN_PROTOTYPE, false);
-        if(proto){
-            return cln_get_field_generic(proto, name, checkproto);
+        Value proto = cln_get_field_generic(self, CLN_ATOM(PROTOTYPE), false);
+        if(cln_is_object(proto)){
+            return cln_get_field_generic(cln_as_object(proto), name, checkproto);
         }
     }
 
-    return NULL;
+    return CLN_NIL;
 }
 
 // -*-
-Object* cln_get_field(Object *self, const char* name){
+Value cln_get_field(Object *self, Atom *name){
     return cln_get_field_generic(self, name, true);
 }
 
+// -*---------------------------------------------------------------*-
+// -*- Inline caches                                               -*-
+// -*---------------------------------------------------------------*-
+FieldCache *clnFieldCaches;
+static size_t clnFieldCacheCount;
+static size_t clnFieldCacheCap;
+
+// -*-
+uint32_t cln_new_field_cache(Atom *name){
+    if(clnFieldCacheCount == clnFieldCacheCap){
+        clnFieldCacheCap = clnFieldCacheCap ? 2*clnFieldCacheCap : CLN_FIELD_CACHES_INITIAL_CAPACITY;
+        clnFieldCaches = (FieldCache*)realloc(clnFieldCaches, sizeof(FieldCache)*clnFieldCacheCap);
+        if(!clnFieldCaches){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    FieldCache *cache = &clnFieldCaches[clnFieldCacheCount];
+    memset(cache, 0, sizeof(FieldCache));
+    cache->name = name;
+    return (uint32_t)clnFieldCacheCount++;
+}
+
+// -*- same lookup as cln_get_field(), recording where the field was found
+Value cln_field_cache_miss(Object *self, FieldCache *cache){
+    if(cache->megamorphic){
+        return cln_get_field(self, cache->name);
+    }
+    FieldCacheEntry found = {.shape = self->shape};
+    Value result;
+    int slot = cln_shape_lookup(self->shape, cache->name);
+    if(slot >= 0){
+        found.slot = (uint32_t)slot;
+        result = self->slots[slot];
+    }else{
+        int protoSlot = cln_shape_lookup(self->shape, CLN_ATOM(PROTOTYPE));
+        if(protoSlot < 0 || !cln_is_object(self->slots[protoSlot])){
+            return CLN_NIL;
+        }
+        Object *holder = cln_as_object(self->slots[protoSlot]);
+        while((slot = cln_shape_lookup(holder->shape, cache->name)) < 0){
+            Value next = cln_get_field_generic(holder, CLN_ATOM(PROTOTYPE), false);
+            if(!cln_is_object(next)){
+                return CLN_NIL;
+            }
+            holder = cln_as_object(next);
+        }
+        found.holder = holder;
+        found.proto = self->slots[protoSlot];
+        found.protoSlot = (uint32_t)protoSlot;
+        found.slot = (uint32_t)slot;
+        found.epoch = clnProtoEpoch;
+        result = holder->slots[slot];
+    }
+    // - refill the stale entry of this layout, or take a new one
+    uint8_t i = 0;
+    while(i < cache->count && cache->entries[i].shape != found.shape){
+        ++i;
+    }
+    if(i == CLN_IC_ENTRIES){
+        cache->megamorphic = true;
+        return result;
+    }
+    cache->entries[i] = found;
+    if(i == cache->count){
+        ++cache->count;
+    }
+    return result;
+}
+
+// -*- overwriting an own field of a layout seen before stores in place;
+// -*- the layout an assignment leaves is recorded, added field or not
+void cln_set_field_cached(Object *self, FieldCache *cache, Value obj){
+    for(uint8_t i=0; i < cache->count; ++i){
+        FieldCacheEntry *entry = &cache->entries[i];
+        if(entry->shape == self->shape && !entry->holder){
+            self->slots[entry->slot] = obj;
+            cln_gc_barrier(self, obj);
+            return;
+        }
+    }
+    cln_set_field(self, cache->name, obj);
+    if(cache->name == CLN_ATOM(PROTOTYPE) || cache->count == CLN_IC_ENTRIES){
+        return;     // relinking a prototype always takes the slow path
+    }
+    for(uint8_t i=0; i < cache->count; ++i){
+        if(cache->entries[i].shape == self->shape){
+            return;
+        }
+    }
+    FieldCacheEntry *entry = &cache->entries[cache->count++];
+    memset(entry, 0, sizeof(FieldCacheEntry));
+    entry->shape = self->shape;
+    entry->slot = (uint32_t)cln_shape_lookup(self->shape, cache->name);
+}
+
+// -*- new Ctor(...): preallocate the slots of the layout Ctor built last time
+Object* cln_new_instance(Value ctor){
+    Object *self = cln_new();
+    if(cln_is_object(ctor) && cln_as_object(ctor)->type == TY_FUN){
+        Shape *shape = cln_as_object(ctor)->val.fun.instanceShape;
+        if(shape){
+            cln_reserve_slots(self, shape->nslot);
+        }
+    }
+    return self;
+}
+
+// -*- once the constructor has returned
+void cln_finish_instance(Value ctor, Object *self){
+    Object *fun = cln_checkobject(ctor);
+    cln_set_field(self, CLN_ATOM(PROTOTYPE), cln_get_field_generic(fun, CLN_ATOM(PROTOTYPE), false));
+    fun->val.fun.instanceShape = self->shape;
+}
+
 // -*---------------------------------------------------------------*-
 // -*- Ast                                                         -*-
 // -*---------------------------------------------------------------*-
@@ -216,34 +498,67 @@ char* clnAstKindNames[] = {
 };
 
 // -*-
-Ast* cln_new_ast(enum AstKind akind, Object *obj){
-    Ast *ast = (Ast*)cln_alloc(sizeof(Ast));
+void cln_ast_arena_init(AstArena *arena){
+    arena->nodes = NULL;
+    arena->len = 0;
+    arena->cap = 0;
+}
+
+// -*- index of the new node
+uint32_t cln_new_ast(AstArena *arena, enum AstKind akind, Value obj){
+    if(arena->len == arena->cap){
+        arena->cap = arena->cap ? 2*arena->cap : CLN_AST_INITIAL_CAPACITY;
+        arena->nodes = (Ast*)realloc(arena->nodes, sizeof(Ast)*arena->cap);
+        if(!arena->nodes){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    Ast *ast = &arena->nodes[arena->len];
     ast->akind = akind;
     ast->obj = obj;
-    ast->node = NULL;
-    ast->next = NULL;
-    ast->parent = NULL;
+    ast->node = 0;
+    ast->next = 0;
+    ast->last = 0;
+    ast->aux = 0;
+    ast->type = CLN_TYPE_UNKNOWN;
+    ast->quick = 0;
+    ast->misses = 0;
 
-    return ast;
+    return arena->len++;
 }
 
 // -*-
-void cln_ast_add_node(Ast *parent, Ast *node){
-    Ast *self = parent->node;
-    self->parent = parent;
-    if(!self){
-        parent->node = node;
-        return;
+void cln_ast_add_node(AstArena *arena, uint32_t parent, uint32_t node){
+    Ast *self = &arena->nodes[parent];
+    if(!self->node){
+        self->node = (int32_t)(node - parent);
+    }else{
+        uint32_t last = parent + self->last;
+        arena->nodes[last].next = (int32_t)(node - last);
     }
-    while(self->next){
-        self = self->next;
+    self->last = (int32_t)(node - parent);
+}
+
+// -*- the finished tree, rooted at the first node
+Ast* cln_ast_arena_finish(AstArena *arena){
+    Ast *root = (Ast*)realloc(arena->nodes, sizeof(Ast)*arena->len);
+    if(!root){
+        cln_panic("CelineError: memory allocation failure\n");
+    }
+    cln_ast_arena_init(arena);
+    return root;
+}
+
+// -*- the whole tree at once
+void cln_ast_free(Ast *root){
+    if(!cln_cache_release(root)){
+        cln_dealloc(root);
     }
-    self->next = node;
 }
 
 // -
 static void _cln_dump_with_indent(Ast *ast, uint32_t indent){
-    for(Ast *node = ast; node; node = node->next){
+    for(Ast *node = ast; node; node = cln_ast_next(node)){
         for(uint32_t i=0; i < indent; ++i){
             printf(" ");
         }
@@ -255,7 +570,7 @@ static void _cln_dump_with_indent(Ast *ast, uint32_t indent){
         }
         printf("\n");
         if(node->node){
-            _cln_dump_with_indent(node->node, indent+1);
+            _cln_dump_with_indent(cln_ast_node(node), indent+1);
         }
     }
 }
@@ -269,126 +584,415 @@ void cln_dump(Ast *ast){
 // -*- Env                                                         -*-
 // -*---------------------------------------------------------------*-
 // -*-
-Env* cln_new_env(){
-    Env *env = (Env*)cln_alloc(sizeof(Env));
-    memset(env->idents, 0, sizeof(Object*)*CLN_MAX_IDENT);
-    env->parent = NULL;
+Env* cln_new_env(uint32_t nslot){
+    Env *env = (Env*)cln_slab_alloc(sizeof(Env) + sizeof(Value)*nslot);
+    env->nslot = nslot;
     return env;
 }
 
-// -*-
-bool cln_env_contains(Env *env, int id){
-    if(env->idents[id]){
-        return true;
+// -*- The globals are indexed by symbol id, and an import interns new
+// -*- symbols while code holding the env is running, so the env never
+// -*- moves: room for CLN_MAX_GLOBALS slots is reserved up front, only
+// -*- touched pages get memory, and `nslot` follows the symbol table.
+Env* cln_new_globals(uint32_t nslot){
+    size_t size = sizeof(Env) + sizeof(Value)*CLN_MAX_GLOBALS;
+#ifdef CLN_GLOBALS_MMAP
+    int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    Env *env = (Env*)mmap(NULL, size, PROT_READ|PROT_WRITE, flags, -1, 0);
+    if(env == MAP_FAILED){
+        cln_panic("CelineError: memory allocation failure\n");
     }
+#else
+    Env *env = (Env*)cln_alloc(size);
+#endif
+    cln_globals_reserve(env, nslot);
+    return env;
+}
 
-    return env->parent ? cln_env_contains(env->parent, id) : false;
+// -*- slots for symbol ids below `nslot`
+void cln_globals_reserve(Env *globals, uint32_t nslot){
+    if(nslot > CLN_MAX_GLOBALS){
+        cln_panic("CelineError: too many identifiers (%u)\n", nslot);
+    }
+    if(nslot > globals->nslot){
+        globals->nslot = nslot;
+    }
 }
 
-// -*-
-Object* cln_env_get(Env *env, int id){
-    if(env->idents[id]){
-        return env->idents[id];
+// -*- Frames no closure captures die with their call, in LIFO order:
+// -*- they are bumped off a stack of chunks that never move, so envs
+// -*- can be pointed to while the stack grows. Emptied chunks are kept
+// -*- for the next deeper call.
+typedef struct framechunk{
+    struct framechunk *prev;
+    struct framechunk *next;    // emptied, kept for reuse
+    Value *top;                 // first free word
+    Value *end;
+    Value words[];
+} FrameChunk;
+
+static FrameChunk *clnFrames;
+
+// -*- a chunk with room for `nword` more words on top of the current one
+static FrameChunk* _cln_frame_chunk(size_t nword){
+    FrameChunk *chunk = clnFrames ? clnFrames->next : NULL;
+    if(chunk && chunk->end - chunk->words < (ptrdiff_t)nword){
+        while(chunk){
+            FrameChunk *next = chunk->next;
+            cln_dealloc(chunk);
+            chunk = next;
+        }
     }
-    if(env->parent){
-        return cln_env_get(env->parent, id);
+    if(!chunk){
+        size_t size = nword > CLN_FRAME_CHUNK_WORDS ? nword : CLN_FRAME_CHUNK_WORDS;
+        chunk = (FrameChunk*)cln_alloc(sizeof(FrameChunk) + sizeof(Value)*size);
+        chunk->end = chunk->words + size;
+        chunk->next = NULL;
+        chunk->prev = clnFrames;
+        if(clnFrames){
+            clnFrames->next = chunk;
+        }
     }
-    cln_panic("ID #%d is not initialized\n", id);
-    return NULL; // never reached
+    chunk->top = chunk->words;
+    clnFrames = chunk;
+    return chunk;
 }
 
-// -*- set
-void cln_env_update(Env *env, int id, Object *obj){
-    if(cln_env_contains(env, id)){
-        while(!env->idents[id]){
-            env = env->parent;
+// -*- the env of a call, `frame` is the CLN_FRAME() layout of the callee
+Env* cln_new_frame(uint32_t frame, Env *parent){
+    uint32_t nslot = CLN_FRAME_NSLOT(frame);
+    Env *env;
+    if(frame & CLN_FRAME_CAPTURED){
+        env = cln_gc_new_env(nslot);
+    }else{
+        size_t nword = (sizeof(Env) + sizeof(Value)*nslot)/sizeof(Value);
+        FrameChunk *chunk = clnFrames;
+        if(!chunk || chunk->end - chunk->top < (ptrdiff_t)nword){
+            chunk = _cln_frame_chunk(nword);
         }
+        env = (Env*)chunk->top;
+        chunk->top += nword;
+        memset(env, 0, sizeof(Value)*nword);
+        env->nslot = nslot;
+    }
+    env->parent = parent;
+    return env;
+}
+
+// -*- on return, innermost frame first: captured frames are left to the
+// -*- collector
+void cln_free_frame(Env *env){
+    if(env->gcflags & CLN_GC_CAPTURED){
+        return;
+    }
+    clnFrames->top = (Value*)env;
+    if(clnFrames->top == clnFrames->words && clnFrames->prev){
+        clnFrames = clnFrames->prev;
+    }
+}
+
+// -*- globals
+Value cln_env_get(Env *env, int id){
+    if(env->slots[id]){
+        return env->slots[id];
     }
-    env->idents[id] = obj;
+    cln_panic("ID #%d is not initialized\n", id);
+    return CLN_NIL; // never reached
 }
 
 // -*-
-void cln_env_put(Env *env, int id, Object *obj){
-    env->idents[id] = obj;
+void cln_env_put(Env *env, int id, Value obj){
+    env->slots[id] = obj;
 }
 
 // -*---------------------------------------------------------------*-
 // -*- Module                                                      -*-
 // -*---------------------------------------------------------------*-
 
+// -*- A module is searched for, parsed (or compiled) and dlopen()ed at
+// -*- most once per process. Import names map to their module, and
+// -*- modules are keyed by canonical path, so a file reached under two
+// -*- names or through two search paths is one module. An import still
+// -*- runs the module each time, only the work before that is kept.
+// -*- With --lazy-imports, a module made only of named defs is scanned
+// -*- instead: its names are left unset and each def is parsed when its
+// -*- name is first read, see cln_module_lazy_def().
+typedef struct prefetch Prefetch;
+
+typedef struct{
+    char *path;                 // canonical
+    Ast *ast;                   // resolved tree, once imported by the tree walker
+    Proto *proto;               // bytecode, once imported by the vm
+    void *handle;               // of a native module, once loaded
+    ModuleDef *defs;            // top-level defs, once scanned for a lazy import
+    uint32_t ndef;
+    bool scanned;
+    bool lazy;                  // nothing but defs, so each can be parsed alone
+    Prefetch *prefetch;         // parsed ahead of its first import, see cln_module_prefetch()
+} Module;
+
+// -*- the def an unset global stands for until it is first read
+typedef struct{
+    Module *module;
+    const ModuleDef *def;
+} LazyGlobal;
+
+// -*- string keyed open addressing, kept at most half full
+typedef struct{
+    char **keys;                // owned
+    Module **modules;
+    uint32_t count;
+    uint32_t mask;
+} ModuleTable;
+
 Modules clnModules;
+static ModuleTable clnModulesByName;    // import name -> module, for the current search path
+static ModuleTable clnModulesByPath;
+static LazyGlobal *clnLazyGlobals;     // by symbol id
+static uint32_t clnLazyCap;
+
+// -*- hits and misses of each cache, for --module-stats
+enum ModuleCounter{ MODULE_FIND, MODULE_PARSE, MODULE_LOAD, MODULE_NCOUNTER };
+static const char *clnModuleCounterNames[] = {"find", "parse", "load"};
+static uint64_t clnModuleHits[MODULE_NCOUNTER];
+static uint64_t clnModuleMisses[MODULE_NCOUNTER];
+static uint64_t clnLazyDeferred;       // defs bound by a lazy import
+static uint64_t clnLazyParsed;         // of which were read, hence parsed
+static uint32_t clnPrefetchParsed;     // modules parsed ahead
+static uint32_t clnPrefetchThreads;
+static uint32_t clnPrefetchUsed;       // of which were imported
+
+// -*- index of `key`, or of the free slot it would take
+static uint32_t _cln_module_table_index(ModuleTable *table, const char *key){
+    uint32_t index = cln_hash(key, strlen(key)) & table->mask;
+    while(table->keys[index] && strcmp(table->keys[index], key)!=0){
+        index = (index + 1) & table->mask;
+    }
+    return index;
+}
 
 // -*-
-void cln_module_addpath(const char* name){
-    Path *mpath = clnModules.paths;
-    Path* module = (Path*)cln_alloc(sizeof(Path));
-    module->name = strdup(name);
-    module->name = NULL;
-    if(!mpath){
-        clnModules.paths = module;
-        return;
+static Module* _cln_module_table_get(ModuleTable *table, const char *key){
+    return table->keys ? table->modules[_cln_module_table_index(table, key)] : NULL;
+}
+
+// -*- `key` is copied
+static void _cln_module_table_put(ModuleTable *table, const char *key, Module *module){
+    if(!table->keys || 2*(table->count + 1) > table->mask + 1){
+        ModuleTable grown = {.mask = table->keys ? 2*table->mask + 1 : 15};
+        grown.keys = (char**)cln_alloc(sizeof(char*)*(grown.mask + 1));
+        grown.modules = (Module**)cln_alloc(sizeof(Module*)*(grown.mask + 1));
+        for(uint32_t i=0; table->keys && i <= table->mask; ++i){
+            if(table->keys[i]){
+                uint32_t index = _cln_module_table_index(&grown, table->keys[i]);
+                grown.keys[index] = table->keys[i];
+                grown.modules[index] = table->modules[i];
+            }
+        }
+        grown.count = table->count;
+        cln_dealloc(table->keys);
+        cln_dealloc(table->modules);
+        *table = grown;
     }
-    while(mpath->name){
-        mpath = mpath->next;
+    uint32_t index = _cln_module_table_index(table, key);
+    if(!table->keys[index]){
+        table->keys[index] = strdup(key);
+        ++table->count;
     }
-    mpath->next = module;
+    table->modules[index] = module;
 }
 
-// -*-
-bool _cln_file_exists(const char* fname){
-    FILE *stream = fopen(fname, "r");
-    if(!stream){
-        return false;
+// -*- the modules themselves stay in clnModulesByPath
+static void _cln_module_table_clear(ModuleTable *table){
+    for(uint32_t i=0; table->keys && i <= table->mask; ++i){
+        cln_dealloc(table->keys[i]);
     }
-    fclose(stream);
-    return true;
+    cln_dealloc(table->keys);
+    cln_dealloc(table->modules);
+    memset(table, 0, sizeof(ModuleTable));
 }
 
-// -*-
-static char* _cln_find_module(const char* name){
-    char moduleFilename[CLN_PATHLEN];
-    char buffer[CLN_PATHLEN];
-    bool found = false;
+// -*- `name` is a directory, ending with '/'
+void cln_module_addpath(const char* name){
+    Path *path = (Path*)cln_alloc(sizeof(Path));
+    path->name = strdup(name);
+    Path **link = &clnModules.paths;
+    while(*link){
+        link = &(*link)->next;
+    }
+    *link = path;
+    _cln_module_table_clear(&clnModulesByName);     // names may resolve elsewhere now
+}
+
+// -*- the module `name` is found at on the search path; unless `required`,
+// -*- NULL rather than an error when there is not exactly one
+static Module* _cln_find_module(const char* name, bool required){
+    Module *module = _cln_module_table_get(&clnModulesByName, name);
+    if(module){
+        ++clnModuleHits[MODULE_FIND];
+        return module;
+    }
+    ++clnModuleMisses[MODULE_FIND];
+    char *found = NULL;
     for(Path *node = clnModules.paths; node; node = node->next){
-        strcpy(buffer, node->name);     // dirname
-        strcat(buffer, name);           // filename
-        if(_cln_file_exists(buffer)){
-            if(found){
-                cln_panic(
-                    "Ambiguous module name: %s\n"
-                    "Found at %s\n"
-                    "Found at %s\n",
-                    name, buffer, moduleFilename
-                );
-            }
-            strcpy(moduleFilename, buffer);
-            found = true;
+        char *filename = (char*)cln_alloc(strlen(node->name) + strlen(name) + 1);
+        strcpy(filename, node->name);   // dirname
+        strcat(filename, name);         // filename
+        char *canonical = realpath(filename, NULL);
+        cln_dealloc(filename);
+        if(!canonical){
+            continue;
+        }
+        if(found && strcmp(found, canonical)!=0 && !required){
+            cln_dealloc(found);
+            cln_dealloc(canonical);
+            return NULL;
+        }
+        if(found && strcmp(found, canonical)!=0){
+            cln_panic(
+                "Ambiguous module name: %s\n"
+                "Found at %s\n"
+                "Found at %s\n",
+                name, canonical, found
+            );
+        }
+        if(found){
+            cln_dealloc(canonical);
+        }else{
+            found = canonical;
         }
     }
 
+    if(!found && !required){
+        return NULL;
+    }
     if(!found){
         cln_panic("CelineError: module not found: %s\n", name);
     }
-
-    return strdup(moduleFilename);
+    module = _cln_module_table_get(&clnModulesByPath, found);
+    if(module){
+        cln_dealloc(found);
+    }else{
+        module = (Module*)cln_alloc(sizeof(Module));
+        module->path = found;
+        _cln_module_table_put(&clnModulesByPath, found, module);
+    }
+    _cln_module_table_put(&clnModulesByName, name, module);
+    if(clnOptions.verbose){
+        printf("Found module %s at %s\n", name, module->path);
+    }
+    return module;
 }
 
+static Ast* _cln_prefetch_take(Module *module, Symtable *symtable);
+
 // -*-
+static Ast* _cln_module_parse(Module *module, Symtable *symtable){
+    Ast *ast = _cln_prefetch_take(module, symtable);
+    if(!ast){
+        ast = cln_parse_cached(module->path, symtable);
+    }
+    cln_resolve(ast, symtable, false);
+    if(!clnOptions.noOptimize){
+        cln_infer(ast, symtable, false);
+    }
+    return ast;
+}
+
+// -*- the resolved tree of a source module, parsed on its first import
 Ast* cln_module_import(const char* name, Symtable* symtable){
-    char* modulePath = _cln_find_module(name);
-    // 
-    printf("Found module %s at %s\n", name, modulePath);
-    return cln_parse(modulePath, symtable);
+    Module *module = _cln_find_module(name, true);
+    if(module->ast){
+        ++clnModuleHits[MODULE_PARSE];
+        return module->ast;
+    }
+    ++clnModuleMisses[MODULE_PARSE];
+    module->ast = _cln_module_parse(module, symtable);
+    return module->ast;
 }
 
-// -*-
+// -*- the bytecode of a source module, compiled on its first import
+Proto* cln_module_compile(const char* name, Symtable* symtable){
+    Module *module = _cln_find_module(name, true);
+    if(module->proto){
+        ++clnModuleHits[MODULE_PARSE];
+        return module->proto;
+    }
+    ++clnModuleMisses[MODULE_PARSE];
+    Ast *ast = _cln_module_parse(module, symtable);
+    module->proto = cln_compile(ast, symtable);
+    cln_ast_free(ast);
+    return module->proto;
+}
+
+// -*- unsets the names a module defines, to be bound on first read; false
+// -*- when the module runs more than defs and must be imported as usual
+bool cln_module_import_lazy(const char* name, Symtable* symtable, Env *globals){
+    Module *module = _cln_find_module(name, true);
+    if(!module->scanned){
+        module->scanned = true;
+        module->lazy = cln_parse_defs(module->path, symtable, &module->defs, &module->ndef);
+    }
+    if(!module->lazy){
+        return false;
+    }
+    cln_globals_reserve(globals, symtable->len);
+    if(clnLazyCap < symtable->len){
+        uint32_t cap = clnLazyCap ? clnLazyCap : 64;
+        while(cap < symtable->len){
+            cap *= 2;
+        }
+        clnLazyGlobals = (LazyGlobal*)realloc(clnLazyGlobals, sizeof(LazyGlobal)*cap);
+        if(!clnLazyGlobals){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+        memset(clnLazyGlobals + clnLazyCap, 0, sizeof(LazyGlobal)*(cap - clnLazyCap));
+        clnLazyCap = cap;
+    }
+    // - a later def of the same name wins, as it would when run
+    for(uint32_t i=0; i < module->ndef; ++i){
+        const ModuleDef *def = &module->defs[i];
+        globals->slots[def->symbol] = CLN_NIL;
+        clnLazyGlobals[def->symbol] = (LazyGlobal){module, def};
+        ++clnLazyDeferred;
+    }
+    return true;
+}
+
+// -*- the resolved program binding the global `id`, when it was left unset
+// -*- by a lazy import, NULL otherwise. Each def is handed out once: the
+// -*- caller runs it, and keeps the tree for as long as the function lives.
+Ast* cln_module_lazy_def(uint32_t id, Symtable* symtable){
+    if(id >= clnLazyCap || !clnLazyGlobals[id].module){
+        return NULL;
+    }
+    LazyGlobal lazy = clnLazyGlobals[id];
+    clnLazyGlobals[id].module = NULL;
+    ++clnLazyParsed;
+    Ast *ast = cln_parse_def(lazy.module->path, symtable, lazy.def);
+    cln_resolve(ast, symtable, false);
+    if(!clnOptions.noOptimize){
+        cln_infer(ast, symtable, false);
+    }
+    return ast;
+}
+
+// -*- a native module binds its globals into `env` on its first load
 void cln_module_load(const char* name, Symtable *symbtable, Env *env){
-    char* modulePath = _cln_find_module(name);
-    void *handle = dlopen(modulePath, RTLD_LAZY);
+    Module *module = _cln_find_module(name, true);
+    if(module->handle){
+        ++clnModuleHits[MODULE_LOAD];
+        return;
+    }
+    ++clnModuleMisses[MODULE_LOAD];
+    void *handle = dlopen(module->path, RTLD_LAZY);
     if(!handle){
         cln_panic(
             "CelineError: failed to load module: %s: %s\n",
-            modulePath, dlerror()
+            module->path, dlerror()
         );
     }
 
@@ -398,9 +1002,223 @@ void cln_module_load(const char* name, Symtable *symbtable, Env *env){
     if(emsg){
         cln_panic(
             "CelineError: failed to load module %s: %s\n",
-            modulePath, emsg
+            module->path, emsg
         );
     }
+    module->handle = handle;
     initfn(symbtable, env);
-    cln_dealloc(modulePath);
+    cln_globals_reserve(env, symbtable->len);
+}
+
+// -*-
+void cln_module_print_stats(FILE *stream){
+    fprintf(stream, "modules: %u found\n", clnModulesByPath.count);
+    for(int i=0; i < MODULE_NCOUNTER; ++i){
+        fprintf(
+            stream, "modules: %s: %llu hits, %llu misses\n", clnModuleCounterNames[i],
+            (unsigned long long)clnModuleHits[i], (unsigned long long)clnModuleMisses[i]
+        );
+    }
+    if(clnOptions.lazyImports){
+        fprintf(
+            stream, "modules: lazy defs: %llu deferred, %llu parsed\n",
+            (unsigned long long)clnLazyDeferred, (unsigned long long)clnLazyParsed
+        );
+    }
+    fprintf(
+        stream, "modules: parsed ahead: %u on %u threads, %u imported\n",
+        clnPrefetchParsed, clnPrefetchThreads, clnPrefetchUsed
+    );
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Module prefetch                                             -*-
+// -*---------------------------------------------------------------*-
+// -*- Import names are literals, so the modules a program may import are
+// -*- known before it runs. They are parsed ahead on a pool of threads,
+// -*- each into a detached tree with a symbol table of its own, while the
+// -*- main thread follows the imports of each module in the order they
+// -*- were found. The program then runs as it would have: an import
+// -*- attaches the tree it finds ready, interning its symbols then and in
+// -*- source order, so neither symbol ids nor the order of evaluation
+// -*- depend on the threads. A module that does not parse is left to its
+// -*- import, which reports the error where it always did.
+struct prefetch{
+    Module *module;
+    Ast *ast;                   // detached, NULL when cached or on error
+    Symtable *symtable;         // of `ast`
+    char **imports;             // names, owned
+    uint32_t nimport;
+    bool done;
+};
+
+static struct{
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a job is queued, or the pool stops
+    pthread_cond_t done;        // a job is done
+    Prefetch **jobs;            // in the order their modules were found
+    uint32_t njob;
+    uint32_t cap;
+    uint32_t next;              // first job no worker took yet
+    bool stop;
+    pthread_t *threads;
+    uint32_t nthread;
+    uint32_t maxthread;
+} clnPrefetch = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+
+// -*- the import names of `ast`, in any kind of tree
+static void _cln_prefetch_imports(Prefetch *job, Ast *ast){
+    for(Ast *node = ast; node; node = cln_ast_next(node)){
+        if(node->akind == AST_IMPORT && cln_is_object(node->obj)){
+            job->imports = (char**)realloc(job->imports, sizeof(char*)*(job->nimport + 1));
+            if(!job->imports){
+                cln_panic("CelineError: memory allocation failure\n");
+            }
+            job->imports[job->nimport++] = strdup(cln_as_object(node->obj)->val.cstr);
+        }
+        _cln_prefetch_imports(job, cln_ast_node(node));
+    }
+}
+
+// -*- on a worker: what a failed parse held is not reclaimed, its import
+// -*- ends the program anyway
+static void _cln_prefetch_run(Prefetch *job){
+    jmp_buf handler;
+    if(setjmp(handler)){
+        clnPanicHandler = NULL;
+        job->ast = NULL;
+        return;
+    }
+    clnPanicHandler = &handler;
+    if(clnOptions.noCache || !cln_cache_imports(job->module->path, &job->imports, &job->nimport)){
+        job->symtable = cln_new_symtable();
+        job->ast = cln_parse_detached(job->module->path, job->symtable);
+        _cln_prefetch_imports(job, job->ast);
+    }
+    clnPanicHandler = NULL;
+}
+
+// -*-
+static void* _cln_prefetch_worker(void *arg){
+    (void)arg;
+    pthread_mutex_lock(&clnPrefetch.lock);
+    for(;;){
+        while(clnPrefetch.next == clnPrefetch.njob && !clnPrefetch.stop){
+            pthread_cond_wait(&clnPrefetch.work, &clnPrefetch.lock);
+        }
+        if(clnPrefetch.next == clnPrefetch.njob){
+            break;
+        }
+        Prefetch *job = clnPrefetch.jobs[clnPrefetch.next++];
+        pthread_mutex_unlock(&clnPrefetch.lock);
+        _cln_prefetch_run(job);
+        pthread_mutex_lock(&clnPrefetch.lock);
+        job->done = true;
+        pthread_cond_broadcast(&clnPrefetch.done);
+    }
+    pthread_mutex_unlock(&clnPrefetch.lock);
+    return NULL;
+}
+
+// -*- a job for the module `name`, unless it has one or was parsed already
+static void _cln_prefetch_queue(const char *name){
+    Module *module = _cln_find_module(name, false);
+    if(!module || module->prefetch || module->ast || module->proto){
+        return;
+    }
+    Prefetch *job = (Prefetch*)cln_alloc(sizeof(Prefetch));
+    job->module = module;
+    module->prefetch = job;
+    pthread_mutex_lock(&clnPrefetch.lock);
+    if(clnPrefetch.njob == clnPrefetch.cap){
+        clnPrefetch.cap = clnPrefetch.cap ? 2*clnPrefetch.cap : 16;
+        clnPrefetch.jobs = (Prefetch**)realloc(clnPrefetch.jobs, sizeof(Prefetch*)*clnPrefetch.cap);
+        if(!clnPrefetch.jobs){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    clnPrefetch.jobs[clnPrefetch.njob++] = job;
+    pthread_cond_signal(&clnPrefetch.work);
+    pthread_mutex_unlock(&clnPrefetch.lock);
+    // - a thread per job, up to one per core
+    if(clnPrefetch.nthread < clnPrefetch.maxthread &&
+       pthread_create(&clnPrefetch.threads[clnPrefetch.nthread], NULL, _cln_prefetch_worker, NULL) == 0){
+        ++clnPrefetch.nthread;
+    }
+}
+
+// -*- parses the modules `root` may import, and theirs, before it runs.
+// -*- Off with --parse-jobs=1, and with --lazy-imports, which would rather
+// -*- not parse them at all.
+void cln_module_prefetch(Ast *root){
+    long nthread = clnOptions.parseJobs ? (long)clnOptions.parseJobs : sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthread <= 1 || clnOptions.lazyImports){
+        return;
+    }
+    clnPrefetch.maxthread = nthread < CLN_MAX_PARSE_JOBS ? (uint32_t)nthread : CLN_MAX_PARSE_JOBS;
+    clnPrefetch.threads = (pthread_t*)cln_alloc(sizeof(pthread_t)*clnPrefetch.maxthread);
+    Prefetch program = {0};
+    _cln_prefetch_imports(&program, root);
+    for(uint32_t i=0; i < program.nimport; ++i){
+        _cln_prefetch_queue(program.imports[i]);
+        free(program.imports[i]);
+    }
+    free(program.imports);
+
+    // - only this thread adds jobs, so it reads them without the lock
+    for(uint32_t i=0; i < clnPrefetch.njob; ++i){
+        Prefetch *job = clnPrefetch.jobs[i];
+        pthread_mutex_lock(&clnPrefetch.lock);
+        while(!job->done){
+            pthread_cond_wait(&clnPrefetch.done, &clnPrefetch.lock);
+        }
+        pthread_mutex_unlock(&clnPrefetch.lock);
+        for(uint32_t k=0; k < job->nimport; ++k){
+            _cln_prefetch_queue(job->imports[k]);
+            free(job->imports[k]);
+        }
+        free(job->imports);
+        job->imports = NULL;
+        job->nimport = 0;
+        clnPrefetchParsed += job->ast != NULL;
+    }
+
+    pthread_mutex_lock(&clnPrefetch.lock);
+    clnPrefetch.stop = true;
+    pthread_cond_broadcast(&clnPrefetch.work);
+    pthread_mutex_unlock(&clnPrefetch.lock);
+    for(uint32_t i=0; i < clnPrefetch.nthread; ++i){
+        pthread_join(clnPrefetch.threads[i], NULL);
+    }
+    clnPrefetchThreads += clnPrefetch.nthread;
+    cln_dealloc(clnPrefetch.threads);
+    cln_dealloc(clnPrefetch.jobs);
+    clnPrefetch.threads = NULL;
+    clnPrefetch.jobs = NULL;
+    clnPrefetch.njob = clnPrefetch.cap = clnPrefetch.next = clnPrefetch.nthread = 0;
+    clnPrefetch.stop = false;
+}
+
+// -*- the tree parsed ahead for `module`, attached as cln_parse_cached()
+// -*- would have returned it; NULL when there is none
+static Ast* _cln_prefetch_take(Module *module, Symtable *symtable){
+    Prefetch *job = module->prefetch;
+    if(!job){
+        return NULL;
+    }
+    module->prefetch = NULL;
+    Ast *ast = NULL;
+    if(job->ast){
+        ast = cln_cache_adopt(module->path, job->ast, job->symtable, symtable);
+        ++clnPrefetchUsed;
+    }
+    if(job->symtable){
+        cln_free_symtable(job->symtable);
+    }
+    cln_dealloc(job);
+    return ast;
 }
\ No newline at end of file
@@ -3,19 +3,20 @@
 
 #include<stdbool.h>
 #include<stddef.h>
+#include<setjmp.h>
 #include<stdarg.h>
 #include<stdint.h>
 #include<stdlib.h>
 #include<stdio.h>
 
-#define CLN_MAX_NUMID           255
-#define CLN_MAX_IDENT           255
-#define CLN_MAX_TOKLEN          255
-#define CLN_BUFSIZE             4096
+#define CLN_MAX_GLOBALS         (1u << 24)  // symbol ids the globals env reserves room for
 #define CLN_RETURN_ID           0
 #define CLN_SELF_ID             1
+#define CLN_ARGS_SLOT           2       // first parameter of a call frame
+#define CLN_MAX_LOCALS          255
+#define CLN_MAX_NESTING         255
 #define CLN_BUILTIN_MAXARGS     10
-#define CLN_PROTOTYPE           "prototype"
+#define CLN_MAX_PARSE_JOBS      256     // threads parsing imports ahead, at most
 #define CLN_COMMENT             '#'
 
 // -*-
@@ -36,8 +37,15 @@ static inline void cln_dealloc(void *ptr){
     ptr = NULL;
 }
 
+// -*- set by a thread whose errors someone else reports: a parse worker
+// -*- gives up on the module, which is parsed again when it is imported
+extern _Thread_local jmp_buf *clnPanicHandler;
+
 // -*-
 static inline void cln_panic(const char* fmt, ...){
+    if(clnPanicHandler){
+        longjmp(*clnPanicHandler, 1);
+    }
     va_list args;
     va_start(args, fmt);
     vfprintf(stderr, fmt, args);
@@ -51,23 +59,59 @@ static inline void cln_panic(const char* fmt, ...){
 typedef struct ast Ast;
 typedef struct env Env;
 typedef struct object Object;
-typedef struct field Field;     // KeyValue
+typedef struct atom Atom;       // interned field name
+typedef struct shape Shape;     // hidden class
+typedef struct shapetable ShapeTable;
 typedef struct path Path;
+typedef struct proto Proto;
+typedef struct jitcode JitCode;
 typedef void (*CFun)(Env*);
 
+// -*-----------------------------------------------------------------*-
+// -*- Options                                                       -*-
+// -*-----------------------------------------------------------------*-
+typedef struct{
+    bool verbose;           // module directory, symbol table and ast dumps
+    bool treeWalker;        // evaluate the Ast directly instead of bytecode
+    bool dumpCode;          // disassemble the compiled bytecode
+    bool gcStats;           // report collector statistics on exit
+    bool noOptimize;        // skip the syntax tree optimizer
+    bool dumpAst;           // print the syntax tree as it is run
+    bool noCache;           // parse every source, neither reading nor writing .clnc files
+    bool moduleStats;       // report module registry hits and misses on exit
+    bool lazyImports;       // parse an imported def on the first read of its name
+    uint32_t parseJobs;     // threads parsing the imports ahead, 0 for one per core, 1 when off
+    uint32_t jitThreshold;  // calls before a function is compiled to machine code, 0 when off
+} Options;
+
+extern Options clnOptions;
+
 // -*-----------------------------------------------------------------*-
 // -*- Symtable -> (IDTable)                                         -*-
 // -*-----------------------------------------------------------------*-
-// -*- IDTable
+// -*- IDTable: names interned to dense ids, in order of appearance, and
+// -*- an open addressing index over them
 typedef struct{
-    char* symbols[CLN_MAX_NUMID];
+    char **symbols;             // by id
+    uint32_t *hashes;           // by id
     uint32_t len;               // count
+    uint32_t cap;
+    uint32_t *index;            // id + 1, 0 when free
+    uint32_t mask;              // index size - 1
 } Symtable;
 
 
 // -*-
 Symtable* cln_new_symtable();
+void cln_free_symtable(Symtable *table);
+uint32_t cln_hash(const char *str, size_t len);
 uint32_t cln_get_symbol_index(Symtable* table, const char* symbol);
+uint32_t cln_get_symbol_slice(Symtable* table, const char* symbol, size_t len);
+
+// -*-
+void cln_readlong(long *num);
+void cln_readfloat(double *num);
+void cln_readstring(char **str);
 
 // -*-----------------------------------------------------------------*-
 // -*- Type -> (IDTable)                                             -*-
@@ -82,47 +126,357 @@ enum Type{
     TY_CFUN,            // <Foreign Function>
 };
 
+// -*-----------------------------------------------------------------*-
+// -*- Value                                                         -*-
+// -*-----------------------------------------------------------------*-
+// -*- NaN-boxed 64-bit value, classified by the top 16 bits:
+// -*-   0x0000        heap Object pointer (0 itself is nil/unset)
+// -*-   0xffff        immediate 48-bit signed integer
+// -*-   otherwise     IEEE double, stored with CLN_DOUBLE_OFFSET added
+// -*- Integers outside the 48-bit range are boxed into a TY_INTEGER Object.
+typedef uint64_t Value;
+
+#define CLN_NIL                 ((Value)0)
+#define CLN_TAG_MASK            0xffff000000000000ULL
+#define CLN_TAG_INTEGER         0xffff000000000000ULL
+#define CLN_PAYLOAD_MASK        0x0000ffffffffffffULL
+#define CLN_DOUBLE_OFFSET       0x0001000000000000ULL
+#define CLN_CANONICAL_NAN       0x7ff8000000000000ULL
+#define CLN_INTEGER_MIN         (-(1L << 47))
+#define CLN_INTEGER_MAX         ((1L << 47) - 1)
+
 // -
 struct object{
     enum Type type;
+    uint8_t gcflags;    // CLN_GC_*
+    bool isPrototype;   // has been stored as some object's prototype
+    Object *gcnext;     // next object of the same heap space
     union{
-        long integer;       // integer
+        long integer;       // integer (boxed, outside the immediate range)
         double real;        // float
         char* cstr;         // string
         struct{
-            Object **data;  // data
+            Value *data;    // data
             size_t len;     // size
         } array ;
         // - function -
         struct {
             int narg;
-            int *args;
             Ast *code;
+            Env *closure;   // frame of the defining function, when it is captured
+            Proto *proto;   // bytecode, NULL under the tree walker
+            Shape *instanceShape;   // layout of the last `new` object
+            const char *name;       // NULL for anonymous functions
+            uint32_t calls;         // tree walker invocations, until it is compiled
+            JitCode *jit;           // machine code, once hot
         } fun;
     }val;               // v
-    Field **fields;
-    size_t ftcap;       // field_table_length
-    size_t nfield;
+    Shape *shape;       // field layout
+    Value *slots;       // field values, NULL until the first field is set
+    uint32_t slotcap;
 };
 
-struct field{
-    char *name;     // key
-    Object* obj;
+// -*- Field names are interned once: equal names are the same Atom, so
+// -*- they compare by pointer and layouts hash them by address.
+struct atom{
+    const char *name;
+    uint32_t len;
+    uint32_t hash;              // of `name`, for the intern table
 };
 
+// -*- field names the runtime itself uses
+#define CLN_ATOMS                       \
+    CLN_DEF(PROTOTYPE, "prototype")     \
+    CLN_DEF(LEN, "len")
+
+enum AtomId{
+#define CLN_DEF(id, name)       ATOM_##id,
+    CLN_ATOMS
+#undef CLN_DEF
+};
+
+extern Atom clnAtoms[];
+#define CLN_ATOM(id)            (&clnAtoms[ATOM_##id])
+
+Atom* cln_atom(const char *name);
+Atom* cln_atom_slice(const char *name, size_t len);
+
+// -*- field layout shared by all objects built by the same field additions
+struct shape{
+    Shape *parent;
+    Atom *name;                 // field added on top of parent, NULL for the root
+    uint32_t nslot;             // fields in this layout, `name` lives in nslot-1
+    ShapeTable *table;          // name -> slot, NULL while the chain is short
+    Shape **transitions;        // child shapes, one per added field name
+    uint32_t ntransition;
+    uint32_t transitioncap;
+};
+
+// -*-
+static inline bool cln_is_integer(Value v){
+    return (v & CLN_TAG_MASK) == CLN_TAG_INTEGER;
+}
+
+// -*-
+static inline bool cln_is_object(Value v){
+    return v != CLN_NIL && (v & CLN_TAG_MASK) == 0;
+}
+
+// -*-
+static inline bool cln_is_float(Value v){
+    return (v & CLN_TAG_MASK) != 0 && !cln_is_integer(v);
+}
+
+// -*-
+static inline Value cln_object_value(Object *obj){
+    return (Value)(uintptr_t)obj;
+}
+
+// -*-
+static inline Object* cln_as_object(Value v){
+    return (Object*)(uintptr_t)v;
+}
+
+// -*-
+static inline double cln_as_float(Value v){
+    union{ uint64_t bits; double num; } u;
+    u.bits = v - CLN_DOUBLE_OFFSET;
+    return u.num;
+}
+
+// -*- immediate or boxed
+static inline long cln_as_integer(Value v){
+    if(cln_is_integer(v)){
+        return ((int64_t)(v << 16)) >> 16;
+    }
+    return cln_as_object(v)->val.integer;
+}
+
+Object* cln_box_integer(long num);
+
+// -*-
+static inline Value cln_new_integer(long num){
+    if(num >= CLN_INTEGER_MIN && num <= CLN_INTEGER_MAX){
+        return CLN_TAG_INTEGER | ((uint64_t)num & CLN_PAYLOAD_MASK);
+    }
+    return cln_object_value(cln_box_integer(num));
+}
+
+// -*-
+static inline Value cln_new_float(double num){
+    union{ uint64_t bits; double num; } u;
+    u.num = num;
+    if(num != num){
+        u.bits = CLN_CANONICAL_NAN;
+    }
+    return u.bits + CLN_DOUBLE_OFFSET;
+}
+
+// -*-
+static inline enum Type cln_typeof(Value v){
+    if(cln_is_integer(v)){
+        return TY_INTEGER;
+    }
+    if(cln_is_float(v)){
+        return TY_FLOAT;
+    }
+    if(v == CLN_NIL){
+        cln_panic("CelineError: use of an undefined value\n");
+    }
+    return cln_as_object(v)->type;
+}
+
+void cln_typeerror(Value v, enum Type type);
+
+// -*-
+static inline void cln_checktype(Value v, enum Type type){
+    if(cln_typeof(v) != type){
+        cln_typeerror(v, type);
+    }
+}
+
+// -*- heap values only: immediates cannot carry fields
+static inline Object* cln_checkobject(Value v){
+    if(!cln_is_object(v)){
+        cln_panic("TypeError: expected an object, got %d\n", cln_typeof(v));
+    }
+    return cln_as_object(v);
+}
+
+// -*- while/if conditions
+static inline bool cln_is_true(Value v){
+    if(cln_is_integer(v)){
+        return v != CLN_TAG_INTEGER;
+    }
+    if(cln_is_float(v)){
+        return cln_as_float(v) != 0.0;
+    }
+    return v != CLN_NIL && (cln_as_object(v)->type != TY_INTEGER || cln_as_object(v)->val.integer);
+}
+
 // -
-void cln_checktype(Object *obj, enum Type type);
-char* cln_toString(const Object *self);
-Object* cln_new_integer(long num);
-Object* cln_new_float(double num);
+char* cln_toString(Value self);
 Object* cln_new_string(char *cstr);
-Object* cln_new_fun(int *args, int narg, Ast *code);
+Object* cln_new_fun(int narg, Ast *code);
 Object* cln_new_array(size_t len);
 Object* cln_new();
-uint32_t cln_hash(const char* cstr, size_t tableLen);
-void cln_set_field(Object *self, const char* name, Object *obj);
-Object* cln_get_field(Object *self, const char* name);
-Object* cln_get_field_generic(Object *self, const char* name, bool checkproto);
+Shape* cln_root_shape();
+int cln_shape_lookup(Shape *shape, Atom *name);
+void cln_reserve_slots(Object *self, uint32_t nslot);
+Object* cln_new_instance(Value ctor);
+void cln_finish_instance(Value ctor, Object *self);
+void cln_set_field(Object *self, Atom *name, Value obj);
+Value cln_get_field(Object *self, Atom *name);
+Value cln_get_field_generic(Object *self, Atom *name, bool checkproto);
+
+// -*- inline cache of one field access site: the receiver layouts seen
+// -*- there and where the field was found for each of them. Prototype
+// -*- hits also depend on clnProtoEpoch, bumped whenever an object used
+// -*- as a prototype changes its layout or its own prototype, or dies.
+// -*- Assignment sites only record own slots, which they overwrite.
+#define CLN_IC_ENTRIES          4
+
+typedef struct{
+    Shape *shape;               // receiver layout
+    Object *holder;             // prototype holding the field, NULL for an own slot
+    Value proto;                // receiver prototype when the entry was filled
+    uint32_t protoSlot;         // of `prototype` in the receiver
+    uint32_t slot;              // of the field, in the receiver or the holder
+    uint32_t epoch;
+} FieldCacheEntry;
+
+typedef struct{
+    Atom *name;
+    uint8_t count;              // 1: monomorphic, more: polymorphic
+    bool megamorphic;           // too many layouts, always looked up
+    FieldCacheEntry entries[CLN_IC_ENTRIES];
+} FieldCache;
+
+extern FieldCache *clnFieldCaches;
+extern uint32_t clnProtoEpoch;
+
+uint32_t cln_new_field_cache(Atom *name);
+Value cln_field_cache_miss(Object *self, FieldCache *cache);
+void cln_set_field_cached(Object *self, FieldCache *cache, Value obj);
+
+// -*- caches are referred to by index, the pool grows as sites are compiled
+static inline FieldCache* cln_field_cache(uint32_t index){
+    return &clnFieldCaches[index];
+}
+
+// -*- cln_get_field() through the cache of a site
+static inline Value cln_get_field_cached(Object *self, FieldCache *cache){
+    for(uint8_t i=0; i < cache->count; ++i){
+        FieldCacheEntry *entry = &cache->entries[i];
+        if(entry->shape != self->shape){
+            continue;
+        }
+        if(!entry->holder){
+            return self->slots[entry->slot];
+        }
+        if(entry->epoch == clnProtoEpoch && self->slots[entry->protoSlot] == entry->proto){
+            return entry->holder->slots[entry->slot];
+        }
+        break;
+    }
+    return cln_field_cache_miss(self, cache);
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Slab allocator                                              -*-
+// -*---------------------------------------------------------------*-
+// -*- Objects, envs, shapes and the slot and array vectors of objects are
+// -*- carved out of mapped chunks by size class (see clnslab.c). Blocks
+// -*- carry no header: they are freed with the size they were allocated.
+void* cln_slab_alloc(size_t size);
+void cln_slab_free(void *ptr, size_t size);
+void* cln_slab_realloc(void *ptr, size_t oldSize, size_t newSize);
+void cln_slab_print_stats(FILE *stream);
+
+// -*---------------------------------------------------------------*-
+// -*- GC                                                          -*-
+// -*---------------------------------------------------------------*-
+// -*- Generational mark & sweep (see clngc.c). Collections only happen
+// -*- at safepoints, where every live value is reachable from an env
+// -*- registered with cln_gc_push_env(), the VM registers and frames,
+// -*- the temporary root stack, or a slot passed to cln_gc_add_root().
+#define CLN_GC_MARKED           0x01
+#define CLN_GC_OLD              0x02    // survived a collection
+#define CLN_GC_REMEMBERED       0x04    // in the remembered set
+#define CLN_GC_PERMANENT        0x08    // syntax tree constant
+#define CLN_GC_CAPTURED         0x10    // env owned by the collector
+
+typedef struct{
+    size_t minor;               // nursery collections
+    size_t major;               // full collections
+    size_t youngBytes;          // nursery
+    size_t oldBytes;            // mature space
+    size_t permanentBytes;      // constants, never collected
+    size_t peakBytes;
+    size_t allocatedBytes;      // since startup
+    size_t freedBytes;
+    size_t promotedBytes;
+    double pauseMs;
+} GCStats;
+
+// -*- values held by C locals of the tree walker across a safepoint
+typedef struct{
+    Value *values;
+    size_t len;
+    size_t cap;
+} GCRoots;
+
+extern GCStats clnGCStats;
+extern GCRoots clnGCRoots;
+extern bool clnGCRequested;
+
+Object* cln_gc_new_object();
+void cln_gc_account(Object *obj, long bytes);
+Value cln_gc_permanent(Value v);
+void cln_gc_remember(Object *obj);
+void cln_gc_push_env(Env *env);
+void cln_gc_pop_env();
+void cln_gc_add_root(Value *slot);
+void cln_gc_grow_roots();
+void cln_gc_mark(Value v);
+void cln_gc_mark_env(Env *env);
+Env* cln_gc_new_env(uint32_t nslot);
+void cln_gc_collect(bool major);
+void cln_gc_collect_pending();
+void cln_gc_print_stats(FILE *stream);
+
+// -*- after storing `v` into `owner`
+static inline void cln_gc_barrier(Object *owner, Value v){
+    if((owner->gcflags & (CLN_GC_OLD|CLN_GC_REMEMBERED)) == CLN_GC_OLD &&
+            cln_is_object(v) && !(cln_as_object(v)->gcflags & CLN_GC_OLD)){
+        cln_gc_remember(owner);
+    }
+}
+
+// -*-
+static inline void cln_gc_safepoint(){
+    if(clnGCRequested){
+        cln_gc_collect_pending();
+    }
+}
+
+// -*-
+static inline size_t cln_gc_root_mark(){
+    return clnGCRoots.len;
+}
+
+// -*-
+static inline void cln_gc_push_root(Value v){
+    if(clnGCRoots.len == clnGCRoots.cap){
+        cln_gc_grow_roots();
+    }
+    clnGCRoots.values[clnGCRoots.len++] = v;
+}
+
+// -*-
+static inline void cln_gc_pop_roots(size_t mark){
+    clnGCRoots.len = mark;
+}
 
 // -*---------------------------------------------------------------*-
 // -*- Ast                                                         -*-
@@ -162,6 +516,8 @@ Object* cln_get_field_generic(Object *self, const char* name, bool checkproto);
     CLN_DEF(OBJECT, "object")       \
     CLN_DEF(IMPORT, "import")       \
     CLN_DEF(NEW, "new")             \
+    CLN_DEF(TAILCALL, "tailcall")   \
+    CLN_DEF(TAILMCALL, "tailmcall") \
     CLN_DEF(LOAD, "load")           \
     CLN_DEF(EMPTY, "@empty")
 
@@ -172,44 +528,166 @@ enum AstKind {
 #undef CLN_DEF
 };
 
-#define CLN_NONE    NULL
+#define CLN_NONE    CLN_NIL
 
-// -*-
+// -*- The nodes of one parse live contiguously in a single allocation,
+// -*- the root first. Links are offsets relative to the node itself, 0
+// -*- for none, so they survive the arena growing while it is built.
 struct ast{
-    enum AstKind akind;
-    Object *obj;
-    // -
-    Ast *node;
-    Ast *next;
-    Ast *parent;
+    Value obj;
+    int32_t node;           // first child
+    int32_t next;           // next sibling
+    int32_t last;           // last child, appends are O(1)
+    uint32_t aux;           // per-site data of the evaluator, 0 until used
+    uint8_t akind;          // enum AstKind
+    uint8_t type;           // proven type of the value, CLN_TYPE_*
+    uint8_t quick;          // specialized variant the tree walker runs, CLN_QUICK_*
+    uint8_t misses;         // failed guards of the specialized variants
 };
 
+// -*- the arena while a tree is built: nodes are referred to by index
+typedef struct{
+    Ast *nodes;
+    uint32_t len;
+    uint32_t cap;
+} AstArena;
+
 extern char* clnAstKindNames[];
 
-Ast* cln_new_ast(enum AstKind, Object *obj);
-void cln_ast_add_node(Ast *parent, Ast *node);
+// -*-
+static inline Ast* cln_ast_node(Ast *ast){
+    return ast->node ? ast + ast->node : NULL;
+}
+
+// -*-
+static inline Ast* cln_ast_next(Ast *ast){
+    return ast->next ? ast + ast->next : NULL;
+}
+
+void cln_ast_arena_init(AstArena *arena);
+uint32_t cln_new_ast(AstArena *arena, enum AstKind akind, Value obj);
+void cln_ast_add_node(AstArena *arena, uint32_t parent, uint32_t node);
+Ast* cln_ast_arena_finish(AstArena *arena);
+void cln_ast_free(Ast *root);
 void cln_dump(Ast *ast);
 
+// -*- the type of an expression node's value once the inference proved
+// -*- it. An INDEX node carries the proven type of its array variable.
+#define CLN_TYPE_UNKNOWN            0
+#define CLN_TYPE(type)              ((uint8_t)((type) + 1))
+
+// -*-
+static inline bool cln_ast_proven(Ast *ast, enum Type type){
+    return ast->type == CLN_TYPE(type);
+}
+
 // -*---------------------------------------------------------------*-
 // -*- Env                                                         -*-
 // -*---------------------------------------------------------------*-
 
+// -*- A call frame, or the globals indexed by symbol id. Frames are laid
+// -*- out by the resolver: @return, @self, the parameters, then locals.
+// -*- Frames a nested function reaches into are owned by the collector
+// -*- and outlive their call; the others are freed on return.
 struct env{
-    Object *idents[CLN_MAX_IDENT];
-    Env *parent;
+    Env *parent;            // frame of the enclosing function, NULL for the globals
+    Env *gcnext;            // next collector frame
+    uint32_t nslot;
+    uint8_t gcflags;        // CLN_GC_MARKED, CLN_GC_CAPTURED
+    Value slots[];
+};
+
+Env* cln_new_env(uint32_t nslot);
+Env* cln_new_globals(uint32_t nslot);
+void cln_globals_reserve(Env *globals, uint32_t nslot);
+Env* cln_new_frame(uint32_t frame, Env *parent);
+void cln_free_frame(Env *env);
+Value cln_env_get(Env *env, int id);
+void cln_env_put(Env *env, int id, Value obj);
+
+// -*- `depth` enclosing functions up
+static inline Env* cln_env_up(Env *env, uint32_t depth){
+    while(depth--){
+        env = env->parent;
+    }
+    return env;
+}
+
+// -*- what a function defined in `env` keeps as its parent frame
+static inline Env* cln_closure_env(Env *env){
+    return (env->gcflags & CLN_GC_CAPTURED) ? env : NULL;
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Optimizer                                                   -*-
+// -*---------------------------------------------------------------*-
+// -*- constant folding, dead branches and algebraic identities, run
+// -*- between parsing and resolution unless --no-opt is given
+void cln_optimize(Ast *root);
+
+// -*---------------------------------------------------------------*-
+// -*- Resolver                                                    -*-
+// -*---------------------------------------------------------------*-
+// -*- Variable references (IDENT, INDEX, FIELD, CALL, the CALL under NEW,
+// -*- named DEF statements and parameters) get their binding in `aux`:
+// -*- a slot of the frame `depth` functions up, or a global looked up by
+// -*- the symbol id in `obj`. The body of each DEF gets its frame layout.
+#define CLN_BIND_GLOBAL             0xffffffffu
+#define CLN_BIND_LOCAL(depth, slot) (((uint32_t)(depth) << 16) | (uint32_t)(slot))
+#define CLN_BIND_DEPTH(bind)        ((bind) >> 16)
+#define CLN_BIND_SLOT(bind)         ((bind) & 0xffff)
+
+#define CLN_FRAME_CAPTURED          0x80000000u
+#define CLN_FRAME(nslot, captured)  ((uint32_t)(nslot) | ((captured) ? CLN_FRAME_CAPTURED : 0))
+#define CLN_FRAME_NSLOT(frame)      ((frame) & 0xffff)
+
+// -*- `strict`: unknown globals are errors, unless the unit imports code
+void cln_resolve(Ast *root, Symtable *symtable, bool strict);
+
+// -*---------------------------------------------------------------*-
+// -*- Type inference                                              -*-
+// -*---------------------------------------------------------------*-
+// -*- proves expression types on a resolved tree so the evaluator can
+// -*- skip their checks. `closed`: no other unit can assign the globals,
+// -*- which lets calls to functions bound once take their result type.
+void cln_infer(Ast *root, Symtable *symtable, bool closed);
+
+// -*---------------------------------------------------------------*-
+// -*- JIT                                                         -*-
+// -*---------------------------------------------------------------*-
+// -*- Function bodies the tree walker keeps calling are compiled to
+// -*- x86-64 machine code. The code runs on the frame slots, with its
+// -*- temporaries in `ntemp` extra slots after the locals. A type guard
+// -*- failing before the statement has called out returns
+// -*- CLN_JIT_BAILOUT with that statement in `resume`, for the tree
+// -*- walker to carry on from; afterwards it takes the slow path.
+#define CLN_JIT_THRESHOLD           1000    // default calls before compiling
+#define CLN_JIT_MAX_BAILOUTS        64      // then the code is dropped
+#define CLN_JIT_DONE                0
+#define CLN_JIT_BAILOUT             1
+
+typedef int (*JitEntry)(Value *slots, Ast **resume);
+
+struct jitcode{
+    JitEntry entry;             // NULL when the body cannot be compiled
+    uint32_t ntemp;
+    uint32_t bailouts;
 };
 
-Env* cln_new_env();
-bool cln_env_contains(Env *env, int id);
-Object* cln_env_get(Env *env, int id);
-void cln_env_update(Env *env, int id, Object *obj); // set
-void cln_env_put(Env *env, int id, Object *obj);
+// -*- shared by every function of `body`, compiled on the first request
+JitCode* cln_jit_compile(Ast *body, const char *name, Env **globals, Symtable *symtable);
 
+// -*- provided by the tree walker: `values` holds the callee, then the
+// -*- arguments. A tail call leaves the call to the running one.
+Value cln_jit_call(Value *values, int narg);
+void cln_jit_tail_call(Value *values, int narg);
+// -*- the global `id`, which the compiled code found unset
+Value cln_jit_global(uint32_t id);
 
 // -*---------------------------------------------------------------*-
 // -*- Module                                                      -*-
 // -*---------------------------------------------------------------*-
-//! @todo: use hashtable & cache
+// -*- the search path, in order
 struct path {
     const char* name;
     Path *next;
@@ -219,12 +697,18 @@ typedef struct{
     Path *paths;
 } Modules;
 
-// -*-
+// -*- values a native module keeps outside of `env` must be registered
+// -*- with cln_gc_add_root()
 typedef void (*InitModuleFn)(Symtable*, Env*);
 
 void cln_module_addpath(const char* name);
 Ast* cln_module_import(const char* name, Symtable* symtable);
+Proto* cln_module_compile(const char* name, Symtable* symtable);
+bool cln_module_import_lazy(const char* name, Symtable* symtable, Env *globals);
+Ast* cln_module_lazy_def(uint32_t id, Symtable* symtable);
 void cln_module_load(const char* name, Symtable *symbtable, Env *env);
+void cln_module_prefetch(Ast *root);
+void cln_module_print_stats(FILE *stream);
 
 // -*---------------------------------------------------------------*-
 // -*- Ast                                                         -*-
@@ -274,6 +758,8 @@ void cln_module_load(const char* name, Symtable *symbtable, Env *env);
     CLN_DEF(OBJECT, "object")       \
     CLN_DEF(IMPORT, "import")       \
     CLN_DEF(NEW, "new")             \
+    CLN_DEF(TAILCALL, "tailcall")   \
+    CLN_DEF(TAILMCALL, "tailmcall") \
     CLN_DEF(LOAD, "load")
 
 
@@ -285,27 +771,41 @@ enum TokenKind{
 
 extern const char* clnTokenNames[];
 
+// -*- tokens own no memory: strings and field names are only their
+// -*- slice of the source until the parser turns them into constants
 typedef struct{
     enum TokenKind tkind;
     uint32_t lineno;
-    Object *obj;
+    uint32_t offset;                // text of the token in the source, quotes excluded
+    uint32_t len;
+    union{
+        uint32_t symbol;            // TOK_IDENT
+        long integer;               // TOK_INTEGER
+        double real;                // TOK_FLOAT
+    } val;
 } Token;
 
+typedef struct scanner Scanner;    // see clnlexer.c
+
+// -*- the source is mapped whole and tokens are slices of it
 typedef struct {
-    FILE *stream;
-    char buffer[CLN_BUFSIZE];       // stream_buffer
-    char token[CLN_MAX_TOKLEN];     // token_buffer
+    const char *source;             // followed by a NUL sentinel
+    size_t size;
+    size_t mapped;                  // bytes mapped, 0 when the source was read
     Symtable *symtable;             // id_table
-    uint32_t pos;                   // head | column
-    uint32_t offset;                // abolute_head_position;
-    size_t bufsize;                 // buffer_size
+    uint32_t pos;                   // offset of the next character
     uint32_t lineno;                // line_num;
     bool nextIsFieldName;           // field_name_following
+    enum TokenKind prevKind;        // previous_token_kind
+    const Scanner *scan;            // character runs, vectorized where the CPU allows
 } Lexer;
 
 void cln_lexer_init(Lexer *lexer, const char *filename, Symtable *symtable);
 void cln_lexer_destroy(Lexer *lexer);
 Token cln_lexer_nexttoken(Lexer *lexer);
+bool cln_lexer_use_scanner(Lexer *lexer, const char *name);
+void cln_lexer_seek(Lexer *lexer, uint32_t offset, uint32_t lineno);
+char* cln_lexer_token_cstr(Lexer *lexer, const Token *token);
 // bool cln_lexer_has_nextotken(Lexer *lexer);
 
 // -*---------------------------------------------------------------*-
@@ -313,9 +813,145 @@ Token cln_lexer_nexttoken(Lexer *lexer);
 // -*---------------------------------------------------------------*-
 Ast* cln_parse(const char* filename, Symtable *symtable);
 
+// -*- a top-level `def name(...){...}` and where its source starts
+typedef struct{
+    uint32_t symbol;
+    uint32_t offset;
+    uint32_t lineno;
+} ModuleDef;
+
+bool cln_parse_defs(const char *filename, Symtable *symtable, ModuleDef **defs, uint32_t *ndef);
+Ast* cln_parse_def(const char *filename, Symtable *symtable, const ModuleDef *def);
+
+// -*- a tree parsed off the main thread: its symbols are ids of its own
+// -*- table and its constants are not yet known to the collector, until
+// -*- cln_ast_attach() makes it what cln_parse() would have
+Ast* cln_parse_detached(const char *filename, Symtable *own);
+void cln_ast_attach(Ast *root, Symtable *own, Symtable *symtable);
+
 // -*---------------------------------------------------------------*-
-// -*- Parser                                                      -*-
+// -*- Module cache                                                -*-
+// -*---------------------------------------------------------------*-
+// -*- the parsed and optimized tree of foo.cln, kept in foo.clnc
+Ast* cln_parse_cached(const char *filename, Symtable *symtable);
+Ast* cln_cache_adopt(const char *filename, Ast *detached, Symtable *own, Symtable *symtable);
+bool cln_cache_imports(const char *filename, char ***names, uint32_t *count);
+void cln_cache_compile(const char *filename);
+bool cln_cache_release(Ast *root);
+
+// -*---------------------------------------------------------------*-
+// -*- Eval                                                        -*-
 // -*---------------------------------------------------------------*-
 void cln_eval(Ast *ast, Env *env, Symtable *symtable);
 
+// -*---------------------------------------------------------------*-
+// -*- Bytecode                                                    -*-
+// -*---------------------------------------------------------------*-
+// -*- iABC:  op:8 A:8 B:8 C:8
+// -*- iABx:  op:8 A:8 Bx:16        iAsBx: op:8 A:8 sBx:16
+// -*- isAx:  op:8 sAx:24
+// -*- GETFIELD and SETFIELD are followed by an EXTRAARG word holding the
+// -*- site's inline cache.
+// -*- GETVAR/SETVAR address a global by symbol id (Bx), GETLOCAL/SETLOCAL
+// -*- the slot B of the frame C functions up. TAILCALL and TAILMCALL are
+// -*- CALL and MCALL followed by the RETURN of their result.
+#define CLN_OPCODES                 \
+    CLN_DEF(MOVE, "move")           \
+    CLN_DEF(LOADK, "loadk")         \
+    CLN_DEF(GETVAR, "getvar")       \
+    CLN_DEF(SETVAR, "setvar")       \
+    CLN_DEF(GETLOCAL, "getlocal")   \
+    CLN_DEF(SETLOCAL, "setlocal")   \
+    CLN_DEF(ADD, "add")             \
+    CLN_DEF(SUB, "sub")             \
+    CLN_DEF(MUL, "mul")             \
+    CLN_DEF(DIV, "div")             \
+    CLN_DEF(AND, "and")             \
+    CLN_DEF(OR, "or")               \
+    CLN_DEF(LT, "lt")               \
+    CLN_DEF(EQ, "eq")               \
+    CLN_DEF(GT, "gt")               \
+    CLN_DEF(LE, "le")               \
+    CLN_DEF(GE, "ge")               \
+    CLN_DEF(NOT, "not")             \
+    CLN_DEF(JMP, "jmp")             \
+    CLN_DEF(JMPIFNOT, "jmpifnot")   \
+    CLN_DEF(READ_INT, "readint")    \
+    CLN_DEF(INPUT, "input")         \
+    CLN_DEF(NEWARRAY, "newarray")   \
+    CLN_DEF(NEWOBJECT, "newobject") \
+    CLN_DEF(GETINDEX, "getindex")   \
+    CLN_DEF(SETINDEX, "setindex")   \
+    CLN_DEF(GETFIELD, "getfield")   \
+    CLN_DEF(SETFIELD, "setfield")   \
+    CLN_DEF(CLOSURE, "closure")     \
+    CLN_DEF(CALL, "call")           \
+    CLN_DEF(MCALL, "mcall")         \
+    CLN_DEF(NEW, "new")             \
+    CLN_DEF(TAILCALL, "tailcall")   \
+    CLN_DEF(TAILMCALL, "tailmcall") \
+    CLN_DEF(RETURN, "return")       \
+    CLN_DEF(PRINT, "print")         \
+    CLN_DEF(IMPORT, "import")       \
+    CLN_DEF(LOAD, "load")           \
+    CLN_DEF(EXTRAARG, "extraarg")
+
+enum OpCode{
+#define CLN_DEF(kind, name)     OP_##kind,
+    CLN_OPCODES
+#undef CLN_DEF
+    OP_NUMOPS
+};
+
+extern const char* clnOpNames[];
+
+typedef uint32_t Instruction;
+
+#define CLN_MAX_REGS                255
+#define CLN_MAXARG_BX               0xffff
+#define CLN_MAXARG_AX               0xffffff
+#define CLN_OFFSET_SBX              0x7fff
+#define CLN_OFFSET_SAX              0x7fffff
+
+#define CLN_GET_OP(i)               ((enum OpCode)((i) & 0xff))
+#define CLN_GET_A(i)                ((int)(((i) >> 8) & 0xff))
+#define CLN_GET_B(i)                ((int)(((i) >> 16) & 0xff))
+#define CLN_GET_C(i)                ((int)(((i) >> 24) & 0xff))
+#define CLN_GET_BX(i)               ((int)(((i) >> 16) & 0xffff))
+#define CLN_GET_SBX(i)              (CLN_GET_BX(i) - CLN_OFFSET_SBX)
+#define CLN_GET_AX(i)               ((int)((i) >> 8))
+#define CLN_GET_SAX(i)              (CLN_GET_AX(i) - CLN_OFFSET_SAX)
+
+#define CLN_ABC(op, a, b, c)        \
+    ((Instruction)(op) | ((Instruction)(a) << 8) | ((Instruction)(b) << 16) | ((Instruction)(c) << 24))
+#define CLN_ABX(op, a, bx)          \
+    ((Instruction)(op) | ((Instruction)(a) << 8) | ((Instruction)(bx) << 16))
+#define CLN_AX(op, ax)              \
+    ((Instruction)(op) | ((Instruction)(ax) << 8))
+
+// -*- compiled function body
+struct proto{
+    Instruction *code;
+    size_t ncode;
+    size_t codecap;
+    Value *consts;              // constants: literals, field names, module names
+    size_t nconst;
+    size_t constcap;
+    Proto **protos;             // nested function definitions
+    size_t nproto;
+    size_t protocap;
+    int narg;
+    int nreg;                   // register window size
+    uint32_t frame;             // CLN_FRAME() layout of the call env
+};
+
+Proto* cln_compile(Ast *ast, Symtable *symtable);
+void cln_proto_dump(Proto *proto, Symtable *symtable);
+
+// -*---------------------------------------------------------------*-
+// -*- VM                                                          -*-
+// -*---------------------------------------------------------------*-
+void cln_vm_run(Proto *proto, Env *env, Symtable *symtable);
+void cln_vm_mark_roots();
+
 #endif
\ No newline at end of file
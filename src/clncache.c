@@ -0,0 +1,444 @@
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+
+#include "celine.h"
+
+// -*- foo.cln is cached as foo.clnc, the tree as cln_parse() and, unless
+// -*- --no-opt, cln_optimize() left it:
+// -*-
+// -*-   CacheHeader
+// -*-   Ast[nnode]          the arena as is, `obj` encoded per relocs[]
+// -*-   uint8_t[nnode]      relocs, enum CacheReloc
+// -*-   uint32_t[nsymbol]   offsets of the symbol names in the blob
+// -*-   uint32_t[nstring]   offsets of the string constants in the blob
+// -*-   char[blobsize]      NUL terminated names and strings
+// -*-
+// -*- A cache is only read back by the build that wrote it. It holds for
+// -*- its source as long as the size and mtime match, or failing that the
+// -*- content hash does (a checkout, a touch). Loading maps the file
+// -*- privately and relocates `obj` of each node in place: symbols are
+// -*- interned into the running table, strings become constants.
+#define CLN_CACHE_MAGIC         0x434e4c43u     // "CLNC"
+#define CLN_CACHE_VERSION       1
+#define CLN_CACHE_OPTIMIZED     0x1
+#define CLN_CACHE_SUFFIX        "c"             // foo.cln -> foo.clnc
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t astSize;           // sizeof(Ast) of the writer
+    uint16_t nkind;             // AST kinds of the writer
+    uint16_t flags;
+    uint32_t nnode;
+    uint32_t nsymbol;
+    uint32_t nstring;
+    uint32_t blobsize;
+    uint32_t pad;
+    uint64_t size;              // of the source
+    int64_t mtime;              // of the source, in ns
+    uint64_t hash;              // of the source content
+} CacheHeader;
+
+enum CacheReloc{
+    CACHE_RELOC_NONE,           // nil, immediate integers, floats
+    CACHE_RELOC_SYMBOL,         // index into the symbol offsets
+    CACHE_RELOC_INTEGER,        // integer literal outside the immediate range
+    CACHE_RELOC_STRING,         // index into the string offsets
+};
+
+// -*- a tree loaded from a cache, unmapped by cln_ast_free()
+typedef struct{
+    Ast *root;
+    void *base;
+    size_t size;
+} CacheTree;
+
+static CacheTree *clnCacheTrees;
+static size_t clnCacheTreeCount;
+static size_t clnCacheTreeCap;
+
+// -*- FNV-1a, 64 bits
+static uint64_t _cln_cache_hash(const char *data, size_t len){
+    uint64_t hash = 14695981039346656037u;
+    for(size_t i=0; i < len; ++i){
+        hash = (hash ^ (uint8_t)data[i])*1099511628211u;
+    }
+    return hash;
+}
+
+// -*-
+static int64_t _cln_cache_mtime(const struct stat *st){
+#ifdef __APPLE__
+    return (int64_t)st->st_mtimespec.tv_sec*1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtim.tv_sec*1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+// -*- hash of the content of `filename`, false when it cannot be read
+static bool _cln_cache_source_hash(const char *filename, size_t size, uint64_t *hash){
+    FILE *stream = fopen(filename, "rb");
+    if(!stream){
+        return false;
+    }
+    char *data = (char*)cln_alloc(size + 1);
+    bool ok = fread(data, 1, size, stream) == size;
+    fclose(stream);
+    if(ok){
+        *hash = _cln_cache_hash(data, size);
+    }
+    cln_dealloc(data);
+    return ok;
+}
+
+// -*- foo.cln -> foo.clnc
+static char* _cln_cache_path(const char *filename){
+    size_t len = strlen(filename);
+    char *path = (char*)cln_alloc(len + sizeof(CLN_CACHE_SUFFIX) + 1);
+    memcpy(path, filename, len);
+    strcpy(path + len, CLN_CACHE_SUFFIX);
+    return path;
+}
+
+// -*- nodes of the arena rooted at `root`: the last one reachable, the
+// -*- optimizer may have orphaned some before it
+static uint32_t _cln_cache_count_nodes(Ast *root, Ast *ast, uint32_t count){
+    for(; ast; ast = cln_ast_next(ast)){
+        if((uint32_t)(ast - root) + 1 > count){
+            count = (uint32_t)(ast - root) + 1;
+        }
+        count = _cln_cache_count_nodes(root, cln_ast_node(ast), count);
+    }
+    return count;
+}
+
+// -*-
+typedef struct{
+    char *data;
+    size_t len;
+    size_t cap;
+} CacheBuffer;
+
+// -*-
+static size_t _cln_cache_append(CacheBuffer *buffer, const void *data, size_t len){
+    if(buffer->len + len > buffer->cap){
+        while(buffer->len + len > buffer->cap){
+            buffer->cap = buffer->cap ? 2*buffer->cap : 4096;
+        }
+        buffer->data = (char*)realloc(buffer->data, buffer->cap);
+        if(!buffer->data){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    size_t at = buffer->len;
+    buffer->len += len;
+    return at;
+}
+
+// -*- write the cache of `filename`, false when it cannot be
+static bool _cln_cache_store(const char *filename, Ast *root, Symtable *symtable){
+    struct stat st;
+    if(stat(filename, &st) != 0){
+        return false;
+    }
+    CacheHeader header = {
+        .magic = CLN_CACHE_MAGIC, .version = CLN_CACHE_VERSION,
+        .astSize = sizeof(Ast), .nkind = AST_EMPTY + 1,
+        .flags = clnOptions.noOptimize ? 0 : CLN_CACHE_OPTIMIZED,
+        .size = (uint64_t)st.st_size, .mtime = _cln_cache_mtime(&st)
+    };
+    if(!_cln_cache_source_hash(filename, (size_t)st.st_size, &header.hash)){
+        return false;
+    }
+
+    // - nodes, with symbols and strings numbered in order of appearance
+    header.nnode = _cln_cache_count_nodes(root, root, 0);
+    Ast *nodes = (Ast*)cln_alloc(sizeof(Ast)*header.nnode);
+    uint8_t *relocs = (uint8_t*)cln_alloc(header.nnode);
+    uint32_t *symbolIndex = (uint32_t*)cln_alloc(sizeof(uint32_t)*symtable->len);     // index + 1
+    uint32_t *symbols = (uint32_t*)cln_alloc(sizeof(uint32_t)*symtable->len);
+    uint32_t *strings = (uint32_t*)cln_alloc(sizeof(uint32_t)*header.nnode);
+    CacheBuffer blob = {0};
+    _cln_cache_append(&blob, "", 1);      // never empty, and NUL terminated
+    for(uint32_t i=0; i < header.nnode; ++i){
+        Ast *node = &nodes[i];
+        *node = root[i];
+        node->aux = 0;
+        node->type = 0;
+        node->quick = 0;
+        node->misses = 0;
+        Value obj = node->obj;
+        if(obj == CLN_NIL || cln_is_float(obj)){
+            relocs[i] = CACHE_RELOC_NONE;
+        }else if(cln_is_integer(obj) && node->akind == AST_INTEGER){
+            relocs[i] = CACHE_RELOC_NONE;
+        }else if(cln_is_integer(obj)){
+            uint32_t id = (uint32_t)cln_as_integer(obj);
+            if(id >= symtable->len){
+                cln_panic("CelineError: cannot cache %s: %s node with a foreign id\n", filename, clnAstKindNames[node->akind]);
+            }
+            if(!symbolIndex[id]){
+                const char *name = symtable->symbols[id];
+                symbols[header.nsymbol] = (uint32_t)_cln_cache_append(&blob, name, strlen(name) + 1);
+                symbolIndex[id] = ++header.nsymbol;
+            }
+            relocs[i] = CACHE_RELOC_SYMBOL;
+            node->obj = symbolIndex[id] - 1;
+        }else if(cln_as_object(obj)->type == TY_INTEGER){
+            relocs[i] = CACHE_RELOC_INTEGER;
+            node->obj = (Value)cln_as_object(obj)->val.integer;
+        }else if(cln_as_object(obj)->type == TY_STRING){
+            const char *cstr = cln_as_object(obj)->val.cstr;
+            strings[header.nstring] = (uint32_t)_cln_cache_append(&blob, cstr, strlen(cstr) + 1);
+            relocs[i] = CACHE_RELOC_STRING;
+            node->obj = header.nstring++;
+        }else{
+            cln_panic("CelineError: cannot cache %s: %s node with a foreign constant\n", filename, clnAstKindNames[node->akind]);
+        }
+    }
+    header.blobsize = (uint32_t)blob.len;
+
+    CacheBuffer file = {0};
+    _cln_cache_append(&file, &header, sizeof(header));
+    _cln_cache_append(&file, nodes, sizeof(Ast)*header.nnode);
+    _cln_cache_append(&file, relocs, header.nnode);
+    uint32_t pad = 0;
+    _cln_cache_append(&file, &pad, (4 - file.len % 4) % 4);
+    _cln_cache_append(&file, symbols, sizeof(uint32_t)*header.nsymbol);
+    _cln_cache_append(&file, strings, sizeof(uint32_t)*header.nstring);
+    _cln_cache_append(&file, blob.data, blob.len);
+    cln_dealloc(nodes);
+    cln_dealloc(relocs);
+    cln_dealloc(symbolIndex);
+    cln_dealloc(symbols);
+    cln_dealloc(strings);
+    cln_dealloc(blob.data);
+
+    // - written aside and renamed, readers never see half a cache
+    char *path = _cln_cache_path(filename);
+    char *temp = (char*)cln_alloc(strlen(path) + 32);
+    sprintf(temp, "%s.%ld", path, (long)getpid());
+    FILE *stream = fopen(temp, "wb");
+    bool ok = stream && fwrite(file.data, 1, file.len, stream) == file.len;
+    if(stream){
+        ok = fclose(stream) == 0 && ok;
+    }
+    ok = ok && rename(temp, path) == 0;
+    if(!ok){
+        remove(temp);
+    }
+    cln_dealloc(file.data);
+    cln_dealloc(temp);
+    cln_dealloc(path);
+    return ok;
+}
+
+// -*- a cache file as mapped
+typedef struct{
+    CacheHeader *header;
+    size_t size;
+    Ast *root;
+    const uint8_t *relocs;
+    const uint32_t *symbols;
+    const uint32_t *strings;
+    const char *blob;
+} CacheImage;
+
+// -*- maps a valid cache of `filename` privately, false when there is none
+static bool _cln_cache_map(const char *filename, CacheImage *image){
+    struct stat source, st;
+    if(stat(filename, &source) != 0){
+        return false;
+    }
+    char *path = _cln_cache_path(filename);
+    int fd = open(path, O_RDONLY);
+    cln_dealloc(path);
+    if(fd < 0){
+        return false;
+    }
+    void *base = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)){
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(base == MAP_FAILED){
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    CacheHeader *header = (CacheHeader*)base;
+
+    // - written by this build, for this source
+    size_t relocAt = sizeof(CacheHeader) + sizeof(Ast)*(size_t)header->nnode;
+    size_t symbolAt = (relocAt + header->nnode + 3) & ~(size_t)3;
+    size_t stringAt = symbolAt + sizeof(uint32_t)*(size_t)header->nsymbol;
+    size_t blobAt = stringAt + sizeof(uint32_t)*(size_t)header->nstring;
+    const char *blob = (const char*)base + blobAt;
+    bool valid = header->magic == CLN_CACHE_MAGIC && header->version == CLN_CACHE_VERSION &&
+        header->astSize == sizeof(Ast) && header->nkind == AST_EMPTY + 1 &&
+        header->flags == (clnOptions.noOptimize ? 0 : CLN_CACHE_OPTIMIZED) &&
+        header->nnode && header->blobsize && blobAt + header->blobsize == size &&
+        blob[header->blobsize - 1] == '\0' &&
+        header->size == (uint64_t)source.st_size;
+    if(valid && header->mtime != _cln_cache_mtime(&source)){
+        uint64_t hash;
+        valid = _cln_cache_source_hash(filename, (size_t)source.st_size, &hash) && hash == header->hash;
+    }
+
+    // - the links stay within the arena, the relocations within the tables
+    Ast *root = (Ast*)((char*)base + sizeof(CacheHeader));
+    const uint8_t *relocs = (const uint8_t*)base + relocAt;
+    const uint32_t *symbols = (const uint32_t*)((char*)base + symbolAt);
+    for(uint32_t i=0; valid && i < header->nsymbol + header->nstring; ++i){
+        valid = symbols[i] < header->blobsize;  // the string offsets follow
+    }
+    for(uint32_t i=0; valid && i < header->nnode; ++i){
+        Ast *node = &root[i];
+        int64_t links[] = {node->node, node->next, node->last};
+        for(int k=0; k < 3; ++k){
+            valid = valid && (int64_t)i + links[k] >= 0 && (int64_t)i + links[k] < header->nnode;
+        }
+        valid = valid && node->akind <= AST_EMPTY && relocs[i] <= CACHE_RELOC_STRING;
+        if(valid && relocs[i] == CACHE_RELOC_SYMBOL){
+            valid = node->obj < header->nsymbol;
+        }else if(valid && relocs[i] == CACHE_RELOC_STRING){
+            valid = node->obj < header->nstring;
+        }
+    }
+    if(!valid){
+        munmap(base, size);
+        return false;
+    }
+    *image = (CacheImage){
+        header, size, root, relocs, symbols,
+        (const uint32_t*)((char*)base + stringAt), blob
+    };
+    return true;
+}
+
+// -*- the tree of a valid cache of `filename`, NULL when there is none
+static Ast* _cln_cache_load(const char *filename, Symtable *symtable){
+    CacheImage image;
+    if(!_cln_cache_map(filename, &image)){
+        return NULL;
+    }
+    CacheHeader *header = image.header;
+    Ast *root = image.root;
+
+    // - relocate
+    uint32_t *ids = (uint32_t*)cln_alloc(sizeof(uint32_t)*(header->nsymbol + 1));     // never empty
+    for(uint32_t i=0; i < header->nsymbol; ++i){
+        ids[i] = cln_get_symbol_index(symtable, image.blob + image.symbols[i]);
+    }
+    for(uint32_t i=0; i < header->nnode; ++i){
+        Ast *node = &root[i];
+        switch(image.relocs[i]){
+        case CACHE_RELOC_SYMBOL:
+            node->obj = cln_new_integer(ids[node->obj]);
+            break;
+        case CACHE_RELOC_INTEGER:
+            node->obj = cln_gc_permanent(cln_new_integer((long)node->obj));
+            break;
+        case CACHE_RELOC_STRING:
+            node->obj = cln_gc_permanent(cln_object_value(cln_new_string(strdup(image.blob + image.strings[node->obj]))));
+            break;
+        default:
+            break;
+        }
+    }
+    cln_dealloc(ids);
+    if(clnCacheTreeCount == clnCacheTreeCap){
+        clnCacheTreeCap = clnCacheTreeCap ? 2*clnCacheTreeCap : 8;
+        clnCacheTrees = (CacheTree*)realloc(clnCacheTrees, sizeof(CacheTree)*clnCacheTreeCap);
+        if(!clnCacheTrees){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    clnCacheTrees[clnCacheTreeCount++] = (CacheTree){root, header, image.size};
+    return root;
+}
+
+// -*- a tree just parsed, optimized and written to the cache
+static Ast* _cln_cache_parsed(const char *filename, Ast *ast, Symtable *symtable){
+    if(!clnOptions.noOptimize){
+        cln_optimize(ast);
+    }
+    if(!clnOptions.noCache){
+        _cln_cache_store(filename, ast, symtable);     // e.g. a read-only directory: run uncached
+    }
+    return ast;
+}
+
+// -*- cln_parse() and cln_optimize() through the cache of `filename`
+Ast* cln_parse_cached(const char *filename, Symtable *symtable){
+    Ast *ast = clnOptions.noCache ? NULL : _cln_cache_load(filename, symtable);
+    if(ast){
+        if(clnOptions.verbose){
+            printf("Loaded %s from its cache\n", filename);
+        }
+        return ast;
+    }
+    return _cln_cache_parsed(filename, cln_parse(filename, symtable), symtable);
+}
+
+// -*- cln_parse_cached() of a source cln_parse_detached() already parsed
+// -*- without a cache to load
+Ast* cln_cache_adopt(const char *filename, Ast *detached, Symtable *own, Symtable *symtable){
+    cln_ast_attach(detached, own, symtable);
+    return _cln_cache_parsed(filename, detached, symtable);
+}
+
+// -*- the names imported by the valid cache of `filename`, false when
+// -*- there is none. Touches nothing shared: safe on any thread.
+bool cln_cache_imports(const char *filename, char ***names, uint32_t *count){
+    CacheImage image;
+    if(!_cln_cache_map(filename, &image)){
+        return false;
+    }
+    uint32_t n = 0;
+    char **found = NULL;
+    for(uint32_t i=0; i < image.header->nnode; ++i){
+        if(image.root[i].akind == AST_IMPORT && image.relocs[i] == CACHE_RELOC_STRING){
+            found = (char**)realloc(found, sizeof(char*)*(n + 1));
+            if(!found){
+                cln_panic("CelineError: memory allocation failure\n");
+            }
+            found[n++] = strdup(image.blob + image.strings[image.root[i].obj]);
+        }
+    }
+    munmap(image.header, image.size);
+    *names = found;
+    *count = n;
+    return true;
+}
+
+// -*- --compile: (re)write the cache of `filename`
+void cln_cache_compile(const char *filename){
+    Symtable *symtable = cln_new_symtable();
+    Ast *ast = cln_parse(filename, symtable);
+    if(!clnOptions.noOptimize){
+        cln_optimize(ast);
+    }
+    if(!_cln_cache_store(filename, ast, symtable)){
+        cln_panic("CelineError: cannot write the cache of %s\n", filename);
+    }
+    if(clnOptions.verbose){
+        printf("Compiled %s\n", filename);
+    }
+    cln_ast_free(ast);
+}
+
+// -*- unmaps `root` when it was loaded from a cache
+bool cln_cache_release(Ast *root){
+    for(size_t i=0; i < clnCacheTreeCount; ++i){
+        if(clnCacheTrees[i].root == root){
+            munmap(clnCacheTrees[i].base, clnCacheTrees[i].size);
+            clnCacheTrees[i] = clnCacheTrees[--clnCacheTreeCount];
+            return true;
+        }
+    }
+    return false;
+}
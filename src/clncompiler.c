@@ -0,0 +1,497 @@
+#include<string.h>
+
+#include "celine.h"
+
+#define CLN_PROTO_INITIAL_CAPACITY      16
+
+const char* clnOpNames[] = {
+#define CLN_DEF(kind, name)     name,
+    CLN_OPCODES
+#undef CLN_DEF
+};
+
+typedef struct {
+    Proto *proto;
+    Symtable *symtable;
+    int freereg;                // first free register
+    bool function;              // compiling a function body, not a chunk
+} Compiler;
+
+// -*---------------------------------------------------------------*-
+// -*- Proto                                                       -*-
+// -*---------------------------------------------------------------*-
+// -*-
+static Proto* _cln_new_proto(){
+    Proto *proto = (Proto*)cln_alloc(sizeof(Proto));
+    proto->codecap = CLN_PROTO_INITIAL_CAPACITY;
+    proto->code = (Instruction*)cln_alloc(sizeof(Instruction)*proto->codecap);
+    return proto;
+}
+
+// -*-
+static int _cln_emit(Compiler *compiler, Instruction instr){
+    Proto *proto = compiler->proto;
+    if(proto->ncode == proto->codecap){
+        proto->codecap *= 2;
+        proto->code = (Instruction*)realloc(proto->code, sizeof(Instruction)*proto->codecap);
+        if(!proto->code){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    proto->code[proto->ncode] = instr;
+    return (int)proto->ncode++;
+}
+
+// -*-
+static int _cln_add_const(Compiler *compiler, Value obj){
+    Proto *proto = compiler->proto;
+    for(size_t i=0; i < proto->nconst; ++i){
+        if(proto->consts[i] == obj){
+            return (int)i;
+        }
+    }
+    if(proto->nconst > CLN_MAXARG_BX){
+        cln_panic("CelineError: too many constants in one function\n");
+    }
+    if(proto->nconst == proto->constcap){
+        proto->constcap = proto->constcap ? 2*proto->constcap : CLN_PROTO_INITIAL_CAPACITY;
+        proto->consts = (Value*)realloc(proto->consts, sizeof(Value)*proto->constcap);
+        if(!proto->consts){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    proto->consts[proto->nconst] = obj;
+    return (int)proto->nconst++;
+}
+
+// -*- inline cache of a GETFIELD or SETFIELD site, `name` is a string constant
+static int _cln_add_field_cache(Value name){
+    cln_checktype(name, TY_STRING);
+    uint32_t index = cln_new_field_cache(cln_atom(cln_as_object(name)->val.cstr));
+    if(index > CLN_MAXARG_AX){
+        cln_panic("CelineError: too many field access sites\n");
+    }
+    return (int)index;
+}
+
+// -*-
+static int _cln_add_proto(Compiler *compiler, Proto *child){
+    Proto *proto = compiler->proto;
+    if(proto->nproto > CLN_MAXARG_BX){
+        cln_panic("CelineError: too many nested functions\n");
+    }
+    if(proto->nproto == proto->protocap){
+        proto->protocap = proto->protocap ? 2*proto->protocap : CLN_PROTO_INITIAL_CAPACITY;
+        proto->protos = (Proto**)realloc(proto->protos, sizeof(Proto*)*proto->protocap);
+        if(!proto->protos){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    proto->protos[proto->nproto] = child;
+    return (int)proto->nproto++;
+}
+
+// -*-
+static int _cln_reserve_reg(Compiler *compiler){
+    int reg = compiler->freereg++;
+    if(reg >= CLN_MAX_REGS){
+        cln_panic("CelineError: expression too complex, out of registers\n");
+    }
+    if(compiler->freereg > compiler->proto->nreg){
+        compiler->proto->nreg = compiler->freereg;
+    }
+    return reg;
+}
+
+// -*- jumps are relative to the instruction that follows them
+static int _cln_emit_jump(Compiler *compiler, enum OpCode op, int reg){
+    if(op == OP_JMP){
+        return _cln_emit(compiler, CLN_AX(OP_JMP, CLN_OFFSET_SAX));
+    }
+    return _cln_emit(compiler, CLN_ABX(op, reg, CLN_OFFSET_SBX));
+}
+
+// -*-
+static void _cln_patch_jump(Compiler *compiler, int at, int target){
+    Instruction *instr = &compiler->proto->code[at];
+    int offset = target - (at + 1);
+    if(CLN_GET_OP(*instr) == OP_JMP){
+        if(offset < -CLN_OFFSET_SAX || offset > CLN_OFFSET_SAX){
+            cln_panic("CelineError: jump too long\n");
+        }
+        *instr = CLN_AX(OP_JMP, offset + CLN_OFFSET_SAX);
+    }else{
+        if(offset < -CLN_OFFSET_SBX || offset > CLN_OFFSET_SBX){
+            cln_panic("CelineError: control structure too long\n");
+        }
+        *instr = CLN_ABX(CLN_GET_OP(*instr), CLN_GET_A(*instr), offset + CLN_OFFSET_SBX);
+    }
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Compiler                                                    -*-
+// -*---------------------------------------------------------------*-
+static void _cln_compile_expr(Compiler *compiler, Ast *ast, int dst);
+static void _cln_compile_block(Compiler *compiler, Ast *ast);
+static Proto* _cln_compile_function(Ast *body, int narg, bool function, Symtable *symtable);
+
+// -*- def name(arglist){ body } -> child prototype
+static int _cln_compile_def(Compiler *compiler, Ast *ast){
+    int argc = 0;
+    for(Ast* arg=cln_ast_node(cln_ast_node(ast)); arg; arg = cln_ast_next(arg)){
+        if(argc == CLN_BUILTIN_MAXARGS){
+            cln_panic("CelineError: too many parameters, maximum is %d\n", CLN_BUILTIN_MAXARGS);
+        }
+        ++argc;
+    }
+    Ast *body = cln_ast_next(cln_ast_node(ast));
+    Proto *child = _cln_compile_function(body, argc, true, compiler->symtable);
+    child->frame = body->aux;
+    return _cln_add_proto(compiler, child);
+}
+
+// -*- the symbol id of a global, its slot in the globals env
+static int _cln_global_id(Ast *ref){
+    long id = cln_as_integer(ref->obj);
+    if(id > CLN_MAXARG_BX){
+        cln_panic("CelineError: too many globals for the bytecode: %ld\n", id);
+    }
+    return (int)id;
+}
+
+// -*- resolved variable reference -> dst
+static void _cln_compile_load(Compiler *compiler, Ast *ref, int dst){
+    if(ref->aux == CLN_BIND_GLOBAL){
+        _cln_emit(compiler, CLN_ABX(OP_GETVAR, dst, _cln_global_id(ref)));
+    }else{
+        _cln_emit(compiler, CLN_ABC(OP_GETLOCAL, dst, CLN_BIND_SLOT(ref->aux), CLN_BIND_DEPTH(ref->aux)));
+    }
+}
+
+// -*- src -> resolved variable reference
+static void _cln_compile_store(Compiler *compiler, Ast *ref, int src){
+    if(ref->aux == CLN_BIND_GLOBAL){
+        _cln_emit(compiler, CLN_ABX(OP_SETVAR, src, _cln_global_id(ref)));
+    }else{
+        _cln_emit(compiler, CLN_ABC(OP_SETLOCAL, src, CLN_BIND_SLOT(ref->aux), CLN_BIND_DEPTH(ref->aux)));
+    }
+}
+
+// -*- fun, [self], args... -> consecutive registers starting at base
+static int _cln_compile_args(Compiler *compiler, Ast *arglist){
+    int narg = 0;
+    for(Ast *arg = cln_ast_node(arglist); arg; arg = cln_ast_next(arg)){
+        _cln_compile_expr(compiler, arg, _cln_reserve_reg(compiler));
+        ++narg;
+    }
+    return narg;
+}
+
+// -*-
+static void _cln_compile_binop(Compiler *compiler, enum OpCode op, Ast *ast, int dst){
+    int saved = compiler->freereg;
+    _cln_compile_expr(compiler, cln_ast_node(ast), dst);
+    int rhs = _cln_reserve_reg(compiler);
+    _cln_compile_expr(compiler, cln_ast_next(cln_ast_node(ast)), rhs);
+    _cln_emit(compiler, CLN_ABC(op, dst, dst, rhs));
+    compiler->freereg = saved;
+}
+
+// -*- Object* _cln_eval_expr() counterpart: the result lands in `dst`
+static void _cln_compile_expr(Compiler *compiler, Ast *ast, int dst){
+    int saved = compiler->freereg;
+    int base, narg, reg;
+    switch(ast->akind){
+    case AST_IDENT:
+        _cln_compile_load(compiler, ast, dst);
+        break;
+    case AST_INTEGER:
+    case AST_FLOAT:
+    case AST_STRING:
+        _cln_emit(compiler, CLN_ABX(OP_LOADK, dst, _cln_add_const(compiler, ast->obj)));
+        break;
+    case AST_READ_INT:
+        _cln_emit(compiler, CLN_ABC(OP_READ_INT, dst, 0, 0));
+        break;
+    case AST_INPUT:
+        _cln_emit(compiler, CLN_ABC(OP_INPUT, dst, 0, 0));
+        break;
+    case AST_ARRAY:
+        _cln_compile_expr(compiler, cln_ast_node(ast), dst);
+        _cln_emit(compiler, CLN_ABC(OP_NEWARRAY, dst, dst, 0));
+        break;
+    case AST_OBJECT:
+        _cln_emit(compiler, CLN_ABC(OP_NEWOBJECT, dst, 0, 0));
+        break;
+    case AST_INDEX:
+        reg = _cln_reserve_reg(compiler);
+        _cln_compile_expr(compiler, cln_ast_node(ast), reg);
+        _cln_compile_load(compiler, ast, dst);
+        _cln_emit(compiler, CLN_ABC(OP_GETINDEX, dst, dst, reg));
+        break;
+    case AST_FIELD:
+        _cln_compile_load(compiler, ast, dst);
+        _cln_emit(compiler, CLN_ABC(OP_GETFIELD, dst, dst, 0));
+        _cln_emit(compiler, CLN_AX(OP_EXTRAARG, _cln_add_field_cache(cln_ast_node(ast)->obj)));
+        break;
+    case AST_DEF:
+        _cln_emit(compiler, CLN_ABX(OP_CLOSURE, dst, _cln_compile_def(compiler, ast)));
+        break;
+    case AST_CALL:
+        base = _cln_reserve_reg(compiler);
+        _cln_compile_load(compiler, ast, base);
+        narg = _cln_compile_args(compiler, cln_ast_node(ast));
+        _cln_emit(compiler, CLN_ABC(OP_CALL, dst, base, narg));
+        break;
+    case AST_NEW:
+        base = _cln_reserve_reg(compiler);
+        _cln_compile_load(compiler, cln_ast_node(ast), base);
+        narg = _cln_compile_args(compiler, cln_ast_node(cln_ast_node(ast)));
+        _cln_emit(compiler, CLN_ABC(OP_NEW, dst, base, narg));
+        break;
+    case AST_MCALL:
+        base = _cln_reserve_reg(compiler);
+        reg = _cln_reserve_reg(compiler);     // @self
+        _cln_compile_load(compiler, cln_ast_node(ast), reg);
+        _cln_emit(compiler, CLN_ABC(OP_GETFIELD, base, reg, 0));
+        _cln_emit(compiler, CLN_AX(OP_EXTRAARG, _cln_add_field_cache(cln_ast_node(cln_ast_node(ast))->obj)));
+        narg = _cln_compile_args(compiler, cln_ast_next(cln_ast_node(ast)));
+        _cln_emit(compiler, CLN_ABC(OP_MCALL, dst, base, narg));
+        break;
+    case AST_ADD:
+        _cln_compile_binop(compiler, OP_ADD, ast, dst);
+        break;
+    case AST_SUB:
+        _cln_compile_binop(compiler, OP_SUB, ast, dst);
+        break;
+    case AST_MUL:
+        _cln_compile_binop(compiler, OP_MUL, ast, dst);
+        break;
+    case AST_DIV:
+        _cln_compile_binop(compiler, OP_DIV, ast, dst);
+        break;
+    case AST_AND:
+        _cln_compile_binop(compiler, OP_AND, ast, dst);
+        break;
+    case AST_OR:
+        _cln_compile_binop(compiler, OP_OR, ast, dst);
+        break;
+    case AST_NOT:
+        _cln_compile_expr(compiler, cln_ast_node(ast), dst);
+        _cln_emit(compiler, CLN_ABC(OP_NOT, dst, dst, 0));
+        break;
+    case AST_LT:
+        _cln_compile_binop(compiler, OP_LT, ast, dst);
+        break;
+    case AST_EQ:
+        _cln_compile_binop(compiler, OP_EQ, ast, dst);
+        break;
+    case AST_GT:
+        _cln_compile_binop(compiler, OP_GT, ast, dst);
+        break;
+    case AST_LE:
+        _cln_compile_binop(compiler, OP_LE, ast, dst);
+        break;
+    case AST_GE:
+        _cln_compile_binop(compiler, OP_GE, ast, dst);
+        break;
+    default:
+        cln_panic(
+            "CelineError: unexpected syntax error: %s\n",
+            clnAstKindNames[ast->akind]
+        );
+        break;
+    }
+    compiler->freereg = saved;
+}
+
+// -*- void _cln_eval_assign() counterpart
+static void _cln_compile_assign(Compiler *compiler, Ast *ast){
+    Ast *lhs = cln_ast_node(ast);
+    int self = _cln_reserve_reg(compiler);
+    int reg, index;
+    _cln_compile_expr(compiler, cln_ast_next(lhs), self);
+    switch(lhs->akind){
+    case AST_IDENT:
+        _cln_compile_store(compiler, lhs, self);
+        break;
+    case AST_INDEX:
+        index = _cln_reserve_reg(compiler);
+        reg = _cln_reserve_reg(compiler);
+        _cln_compile_expr(compiler, cln_ast_node(lhs), index);
+        _cln_compile_load(compiler, lhs, reg);
+        _cln_emit(compiler, CLN_ABC(OP_SETINDEX, reg, index, self));
+        break;
+    case AST_FIELD:
+        reg = _cln_reserve_reg(compiler);
+        _cln_compile_load(compiler, lhs, reg);
+        _cln_emit(compiler, CLN_ABC(OP_SETFIELD, reg, self, 0));
+        _cln_emit(compiler, CLN_AX(OP_EXTRAARG, _cln_add_field_cache(cln_ast_node(lhs)->obj)));
+        break;
+    default:
+        cln_panic("CelineError: syntax error: %d\n", lhs->akind);
+        break;
+    }
+}
+
+// -*- void _cln_eval_statement() counterpart
+static void _cln_compile_statement(Compiler *compiler, Ast *ast){
+    int saved = compiler->freereg;
+    int reg, loop, exit, skip;
+    switch(ast->akind){
+    case AST_ASSIGN:
+    case AST_LOCAL:
+        _cln_compile_assign(compiler, ast);
+        break;
+    case AST_WHILE:
+        reg = _cln_reserve_reg(compiler);
+        loop = (int)compiler->proto->ncode;
+        _cln_compile_expr(compiler, cln_ast_node(ast), reg);
+        exit = _cln_emit_jump(compiler, OP_JMPIFNOT, reg);
+        _cln_compile_statement(compiler, cln_ast_next(cln_ast_node(ast)));
+        _cln_patch_jump(compiler, _cln_emit_jump(compiler, OP_JMP, 0), loop);
+        _cln_patch_jump(compiler, exit, (int)compiler->proto->ncode);
+        break;
+    case AST_IF:
+        reg = _cln_reserve_reg(compiler);
+        _cln_compile_expr(compiler, cln_ast_node(ast), reg);
+        skip = _cln_emit_jump(compiler, OP_JMPIFNOT, reg);
+        _cln_compile_statement(compiler, cln_ast_next(cln_ast_node(ast)));
+        if(cln_ast_next(cln_ast_next(cln_ast_node(ast)))){
+            exit = _cln_emit_jump(compiler, OP_JMP, 0);
+            _cln_patch_jump(compiler, skip, (int)compiler->proto->ncode);
+            _cln_compile_statement(compiler, cln_ast_next(cln_ast_next(cln_ast_node(ast))));
+            _cln_patch_jump(compiler, exit, (int)compiler->proto->ncode);
+        }else{
+            _cln_patch_jump(compiler, skip, (int)compiler->proto->ncode);
+        }
+        break;
+    case AST_PRINT:
+        reg = _cln_reserve_reg(compiler);
+        _cln_compile_expr(compiler, cln_ast_node(ast), reg);
+        _cln_emit(compiler, CLN_ABC(OP_PRINT, reg, 0, 0));
+        break;
+    case AST_RETURN:
+        reg = _cln_reserve_reg(compiler);
+        _cln_compile_expr(compiler, cln_ast_node(ast), reg);
+        // - the call just emitted becomes a tail call, the return stays
+        // - for the frames that cannot be replaced
+        if(compiler->function && cln_ast_node(ast)->akind == AST_CALL){
+            compiler->proto->code[compiler->proto->ncode-1] += OP_TAILCALL - OP_CALL;
+        }else if(compiler->function && cln_ast_node(ast)->akind == AST_MCALL){
+            compiler->proto->code[compiler->proto->ncode-1] += OP_TAILMCALL - OP_MCALL;
+        }
+        _cln_emit(compiler, CLN_ABC(OP_RETURN, reg, 1, 0));
+        break;
+    case AST_DEF:
+        reg = _cln_reserve_reg(compiler);
+        _cln_emit(compiler, CLN_ABX(OP_CLOSURE, reg, _cln_compile_def(compiler, ast)));
+        if(ast->obj){
+            _cln_compile_store(compiler, ast, reg);
+        }
+        break;
+    case AST_CALL:
+    case AST_MCALL:
+        _cln_compile_expr(compiler, ast, _cln_reserve_reg(compiler));
+        break;
+    case AST_EMPTY:
+        _cln_compile_block(compiler, cln_ast_node(ast));
+        break;
+    case AST_IMPORT:
+        cln_checktype(ast->obj, TY_STRING);
+        _cln_emit(compiler, CLN_ABX(OP_IMPORT, 0, _cln_add_const(compiler, ast->obj)));
+        break;
+    case AST_LOAD:
+        cln_checktype(ast->obj, TY_STRING);
+        _cln_emit(compiler, CLN_ABX(OP_LOAD, 0, _cln_add_const(compiler, ast->obj)));
+        break;
+    default:
+        fprintf(stderr, "CelineError: syntax error: %s\n", clnAstKindNames[ast->akind]);
+        break;
+    }
+    compiler->freereg = saved;
+}
+
+// -*-
+static void _cln_compile_block(Compiler *compiler, Ast *ast){
+    for(Ast *node=ast; node; node = cln_ast_next(node)){
+        _cln_compile_statement(compiler, node);
+    }
+}
+
+// -*-
+static Proto* _cln_compile_function(Ast *body, int narg, bool function, Symtable *symtable){
+    Compiler compiler;
+    compiler.proto = _cln_new_proto();
+    compiler.proto->narg = narg;
+    compiler.symtable = symtable;
+    compiler.freereg = 0;
+    compiler.function = function;
+    _cln_compile_block(&compiler, body);
+    _cln_emit(&compiler, CLN_ABC(OP_RETURN, 0, 0, 0));
+    return compiler.proto;
+}
+
+// -*-
+Proto* cln_compile(Ast *ast, Symtable *symtable){
+    return _cln_compile_function(ast, 0, false, symtable);
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Disassembler                                                -*-
+// -*---------------------------------------------------------------*-
+// -
+static void _cln_proto_dump_with_indent(Proto *proto, Symtable *symtable, uint32_t indent){
+    for(size_t pc=0; pc < proto->ncode; ++pc){
+        Instruction instr = proto->code[pc];
+        enum OpCode op = CLN_GET_OP(instr);
+        printf("%*s%4zu  %-10s", (int)indent*2, "", pc, clnOpNames[op]);
+        switch(op){
+        case OP_JMP:
+            printf("-> %zu\n", pc + 1 + CLN_GET_SAX(instr));
+            break;
+        case OP_JMPIFNOT:
+            printf("r%d -> %zu\n", CLN_GET_A(instr), pc + 1 + CLN_GET_SBX(instr));
+            break;
+        case OP_GETVAR:
+        case OP_SETVAR:
+            printf("r%d %s\n", CLN_GET_A(instr), symtable->symbols[CLN_GET_BX(instr)]);
+            break;
+        case OP_GETLOCAL:
+        case OP_SETLOCAL:
+            printf("r%d slot %d, depth %d\n", CLN_GET_A(instr), CLN_GET_B(instr), CLN_GET_C(instr));
+            break;
+        case OP_LOADK:
+        case OP_IMPORT:
+        case OP_LOAD:{
+                char *repr = cln_toString(proto->consts[CLN_GET_BX(instr)]);
+                printf("r%d %s\n", CLN_GET_A(instr), repr);
+                cln_dealloc(repr);
+            }//
+            break;
+        case OP_CLOSURE:
+            printf("r%d <function #%d>\n", CLN_GET_A(instr), CLN_GET_BX(instr));
+            break;
+        case OP_EXTRAARG:
+            printf("\"%s\" (cache #%d)\n", cln_field_cache(CLN_GET_AX(instr))->name->name, CLN_GET_AX(instr));
+            break;
+        default:
+            printf("%d %d %d\n", CLN_GET_A(instr), CLN_GET_B(instr), CLN_GET_C(instr));
+            break;
+        }
+    }
+    for(size_t i=0; i < proto->nproto; ++i){
+        Proto *child = proto->protos[i];
+        printf(
+            "%*sfunction #%zu (%d registers, %u slots%s):\n", (int)indent*2, "", i, child->nreg,
+            CLN_FRAME_NSLOT(child->frame), (child->frame & CLN_FRAME_CAPTURED) ? ", captured" : ""
+        );
+        _cln_proto_dump_with_indent(proto->protos[i], symtable, indent+1);
+    }
+}
+
+// -*-
+void cln_proto_dump(Proto *proto, Symtable *symtable){
+    printf("main (%d registers):\n", proto->nreg);
+    _cln_proto_dump_with_indent(proto, symtable, 1);
+}
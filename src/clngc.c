@@ -0,0 +1,403 @@
+#include<string.h>
+#include<time.h>
+
+#include "celine.h"
+
+#ifndef CLN_GC_NURSERY_SIZE
+#define CLN_GC_NURSERY_SIZE         (1 << 20)   // bytes allocated between minor collections
+#endif
+#ifndef CLN_GC_MATURE_MIN
+#define CLN_GC_MATURE_MIN           (8 << 20)   // mature size that triggers the first major collection
+#endif
+#define CLN_GC_INITIAL_CAPACITY     64
+
+// -*---------------------------------------------------------------*-
+// -*- Heap                                                        -*-
+// -*---------------------------------------------------------------*-
+// -*- Objects are never moved. New objects live in the nursery and are
+// -*- promoted to the mature space by the first collection they survive.
+// -*- A minor collection only traces the nursery: mature objects are
+// -*- assumed live, and the ones that were handed a nursery pointer since
+// -*- the last collection are found through the remembered set that
+// -*- cln_gc_barrier() maintains. A major collection traces everything.
+// -*- Captured call frames are mature from the start and written without
+// -*- a barrier: a minor collection scans them all, a major one only
+// -*- keeps those reachable from a live frame or function.
+
+typedef struct{
+    Object *young;              // nursery, newest first
+    Object *old;                // mature space
+    Object *permanent;          // syntax tree constants, never swept
+    Object **remembered;        // mature objects holding nursery pointers
+    size_t nremembered;
+    size_t rememberedcap;
+    Object **gray;              // marked, children not traced yet
+    size_t ngray;
+    size_t graycap;
+    Env **envs;                 // tree walker frames and the root env
+    size_t nenv;
+    size_t envcap;
+    Env *frames;                // captured call frames
+    Value **globals;            // slots registered by native modules
+    size_t nglobal;
+    size_t globalcap;
+    size_t nextMajor;           // mature size that triggers a major collection
+    bool major;                 // the running collection traces the mature space
+} Heap;
+
+static Heap clnHeap = {.nextMajor = CLN_GC_MATURE_MIN};
+
+GCStats clnGCStats;
+GCRoots clnGCRoots;
+bool clnGCRequested;
+
+// -*-
+static void _cln_gc_grow(void **items, size_t *cap, size_t size){
+    *cap = *cap ? 2*(*cap) : CLN_GC_INITIAL_CAPACITY;
+    *items = realloc(*items, size*(*cap));
+    if(!*items){
+        cln_panic("CelineError: memory allocation failure\n");
+    }
+}
+
+// -*-
+void cln_gc_grow_roots(){
+    _cln_gc_grow((void**)&clnGCRoots.values, &clnGCRoots.cap, sizeof(Value));
+}
+
+// -*- bytes owned by an object, header included
+static size_t _cln_gc_sizeof(Object *obj){
+    size_t size = sizeof(Object) + sizeof(Value)*obj->slotcap;
+    switch(obj->type){
+    case TY_STRING:
+        size += strlen(obj->val.cstr) + 1;
+        break;
+    case TY_ARRAY:
+        size += sizeof(Value)*obj->val.array.len;
+        break;
+    default:
+        break;
+    }
+    return size;
+}
+
+// -*-
+static void _cln_gc_free(Object *obj){
+    if(obj->isPrototype){
+        ++clnProtoEpoch;    // inline caches may still point to it
+    }
+    cln_slab_free(obj->slots, sizeof(Value)*obj->slotcap);
+    switch(obj->type){
+    case TY_STRING:
+        free(obj->val.cstr);
+        break;
+    case TY_ARRAY:
+        cln_slab_free(obj->val.array.data, sizeof(Value)*obj->val.array.len);
+        break;
+    default:
+        break;
+    }
+    cln_slab_free(obj, sizeof(Object));
+}
+
+// -*-
+static void _cln_gc_update_peak(){
+    size_t heap = clnGCStats.youngBytes + clnGCStats.oldBytes + clnGCStats.permanentBytes;
+    if(heap > clnGCStats.peakBytes){
+        clnGCStats.peakBytes = heap;
+    }
+}
+
+// -*-
+Object* cln_gc_new_object(){
+    Object *obj = (Object*)cln_slab_alloc(sizeof(Object));
+    obj->gcnext = clnHeap.young;
+    clnHeap.young = obj;
+    cln_gc_account(obj, sizeof(Object));
+    return obj;
+}
+
+// -*- `bytes` more (or less) memory owned by `obj`
+void cln_gc_account(Object *obj, long bytes){
+    if(obj->gcflags & CLN_GC_PERMANENT){
+        clnGCStats.permanentBytes += bytes;
+    }else if(obj->gcflags & CLN_GC_OLD){
+        clnGCStats.oldBytes += bytes;
+    }else{
+        clnGCStats.youngBytes += bytes;
+        if(clnGCStats.youngBytes >= CLN_GC_NURSERY_SIZE){
+            clnGCRequested = true;
+        }
+    }
+    if(bytes > 0){
+        clnGCStats.allocatedBytes += bytes;
+        _cln_gc_update_peak();
+    }
+}
+
+// -*- a call frame outliving its call, accounted to the mature space
+Env* cln_gc_new_env(uint32_t nslot){
+    Env *env = cln_new_env(nslot);
+    env->gcflags = CLN_GC_CAPTURED;
+    env->gcnext = clnHeap.frames;
+    clnHeap.frames = env;
+    size_t size = sizeof(Env) + sizeof(Value)*nslot;
+    clnGCStats.oldBytes += size;
+    clnGCStats.allocatedBytes += size;
+    _cln_gc_update_peak();
+    if(clnGCStats.oldBytes >= clnHeap.nextMajor){
+        clnGCRequested = true;
+    }
+    return env;
+}
+
+// -*- literals live as long as the syntax tree holding them
+Value cln_gc_permanent(Value v){
+    if(!cln_is_object(v)){
+        return v;
+    }
+    Object *obj = cln_as_object(v);
+    if(obj->gcflags & CLN_GC_PERMANENT){
+        return v;
+    }
+    if(obj->gcflags & CLN_GC_OLD){
+        cln_panic("CelineError: only nursery objects can be made permanent\n");
+    }
+    Object **link = &clnHeap.young;
+    while(*link != obj){
+        link = &(*link)->gcnext;
+    }
+    *link = obj->gcnext;
+    size_t size = _cln_gc_sizeof(obj);
+    clnGCStats.youngBytes -= size;
+    clnGCStats.permanentBytes += size;
+    obj->gcflags |= CLN_GC_OLD | CLN_GC_PERMANENT;
+    obj->gcnext = clnHeap.permanent;
+    clnHeap.permanent = obj;
+    return v;
+}
+
+// -*- slow path of cln_gc_barrier()
+void cln_gc_remember(Object *obj){
+    if(clnHeap.nremembered == clnHeap.rememberedcap){
+        _cln_gc_grow((void**)&clnHeap.remembered, &clnHeap.rememberedcap, sizeof(Object*));
+    }
+    obj->gcflags |= CLN_GC_REMEMBERED;
+    clnHeap.remembered[clnHeap.nremembered++] = obj;
+}
+
+// -*-
+void cln_gc_push_env(Env *env){
+    if(clnHeap.nenv == clnHeap.envcap){
+        _cln_gc_grow((void**)&clnHeap.envs, &clnHeap.envcap, sizeof(Env*));
+    }
+    clnHeap.envs[clnHeap.nenv++] = env;
+}
+
+// -*-
+void cln_gc_pop_env(){
+    --clnHeap.nenv;
+}
+
+// -*- for native modules keeping values outside of any env
+void cln_gc_add_root(Value *slot){
+    if(clnHeap.nglobal == clnHeap.globalcap){
+        _cln_gc_grow((void**)&clnHeap.globals, &clnHeap.globalcap, sizeof(Value*));
+    }
+    clnHeap.globals[clnHeap.nglobal++] = slot;
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Collector                                                   -*-
+// -*---------------------------------------------------------------*-
+// -*-
+void cln_gc_mark(Value v){
+    if(!cln_is_object(v)){
+        return;
+    }
+    Object *obj = cln_as_object(v);
+    if(obj->gcflags & CLN_GC_MARKED){
+        return;
+    }
+    if((obj->gcflags & CLN_GC_OLD) && !clnHeap.major){
+        return;
+    }
+    obj->gcflags |= CLN_GC_MARKED;
+    if(clnHeap.ngray == clnHeap.graycap){
+        _cln_gc_grow((void**)&clnHeap.gray, &clnHeap.graycap, sizeof(Object*));
+    }
+    clnHeap.gray[clnHeap.ngray++] = obj;
+}
+
+// -*-
+static void _cln_gc_trace(Object *obj){
+    for(uint32_t i=0; i < obj->shape->nslot; ++i){
+        cln_gc_mark(obj->slots[i]);
+    }
+    if(obj->type == TY_ARRAY){
+        for(size_t i=0; i < obj->val.array.len; ++i){
+            cln_gc_mark(obj->val.array.data[i]);
+        }
+    }else if(obj->type == TY_FUN && obj->val.fun.closure){
+        cln_gc_mark_env(obj->val.fun.closure);
+    }
+}
+
+// -*- an env and the enclosing frames it reaches
+void cln_gc_mark_env(Env *env){
+    for(; env; env = env->parent){
+        if(env->gcflags & CLN_GC_CAPTURED){
+            if(!clnHeap.major || (env->gcflags & CLN_GC_MARKED)){
+                return;     // scanned as a root of the minor collection
+            }
+            env->gcflags |= CLN_GC_MARKED;
+        }
+        for(uint32_t i=0; i < env->nslot; ++i){
+            cln_gc_mark(env->slots[i]);
+        }
+    }
+}
+
+// -*-
+static void _cln_gc_mark_roots(){
+    for(size_t i=0; i < clnHeap.nenv; ++i){
+        cln_gc_mark_env(clnHeap.envs[i]);
+    }
+    for(size_t i=0; i < clnGCRoots.len; ++i){
+        cln_gc_mark(clnGCRoots.values[i]);
+    }
+    for(size_t i=0; i < clnHeap.nglobal; ++i){
+        cln_gc_mark(*clnHeap.globals[i]);
+    }
+    cln_vm_mark_roots();
+    if(clnHeap.major){
+        for(Object *obj = clnHeap.permanent; obj; obj = obj->gcnext){
+            obj->gcflags |= CLN_GC_MARKED;
+            _cln_gc_trace(obj);
+        }
+    }else{
+        for(size_t i=0; i < clnHeap.nremembered; ++i){
+            _cln_gc_trace(clnHeap.remembered[i]);
+        }
+        for(Env *env = clnHeap.frames; env; env = env->gcnext){
+            for(uint32_t i=0; i < env->nslot; ++i){
+                cln_gc_mark(env->slots[i]);
+            }
+        }
+    }
+    while(clnHeap.ngray){
+        _cln_gc_trace(clnHeap.gray[--clnHeap.ngray]);
+    }
+}
+
+// -*- survivors are promoted, the rest is freed
+static void _cln_gc_sweep_young(){
+    Object *obj = clnHeap.young;
+    while(obj){
+        Object *next = obj->gcnext;
+        size_t size = _cln_gc_sizeof(obj);
+        if(obj->gcflags & CLN_GC_MARKED){
+            obj->gcflags = (obj->gcflags & ~CLN_GC_MARKED) | CLN_GC_OLD;
+            obj->gcnext = clnHeap.old;
+            clnHeap.old = obj;
+            clnGCStats.oldBytes += size;
+            clnGCStats.promotedBytes += size;
+        }else{
+            clnGCStats.freedBytes += size;
+            _cln_gc_free(obj);
+        }
+        obj = next;
+    }
+    clnHeap.young = NULL;
+    clnGCStats.youngBytes = 0;
+}
+
+// -*-
+static void _cln_gc_sweep_old(){
+    Object **link = &clnHeap.old;
+    while(*link){
+        Object *obj = *link;
+        if(obj->gcflags & CLN_GC_MARKED){
+            obj->gcflags &= ~CLN_GC_MARKED;
+            link = &obj->gcnext;
+        }else{
+            size_t size = _cln_gc_sizeof(obj);
+            clnGCStats.oldBytes -= size;
+            clnGCStats.freedBytes += size;
+            *link = obj->gcnext;
+            _cln_gc_free(obj);
+        }
+    }
+    for(Object *obj = clnHeap.permanent; obj; obj = obj->gcnext){
+        obj->gcflags &= ~CLN_GC_MARKED;
+    }
+}
+
+// -*-
+static void _cln_gc_sweep_frames(){
+    Env **link = &clnHeap.frames;
+    while(*link){
+        Env *env = *link;
+        if(env->gcflags & CLN_GC_MARKED){
+            env->gcflags &= ~CLN_GC_MARKED;
+            link = &env->gcnext;
+        }else{
+            size_t size = sizeof(Env) + sizeof(Value)*env->nslot;
+            clnGCStats.oldBytes -= size;
+            clnGCStats.freedBytes += size;
+            *link = env->gcnext;
+            cln_slab_free(env, size);
+        }
+    }
+}
+
+// -*-
+void cln_gc_collect(bool major){
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    clnHeap.major = major;
+    _cln_gc_mark_roots();
+    if(major){
+        _cln_gc_sweep_old();
+        _cln_gc_sweep_frames();
+    }
+    _cln_gc_sweep_young();
+    // - every nursery survivor is mature now: no old -> young pointers left
+    for(size_t i=0; i < clnHeap.nremembered; ++i){
+        clnHeap.remembered[i]->gcflags &= ~CLN_GC_REMEMBERED;
+    }
+    clnHeap.nremembered = 0;
+    if(major){
+        ++clnGCStats.major;
+        clnHeap.nextMajor = 2*clnGCStats.oldBytes;
+        if(clnHeap.nextMajor < CLN_GC_MATURE_MIN){
+            clnHeap.nextMajor = CLN_GC_MATURE_MIN;
+        }
+    }else{
+        ++clnGCStats.minor;
+    }
+    clnHeap.major = false;
+    clnGCRequested = false;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    clnGCStats.pauseMs += (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)/1e6;
+}
+
+// -*- slow path of cln_gc_safepoint()
+void cln_gc_collect_pending(){
+    cln_gc_collect(clnGCStats.oldBytes >= clnHeap.nextMajor);
+}
+
+// -*-
+void cln_gc_print_stats(FILE *stream){
+    fprintf(
+        stream,
+        "gc: %zu minor, %zu major collections, %.3f ms paused\n"
+        "gc: heap %zu bytes (nursery %zu, mature %zu, permanent %zu), peak %zu\n"
+        "gc: %zu bytes allocated, %zu freed, %zu promoted\n",
+        clnGCStats.minor, clnGCStats.major, clnGCStats.pauseMs,
+        clnGCStats.youngBytes + clnGCStats.oldBytes + clnGCStats.permanentBytes,
+        clnGCStats.youngBytes, clnGCStats.oldBytes, clnGCStats.permanentBytes,
+        clnGCStats.peakBytes, clnGCStats.allocatedBytes, clnGCStats.freedBytes,
+        clnGCStats.promotedBytes
+    );
+}
@@ -0,0 +1,372 @@
+#include<string.h>
+
+#include "celine.h"
+
+#define CLN_INFER_MAX_ROUNDS        4
+#define CLN_INFER_NONE              0xff    // no `return` seen yet
+
+// -*---------------------------------------------------------------*-
+// -*- Type inference                                              -*-
+// -*---------------------------------------------------------------*-
+// -*- Forward, flow-sensitive: the state maps the slots of the frame
+// -*- being inferred and the globals to their proven type. Assigning a
+// -*- variable gives it the type of the value, a check that passed gives
+// -*- it the checked type, and branches and loop heads join to UNKNOWN
+// -*- where they disagree. A call may assign any global, and the slots
+// -*- of a captured frame, so it forgets them.
+// -*- Function results are only used for globals bound by a single def
+// -*- in a closed unit. They are found by rounds starting from UNKNOWN,
+// -*- each round only building on what earlier rounds proved.
+
+typedef struct{
+    Symtable *symtable;
+    uint32_t nglobal;
+    Ast **defs;                 // per global: the def binding it, if that is its only binding
+    uint8_t *results;           // per global: proven result of calling `defs`
+    bool changed;               // a result improved during this round
+    // - function being inferred -
+    uint8_t *state;             // frame slots, then globals
+    uint32_t nslot;
+    bool captured;
+    uint8_t returns;            // joined over its `return`s
+} Infer;
+
+// -*-
+static uint8_t _cln_infer_join(uint8_t a, uint8_t b){
+    if(a == CLN_INFER_NONE){
+        return b;
+    }
+    return a == b ? a : CLN_TYPE_UNKNOWN;
+}
+
+// -*- state entry of a resolved reference, NULL if it is not tracked
+static uint8_t* _cln_infer_var(Infer *infer, Ast *ref){
+    if(ref->aux == CLN_BIND_GLOBAL){
+        return &infer->state[infer->nslot + cln_as_integer(ref->obj)];
+    }
+    if(CLN_BIND_DEPTH(ref->aux) == 0){
+        return &infer->state[CLN_BIND_SLOT(ref->aux)];
+    }
+    return NULL;
+}
+
+// -*-
+static uint8_t _cln_infer_read(Infer *infer, Ast *ref){
+    uint8_t *type = _cln_infer_var(infer, ref);
+    return type ? *type : CLN_TYPE_UNKNOWN;
+}
+
+// -*-
+static void _cln_infer_write(Infer *infer, Ast *ref, uint8_t type){
+    uint8_t *entry = _cln_infer_var(infer, ref);
+    if(entry){
+        *entry = type;
+    }
+}
+
+// -*- `ast` was checked to be of `type`
+static void _cln_infer_refine(Infer *infer, Ast *ast, enum Type type){
+    if(ast->akind == AST_IDENT){
+        _cln_infer_write(infer, ast, CLN_TYPE(type));
+    }
+}
+
+// -*- after running code of another function
+static void _cln_infer_clobber(Infer *infer){
+    if(infer->captured){
+        memset(infer->state, CLN_TYPE_UNKNOWN, infer->nslot);
+    }
+    memset(infer->state + infer->nslot, CLN_TYPE_UNKNOWN, infer->nglobal);
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Expressions                                                 -*-
+// -*---------------------------------------------------------------*-
+static uint8_t _cln_infer_expr(Infer *infer, Ast *ast);
+static void _cln_infer_statement(Infer *infer, Ast *ast);
+
+// -*-
+static void _cln_infer_args(Infer *infer, Ast *arglist){
+    for(Ast *arg = cln_ast_node(arglist); arg; arg = cln_ast_next(arg)){
+        _cln_infer_expr(infer, arg);
+    }
+}
+
+// -*- def (arglist){ body } -> proven result of a call
+static uint8_t _cln_infer_function(Infer *infer, Ast *ast){
+    Infer outer = *infer;
+    Ast *body = cln_ast_next(cln_ast_node(ast));
+    infer->nslot = CLN_FRAME_NSLOT(body->aux);
+    infer->captured = (body->aux & CLN_FRAME_CAPTURED) != 0;
+    infer->state = (uint8_t*)cln_alloc(infer->nslot + infer->nglobal);
+    infer->returns = CLN_INFER_NONE;
+    _cln_infer_statement(infer, body);
+    // - falling off the end returns nil
+    Ast *last = body->last ? body + body->last : NULL;
+    uint8_t result = last && last->akind == AST_RETURN ? infer->returns : CLN_TYPE_UNKNOWN;
+    cln_dealloc(infer->state);
+    infer->state = outer.state;
+    infer->nslot = outer.nslot;
+    infer->captured = outer.captured;
+    infer->returns = outer.returns;
+    return result;
+}
+
+// -*- the INDEX node holds the type of the array variable
+static void _cln_infer_index(Infer *infer, Ast *ast){
+    _cln_infer_expr(infer, cln_ast_node(ast));
+    _cln_infer_refine(infer, cln_ast_node(ast), TY_INTEGER);
+    ast->type = _cln_infer_read(infer, ast) == CLN_TYPE(TY_ARRAY) ? CLN_TYPE(TY_ARRAY) : CLN_TYPE_UNKNOWN;
+    _cln_infer_write(infer, ast, CLN_TYPE(TY_ARRAY));
+}
+
+// -*- mirrors the evaluation order of the tree walker
+static uint8_t _cln_infer_expr(Infer *infer, Ast *ast){
+    Ast *lhs = cln_ast_node(ast);
+    uint8_t type = CLN_TYPE_UNKNOWN;
+    switch(ast->akind){
+    case AST_INTEGER:
+    case AST_READ_INT:
+        type = CLN_TYPE(TY_INTEGER);
+        break;
+    case AST_FLOAT:
+        type = CLN_TYPE(TY_FLOAT);
+        break;
+    case AST_STRING:
+    case AST_INPUT:
+        type = CLN_TYPE(TY_STRING);
+        break;
+    case AST_OBJECT:
+        type = CLN_TYPE(TY_OBJECT);
+        break;
+    case AST_IDENT:
+        type = _cln_infer_read(infer, ast);
+        break;
+    case AST_ARRAY:
+        _cln_infer_expr(infer, lhs);
+        _cln_infer_refine(infer, lhs, TY_INTEGER);
+        type = CLN_TYPE(TY_ARRAY);
+        break;
+    case AST_INDEX:
+        _cln_infer_index(infer, ast);
+        return CLN_TYPE_UNKNOWN;
+    case AST_DEF:
+        _cln_infer_function(infer, ast);
+        type = CLN_TYPE(TY_FUN);
+        break;
+    case AST_CALL:
+        _cln_infer_write(infer, ast, CLN_TYPE(TY_FUN));
+        _cln_infer_args(infer, lhs);
+        _cln_infer_clobber(infer);
+        if(ast->aux == CLN_BIND_GLOBAL && infer->defs && infer->defs[cln_as_integer(ast->obj)]){
+            type = infer->results[cln_as_integer(ast->obj)];
+        }
+        break;
+    case AST_NEW:
+        _cln_infer_write(infer, lhs, CLN_TYPE(TY_FUN));
+        _cln_infer_args(infer, cln_ast_node(lhs));
+        _cln_infer_clobber(infer);
+        type = CLN_TYPE(TY_OBJECT);
+        break;
+    case AST_MCALL:
+        _cln_infer_args(infer, cln_ast_next(lhs));
+        _cln_infer_clobber(infer);
+        break;
+    case AST_NOT:
+        _cln_infer_expr(infer, lhs);
+        _cln_infer_refine(infer, lhs, TY_INTEGER);
+        type = CLN_TYPE(TY_INTEGER);
+        break;
+    case AST_ADD:
+    case AST_SUB:
+    case AST_MUL:
+    case AST_DIV:
+    case AST_AND:
+    case AST_OR:
+    case AST_LT:
+    case AST_EQ:
+    case AST_GT:
+    case AST_LE:
+    case AST_GE:
+        _cln_infer_expr(infer, lhs);
+        _cln_infer_refine(infer, lhs, TY_INTEGER);
+        _cln_infer_expr(infer, cln_ast_next(lhs));
+        _cln_infer_refine(infer, cln_ast_next(lhs), TY_INTEGER);
+        type = CLN_TYPE(TY_INTEGER);
+        break;
+    default:
+        for(; lhs; lhs = cln_ast_next(lhs)){
+            _cln_infer_expr(infer, lhs);
+        }
+        break;
+    }
+    ast->type = type;
+    return type;
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Statements                                                  -*-
+// -*---------------------------------------------------------------*-
+// -*- the loop head is inferred from the join of its entry and of the
+// -*- end of the body, until that join is stable
+static void _cln_infer_while(Infer *infer, Ast *ast){
+    Ast *cond = cln_ast_node(ast);
+    size_t size = infer->nslot + infer->nglobal;
+    uint8_t *head = (uint8_t*)cln_alloc(size);
+    memcpy(head, infer->state, size);
+    bool stable = false;
+    while(!stable){
+        _cln_infer_expr(infer, cond);
+        _cln_infer_statement(infer, cln_ast_next(cond));
+        stable = true;
+        for(size_t i=0; i < size; ++i){
+            uint8_t type = _cln_infer_join(head[i], infer->state[i]);
+            if(type != head[i]){
+                head[i] = type;
+                stable = false;
+            }
+        }
+        memcpy(infer->state, head, size);
+    }
+    _cln_infer_expr(infer, cond);   // the test that exits
+    cln_dealloc(head);
+}
+
+// -*-
+static void _cln_infer_if(Infer *infer, Ast *ast){
+    Ast *cond = cln_ast_node(ast);
+    size_t size = infer->nslot + infer->nglobal;
+    _cln_infer_expr(infer, cond);
+    uint8_t *taken = (uint8_t*)cln_alloc(size);
+    memcpy(taken, infer->state, size);
+    _cln_infer_statement(infer, cln_ast_next(cond));
+    uint8_t *swap = taken;
+    taken = infer->state;
+    infer->state = swap;
+    if(cln_ast_next(cln_ast_next(cond))){
+        _cln_infer_statement(infer, cln_ast_next(cln_ast_next(cond)));
+    }
+    for(size_t i=0; i < size; ++i){
+        taken[i] = _cln_infer_join(taken[i], infer->state[i]);
+    }
+    memcpy(infer->state, taken, size);
+    cln_dealloc(taken);
+}
+
+// -*-
+static void _cln_infer_statement(Infer *infer, Ast *ast){
+    Ast *lhs = cln_ast_node(ast);
+    uint8_t type;
+    switch(ast->akind){
+    case AST_ASSIGN:
+    case AST_LOCAL:
+        type = _cln_infer_expr(infer, cln_ast_next(lhs));
+        if(lhs->akind == AST_IDENT){
+            _cln_infer_write(infer, lhs, type);
+        }else if(lhs->akind == AST_INDEX){
+            _cln_infer_index(infer, lhs);
+        }
+        break;
+    case AST_WHILE:
+        _cln_infer_while(infer, ast);
+        break;
+    case AST_IF:
+        _cln_infer_if(infer, ast);
+        break;
+    case AST_RETURN:
+        infer->returns = _cln_infer_join(infer->returns, _cln_infer_expr(infer, lhs));
+        break;
+    case AST_DEF:
+        type = _cln_infer_function(infer, ast);
+        if(infer->defs && ast->aux == CLN_BIND_GLOBAL && infer->defs[cln_as_integer(ast->obj)] == ast &&
+                infer->results[cln_as_integer(ast->obj)] != type){
+            infer->results[cln_as_integer(ast->obj)] = type;
+            infer->changed = true;
+        }
+        if(ast->obj){
+            _cln_infer_write(infer, ast, CLN_TYPE(TY_FUN));
+        }
+        break;
+    case AST_EMPTY:
+        for(Ast *node = lhs; node; node = cln_ast_next(node)){
+            _cln_infer_statement(infer, node);
+        }
+        break;
+    case AST_IMPORT:
+    case AST_LOAD:
+        _cln_infer_clobber(infer);
+        break;
+    default:
+        _cln_infer_expr(infer, ast);
+        break;
+    }
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Driver                                                      -*-
+// -*---------------------------------------------------------------*-
+// -*- counts the bindings of each global, false if the unit imports code
+static bool _cln_infer_bindings(Ast *ast, uint32_t *count, Ast **defs){
+    for(Ast *node = ast; node; node = cln_ast_next(node)){
+        switch(node->akind){
+        case AST_ASSIGN:
+        case AST_LOCAL:
+            if(cln_ast_node(node)->akind == AST_IDENT && cln_ast_node(node)->aux == CLN_BIND_GLOBAL){
+                ++count[cln_as_integer(cln_ast_node(node)->obj)];
+            }
+            break;
+        case AST_DEF:
+            // - named def statements are the only defs with a binding
+            if(node->obj && node->aux == CLN_BIND_GLOBAL){
+                ++count[cln_as_integer(node->obj)];
+                defs[cln_as_integer(node->obj)] = node;
+            }
+            break;
+        case AST_IMPORT:
+        case AST_LOAD:
+            return false;
+        default:
+            break;
+        }
+        if(!_cln_infer_bindings(cln_ast_node(node), count, defs)){
+            return false;
+        }
+    }
+    return true;
+}
+
+// -*-
+void cln_infer(Ast *root, Symtable *symtable, bool closed){
+    Infer infer;
+    memset(&infer, 0, sizeof(Infer));
+    infer.symtable = symtable;
+    infer.nglobal = symtable->len;
+    if(closed){
+        uint32_t *count = (uint32_t*)cln_alloc(sizeof(uint32_t)*infer.nglobal);
+        infer.defs = (Ast**)cln_alloc(sizeof(Ast*)*infer.nglobal);
+        infer.results = (uint8_t*)cln_alloc(infer.nglobal);
+        if(_cln_infer_bindings(root, count, infer.defs)){
+            for(uint32_t id=0; id < infer.nglobal; ++id){
+                if(count[id] != 1){
+                    infer.defs[id] = NULL;
+                }
+            }
+        }else{
+            cln_dealloc(infer.defs);
+            infer.defs = NULL;
+        }
+        cln_dealloc(count);
+    }
+    infer.state = (uint8_t*)cln_alloc(infer.nglobal);
+    for(int round=0; round < CLN_INFER_MAX_ROUNDS; ++round){
+        infer.changed = false;
+        memset(infer.state, CLN_TYPE_UNKNOWN, infer.nglobal);
+        _cln_infer_statement(&infer, root);
+        if(!infer.changed){
+            break;
+        }
+    }
+    cln_dealloc(infer.state);
+    cln_dealloc(infer.defs);
+    cln_dealloc(infer.results);
+}
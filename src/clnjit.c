@@ -0,0 +1,854 @@
+#include<stddef.h>
+#include<string.h>
+#include<unistd.h>
+
+#include "celine.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CLN_JIT_X64
+#include<sys/mman.h>
+#endif
+
+#define CLN_JIT_CACHE_INITIAL_CAPACITY  64
+#define CLN_JIT_CODE_INITIAL_CAPACITY   512
+#define CLN_JIT_CHUNK_SIZE              (64 << 10)  // executable memory is mapped by this many bytes
+
+// -*---------------------------------------------------------------*-
+// -*- Code cache                                                  -*-
+// -*---------------------------------------------------------------*-
+// -*- body -> JitCode, open addressing on the node address
+typedef struct{
+    Ast **bodies;
+    JitCode **codes;
+    size_t len;
+    size_t cap;
+} JitCache;
+
+static JitCache clnJitCache;
+
+// -*-
+static size_t _cln_jit_hash(Ast *body, size_t cap){
+    return (size_t)(((uintptr_t)body >> 5) * 0x9e3779b97f4a7c15ULL) & (cap - 1);
+}
+
+// -*-
+static JitCode** _cln_jit_cache_slot(Ast *body){
+    if(2*(clnJitCache.len + 1) > clnJitCache.cap){
+        JitCache grown;
+        grown.cap = clnJitCache.cap ? 2*clnJitCache.cap : CLN_JIT_CACHE_INITIAL_CAPACITY;
+        grown.len = clnJitCache.len;
+        grown.bodies = (Ast**)cln_alloc(sizeof(Ast*)*grown.cap);
+        grown.codes = (JitCode**)cln_alloc(sizeof(JitCode*)*grown.cap);
+        for(size_t i=0; i < clnJitCache.cap; ++i){
+            if(clnJitCache.bodies[i]){
+                size_t at = _cln_jit_hash(clnJitCache.bodies[i], grown.cap);
+                while(grown.bodies[at]){
+                    at = (at + 1) & (grown.cap - 1);
+                }
+                grown.bodies[at] = clnJitCache.bodies[i];
+                grown.codes[at] = clnJitCache.codes[i];
+            }
+        }
+        cln_dealloc(clnJitCache.bodies);
+        cln_dealloc(clnJitCache.codes);
+        clnJitCache = grown;
+    }
+    size_t at = _cln_jit_hash(body, clnJitCache.cap);
+    while(clnJitCache.bodies[at] && clnJitCache.bodies[at] != body){
+        at = (at + 1) & (clnJitCache.cap - 1);
+    }
+    if(!clnJitCache.bodies[at]){
+        clnJitCache.bodies[at] = body;
+        ++clnJitCache.len;
+    }
+    return &clnJitCache.codes[at];
+}
+
+#ifdef CLN_JIT_X64
+// -*---------------------------------------------------------------*-
+// -*- Runtime                                                     -*-
+// -*---------------------------------------------------------------*-
+// -*- what the generated code calls on its slow paths, with the same
+// -*- semantics as the tree walker
+
+// -*- integer operators
+static Value _cln_jit_slow_binop(int akind, Value lhs, Value rhs){
+    cln_checktype(lhs, TY_INTEGER);
+    cln_checktype(rhs, TY_INTEGER);
+    long a = cln_as_integer(lhs);
+    long b = cln_as_integer(rhs);
+    switch(akind){
+    case AST_ADD:
+        return cln_new_integer(a + b);
+    case AST_SUB:
+        return cln_new_integer(a - b);
+    case AST_MUL:
+        return cln_new_integer(a * b);
+    case AST_DIV:
+        return cln_new_integer(a / b);
+    case AST_AND:
+        return cln_new_integer(a && b);
+    case AST_OR:
+        return cln_new_integer(a || b);
+    case AST_LT:
+        return cln_new_integer(a < b);
+    case AST_EQ:
+        return cln_new_integer(a == b);
+    case AST_GT:
+        return cln_new_integer(a > b);
+    case AST_LE:
+        return cln_new_integer(a <= b);
+    default:
+        return cln_new_integer(a >= b);
+    }
+}
+
+// -*-
+static Value _cln_jit_slow_not(Value self){
+    cln_checktype(self, TY_INTEGER);
+    return cln_new_integer(!cln_as_integer(self));
+}
+
+// -*- the left operand is checked before the right one runs
+static void _cln_jit_check_integer(Value self){
+    cln_checktype(self, TY_INTEGER);
+}
+
+// -*- the callee is checked before its arguments run
+static void _cln_jit_check_fun(Value self){
+    cln_checktype(self, TY_FUN);
+}
+
+// -*-
+static int _cln_jit_truth(Value self){
+    return cln_is_true(self);
+}
+
+// -*-
+static void _cln_jit_unset(const char *name){
+    cln_panic("CelineError: %s is not initialized\n", name);
+}
+
+// -*-
+static void _cln_jit_print(Value self){
+    char *repr = cln_toString(self);
+    printf("\n%s\n", repr);
+    cln_dealloc(repr);
+}
+
+// -*---------------------------------------------------------------*-
+// -*- x86-64 encoding                                             -*-
+// -*---------------------------------------------------------------*-
+// -*- Only the legacy registers are used: rbx holds the frame slots,
+// -*- rax the value being computed, rcx and rdx are scratch, r11 holds
+// -*- the address of called helpers.
+enum{ RAX=0, RCX=1, RDX=2, RBX=3, RSP=4, RBP=5, RSI=6, RDI=7 };
+enum{ CC_O=0x0, CC_E=0x4, CC_NE=0x5, CC_L=0xc, CC_GE=0xd, CC_LE=0xe, CC_G=0xf };
+enum{ SHIFT_ROR=1, SHIFT_SHL=4, SHIFT_SAR=7 };
+
+// -*- a jump to a bailout, patched once the stubs are laid out
+typedef struct{
+    size_t at;
+    Ast *stmt;
+} JitExit;
+
+typedef struct{
+    uint8_t *code;
+    size_t len;
+    size_t cap;
+    Env **globals;
+    Symtable *symtable;
+    uint32_t nslot;             // frame slots of the locals
+    uint32_t ntemp;             // temporaries in use
+    uint32_t maxtemp;
+    Ast *stmt;                  // statement a failing guard resumes at
+    bool effects;               // the statement has called out: its guards take the slow path
+    JitExit *exits;
+    size_t nexit;
+    size_t exitcap;
+    bool failed;                // the body uses something not compiled
+} Jit;
+
+// -*-
+static void _cln_x64_bytes(Jit *jit, const void *bytes, size_t len){
+    if(jit->len + len > jit->cap){
+        while(jit->len + len > jit->cap){
+            jit->cap = jit->cap ? 2*jit->cap : CLN_JIT_CODE_INITIAL_CAPACITY;
+        }
+        jit->code = (uint8_t*)realloc(jit->code, jit->cap);
+        if(!jit->code){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    memcpy(jit->code + jit->len, bytes, len);
+    jit->len += len;
+}
+
+// -*-
+static void _cln_x64_byte(Jit *jit, uint8_t byte){
+    _cln_x64_bytes(jit, &byte, 1);
+}
+
+// -*-
+static void _cln_x64_u32(Jit *jit, uint32_t word){
+    _cln_x64_bytes(jit, &word, 4);
+}
+
+// -*- op reg, [base + disp32], REX.W
+static void _cln_x64_mem(Jit *jit, uint8_t op, int reg, int base, int32_t disp){
+    uint8_t bytes[] = {0x48, op, (uint8_t)(0x80 | reg << 3 | base)};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    _cln_x64_u32(jit, (uint32_t)disp);
+}
+
+// -*-
+static void _cln_x64_load(Jit *jit, int reg, int base, int32_t disp){
+    _cln_x64_mem(jit, 0x8b, reg, base, disp);
+}
+
+// -*-
+static void _cln_x64_store(Jit *jit, int reg, int base, int32_t disp){
+    _cln_x64_mem(jit, 0x89, reg, base, disp);
+}
+
+// -*- op dst, src between registers, REX.W
+static void _cln_x64_rr(Jit *jit, uint8_t op, int dst, int src){
+    uint8_t bytes[] = {0x48, op, (uint8_t)(0xc0 | src << 3 | dst)};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+}
+
+// -*-
+static void _cln_x64_mov(Jit *jit, int dst, int src){
+    _cln_x64_rr(jit, 0x89, dst, src);
+}
+
+// -*-
+static void _cln_x64_imm(Jit *jit, int reg, uint64_t imm){
+    uint8_t bytes[] = {0x48, (uint8_t)(0xb8 + reg)};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    _cln_x64_bytes(jit, &imm, 8);
+}
+
+// -*-
+static void _cln_x64_shift(Jit *jit, int ext, int reg, uint8_t count){
+    uint8_t bytes[] = {0x48, 0xc1, (uint8_t)(0xc0 | ext << 3 | reg), count};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+}
+
+// -*- cmp reg, imm8
+static void _cln_x64_cmp_imm(Jit *jit, int reg, int8_t imm){
+    uint8_t bytes[] = {0x48, 0x83, (uint8_t)(0xf8 | reg), (uint8_t)imm};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+}
+
+// -*- setcc al; movzx eax, al
+static void _cln_x64_setcc(Jit *jit, int cc){
+    uint8_t bytes[] = {0x0f, (uint8_t)(0x90 + cc), 0xc0, 0x0f, 0xb6, 0xc0};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+}
+
+// -*- through r11, the stack is 16 byte aligned in the body
+static void _cln_x64_call(Jit *jit, void *fn){
+    uint64_t addr = (uint64_t)(uintptr_t)fn;
+    uint8_t bytes[] = {0x49, 0xbb};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    _cln_x64_bytes(jit, &addr, 8);
+    uint8_t call[] = {0x41, 0xff, 0xd3};
+    _cln_x64_bytes(jit, call, sizeof(call));
+}
+
+// -*- returns where the rel32 goes
+static size_t _cln_x64_jmp(Jit *jit){
+    _cln_x64_byte(jit, 0xe9);
+    _cln_x64_u32(jit, 0);
+    return jit->len - 4;
+}
+
+// -*-
+static size_t _cln_x64_jcc(Jit *jit, int cc){
+    uint8_t bytes[] = {0x0f, (uint8_t)(0x80 + cc)};
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    _cln_x64_u32(jit, 0);
+    return jit->len - 4;
+}
+
+// -*- the jump whose rel32 is at `at` goes to `target`
+static void _cln_x64_patch(Jit *jit, size_t at, size_t target){
+    int32_t rel = (int32_t)((long)target - (long)(at + 4));
+    memcpy(jit->code + at, &rel, 4);
+}
+
+// -*- backward
+static void _cln_x64_jmp_to(Jit *jit, size_t target){
+    _cln_x64_patch(jit, _cln_x64_jmp(jit), target);
+}
+
+// -*-
+static void _cln_x64_epilogue(Jit *jit, int status){
+    uint8_t bytes[] = {
+        0xb8, (uint8_t)status, 0, 0, 0,     // mov eax, status
+        0x48, 0x83, 0xc4, 0x08,             // add rsp, 8
+        0x5b,                               // pop rbx
+        0x5d,                               // pop rbp
+        0xc3,                               // ret
+    };
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Values                                                      -*-
+// -*---------------------------------------------------------------*-
+// -*- frame slot `index`, locals first then temporaries
+static int32_t _cln_jit_slot(uint32_t index){
+    return (int32_t)(sizeof(Value)*index);
+}
+
+// -*-
+static uint32_t _cln_jit_temp(Jit *jit){
+    uint32_t temp = jit->nslot + jit->ntemp++;
+    if(jit->ntemp > jit->maxtemp){
+        jit->maxtemp = jit->ntemp;
+    }
+    return temp;
+}
+
+// -*- jumps when rax does not hold an immediate integer, or when one of
+// -*- rax and rcx does not
+static size_t _cln_jit_guard(Jit *jit, bool both){
+    _cln_x64_mov(jit, RDX, RAX);
+    if(both){
+        _cln_x64_rr(jit, 0x21, RDX, RCX);       // and rdx, rcx
+    }
+    _cln_x64_shift(jit, SHIFT_SAR, RDX, 48);
+    _cln_x64_cmp_imm(jit, RDX, -1);
+    return _cln_x64_jcc(jit, CC_NE);
+}
+
+// -*- a failed guard bails out while nothing can tell, returns false
+// -*- when the caller must patch it to its slow path
+static bool _cln_jit_bail(Jit *jit, size_t at){
+    if(jit->effects){
+        return false;
+    }
+    if(jit->nexit == jit->exitcap){
+        jit->exitcap = jit->exitcap ? 2*jit->exitcap : 16;
+        jit->exits = (JitExit*)realloc(jit->exits, sizeof(JitExit)*jit->exitcap);
+        if(!jit->exits){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    jit->exits[jit->nexit].at = at;
+    jit->exits[jit->nexit].stmt = jit->stmt;
+    ++jit->nexit;
+    return true;
+}
+
+// -*- sign extends the 48-bit payload
+static void _cln_jit_unbox(Jit *jit, int reg){
+    _cln_x64_shift(jit, SHIFT_SHL, reg, 16);
+    _cln_x64_shift(jit, SHIFT_SAR, reg, 16);
+}
+
+// -*- rax fits 48 bits
+static void _cln_jit_box(Jit *jit){
+    uint8_t bytes[] = {0x48, 0x0d, 0xff, 0xff, 0x00, 0x00};    // or rax, 0xffff
+    _cln_x64_shift(jit, SHIFT_SHL, RAX, 16);
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    _cln_x64_shift(jit, SHIFT_ROR, RAX, 16);
+}
+
+// -*- jumps when rax does not fit 48 bits
+static size_t _cln_jit_overflow(Jit *jit){
+    _cln_x64_mov(jit, RDX, RAX);
+    _cln_jit_unbox(jit, RDX);
+    _cln_x64_rr(jit, 0x39, RDX, RAX);           // cmp rdx, rax
+    return _cln_x64_jcc(jit, CC_NE);
+}
+
+// -*- calls, prints and anything not compiled are effects
+static bool _cln_jit_effects(Ast *ast){
+    if(ast->akind == AST_CALL){
+        return true;
+    }
+    for(Ast *node = cln_ast_node(ast); node; node = cln_ast_next(node)){
+        if(_cln_jit_effects(node)){
+            return true;
+        }
+    }
+    return false;
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Expressions                                                 -*-
+// -*---------------------------------------------------------------*-
+static void _cln_jit_expr(Jit *jit, Ast *ast);
+
+// -*- rax = the variable, which must be set
+static void _cln_jit_load(Jit *jit, Ast *ast){
+    if(ast->aux == CLN_BIND_GLOBAL){
+        _cln_x64_imm(jit, RAX, (uint64_t)(uintptr_t)jit->globals);
+        _cln_x64_load(jit, RAX, RAX, 0);
+        _cln_x64_load(jit, RAX, RAX, (int32_t)(offsetof(Env, slots) + sizeof(Value)*cln_as_integer(ast->obj)));
+    }else if(CLN_BIND_DEPTH(ast->aux) == 0){
+        _cln_x64_load(jit, RAX, RBX, _cln_jit_slot(CLN_BIND_SLOT(ast->aux)));
+    }else{
+        jit->failed = true;
+        return;
+    }
+    _cln_x64_rr(jit, 0x85, RAX, RAX);           // test rax, rax
+    size_t set = _cln_x64_jcc(jit, CC_NE);
+    if(ast->aux == CLN_BIND_GLOBAL){
+        _cln_x64_imm(jit, RDI, (uint64_t)cln_as_integer(ast->obj));
+        _cln_x64_call(jit, cln_jit_global);     // rax = the def a lazy import left, if any
+    }else{
+        _cln_x64_imm(jit, RDI, (uint64_t)(uintptr_t)jit->symtable->symbols[cln_as_integer(ast->obj)]);
+        _cln_x64_call(jit, _cln_jit_unset);
+    }
+    _cln_x64_patch(jit, set, jit->len);
+}
+
+// -*- the variable = rax
+static void _cln_jit_store(Jit *jit, Ast *ast){
+    if(ast->aux == CLN_BIND_GLOBAL){
+        _cln_x64_imm(jit, RCX, (uint64_t)(uintptr_t)jit->globals);
+        _cln_x64_load(jit, RCX, RCX, 0);
+        _cln_x64_store(jit, RAX, RCX, (int32_t)(offsetof(Env, slots) + sizeof(Value)*cln_as_integer(ast->obj)));
+    }else if(CLN_BIND_DEPTH(ast->aux) == 0){
+        _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(CLN_BIND_SLOT(ast->aux)));
+    }else{
+        jit->failed = true;
+    }
+}
+
+// -*- the callee and the arguments go to consecutive temporaries;
+// -*- returns the first
+static uint32_t _cln_jit_args(Jit *jit, Ast *ast, int *narg){
+    uint32_t first = _cln_jit_temp(jit);
+    _cln_jit_load(jit, ast);
+    _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(first));
+    if(_cln_jit_effects(cln_ast_node(ast))){
+        _cln_x64_mov(jit, RDI, RAX);
+        _cln_x64_call(jit, _cln_jit_check_fun);
+    }
+    uint32_t saved = jit->ntemp;
+    *narg = 0;
+    for(Ast *arg = cln_ast_node(cln_ast_node(ast)); arg; arg = cln_ast_next(arg)){
+        uint32_t temp = _cln_jit_temp(jit);
+        _cln_jit_expr(jit, arg);
+        _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(temp));
+        ++*narg;
+    }
+    jit->ntemp = saved;
+    _cln_x64_mem(jit, 0x8d, RDI, RBX, _cln_jit_slot(first));   // lea rdi, [rbx + first]
+    _cln_x64_imm(jit, RSI, (uint64_t)*narg);
+    return first;
+}
+
+// -*- lhs op rhs: rax and rcx once both are computed
+static void _cln_jit_binop(Jit *jit, Ast *ast){
+    Ast *lhs = cln_ast_node(ast);
+    Ast *rhs = cln_ast_next(lhs);
+    uint32_t saved = jit->ntemp;
+    uint32_t left = _cln_jit_temp(jit);
+    uint32_t right = _cln_jit_temp(jit);
+    _cln_jit_expr(jit, lhs);
+    _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(left));
+    if(_cln_jit_effects(rhs)){
+        size_t fail = _cln_jit_guard(jit, false);
+        if(!_cln_jit_bail(jit, fail)){
+            size_t ok = _cln_x64_jmp(jit);
+            _cln_x64_patch(jit, fail, jit->len);
+            _cln_x64_mov(jit, RDI, RAX);
+            _cln_x64_call(jit, _cln_jit_check_integer);
+            _cln_x64_patch(jit, ok, jit->len);
+        }
+    }
+    _cln_jit_expr(jit, rhs);
+    _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(right));
+    _cln_x64_mov(jit, RCX, RAX);
+    _cln_x64_load(jit, RAX, RBX, _cln_jit_slot(left));
+    jit->ntemp = saved;
+
+    size_t slow[3];
+    size_t nslow = 0;
+    size_t fail = _cln_jit_guard(jit, true);
+    if(!_cln_jit_bail(jit, fail)){
+        slow[nslow++] = fail;
+    }
+    _cln_jit_unbox(jit, RAX);
+    _cln_jit_unbox(jit, RCX);
+    switch(ast->akind){
+    case AST_ADD:
+        _cln_x64_rr(jit, 0x01, RAX, RCX);
+        slow[nslow++] = _cln_jit_overflow(jit);
+        break;
+    case AST_SUB:
+        _cln_x64_rr(jit, 0x29, RAX, RCX);
+        slow[nslow++] = _cln_jit_overflow(jit);
+        break;
+    case AST_MUL:{
+            uint8_t bytes[] = {0x48, 0x0f, 0xaf, 0xc1};            // imul rax, rcx
+            _cln_x64_bytes(jit, bytes, sizeof(bytes));
+            slow[nslow++] = _cln_x64_jcc(jit, CC_O);
+            slow[nslow++] = _cln_jit_overflow(jit);
+        }//
+        break;
+    case AST_DIV:{
+            uint8_t bytes[] = {0x48, 0x99, 0x48, 0xf7, 0xf9};      // cqo; idiv rcx
+            _cln_x64_rr(jit, 0x85, RCX, RCX);
+            slow[nslow++] = _cln_x64_jcc(jit, CC_E);
+            _cln_x64_bytes(jit, bytes, sizeof(bytes));
+            slow[nslow++] = _cln_jit_overflow(jit);
+        }//
+        break;
+    case AST_AND:
+    case AST_OR:{
+            uint8_t bytes[] = {
+                0x0f, 0x95, 0xc2,       // setne dl
+                0x48, 0x85, 0xc9,       // test rcx, rcx
+                0x0f, 0x95, 0xc1,       // setne cl
+                ast->akind == AST_AND ? 0x20 : 0x08, 0xca,     // and/or dl, cl
+                0x0f, 0xb6, 0xc2,       // movzx eax, dl
+            };
+            _cln_x64_rr(jit, 0x85, RAX, RAX);
+            _cln_x64_bytes(jit, bytes, sizeof(bytes));
+        }//
+        break;
+    default:
+        _cln_x64_rr(jit, 0x39, RAX, RCX);       // cmp rax, rcx
+        switch(ast->akind){
+        case AST_LT:
+            _cln_x64_setcc(jit, CC_L);
+            break;
+        case AST_EQ:
+            _cln_x64_setcc(jit, CC_E);
+            break;
+        case AST_GT:
+            _cln_x64_setcc(jit, CC_G);
+            break;
+        case AST_LE:
+            _cln_x64_setcc(jit, CC_LE);
+            break;
+        default:
+            _cln_x64_setcc(jit, CC_GE);
+            break;
+        }
+        break;
+    }
+    _cln_jit_box(jit);
+    size_t done = _cln_x64_jmp(jit);
+    for(size_t i=0; i < nslow; ++i){
+        _cln_x64_patch(jit, slow[i], jit->len);
+    }
+    _cln_x64_imm(jit, RDI, ast->akind);
+    _cln_x64_load(jit, RSI, RBX, _cln_jit_slot(left));
+    _cln_x64_load(jit, RDX, RBX, _cln_jit_slot(right));
+    _cln_x64_call(jit, _cln_jit_slow_binop);
+    _cln_x64_patch(jit, done, jit->len);
+}
+
+// -*-
+static void _cln_jit_not(Jit *jit, Ast *ast){
+    uint32_t saved = jit->ntemp;
+    uint32_t operand = _cln_jit_temp(jit);
+    _cln_jit_expr(jit, cln_ast_node(ast));
+    _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(operand));
+    jit->ntemp = saved;
+    size_t fail = _cln_jit_guard(jit, false);
+    bool bail = _cln_jit_bail(jit, fail);
+    _cln_x64_shift(jit, SHIFT_SHL, RAX, 16);
+    _cln_x64_rr(jit, 0x85, RAX, RAX);
+    _cln_x64_setcc(jit, CC_E);
+    _cln_jit_box(jit);
+    if(!bail){
+        size_t done = _cln_x64_jmp(jit);
+        _cln_x64_patch(jit, fail, jit->len);
+        _cln_x64_load(jit, RDI, RBX, _cln_jit_slot(operand));
+        _cln_x64_call(jit, _cln_jit_slow_not);
+        _cln_x64_patch(jit, done, jit->len);
+    }
+}
+
+// -*- leaves the value in rax
+static void _cln_jit_expr(Jit *jit, Ast *ast){
+    uint32_t saved;
+    int narg;
+    switch(ast->akind){
+    case AST_INTEGER:
+    case AST_FLOAT:
+    case AST_STRING:
+        _cln_x64_imm(jit, RAX, ast->obj);
+        break;
+    case AST_IDENT:
+        _cln_jit_load(jit, ast);
+        break;
+    case AST_CALL:
+        saved = jit->ntemp;
+        _cln_jit_args(jit, ast, &narg);
+        _cln_x64_call(jit, cln_jit_call);
+        jit->ntemp = saved;
+        jit->effects = true;
+        break;
+    case AST_ADD:
+    case AST_SUB:
+    case AST_MUL:
+    case AST_DIV:
+    case AST_AND:
+    case AST_OR:
+    case AST_LT:
+    case AST_EQ:
+    case AST_GT:
+    case AST_LE:
+    case AST_GE:
+        _cln_jit_binop(jit, ast);
+        break;
+    case AST_NOT:
+        _cln_jit_not(jit, ast);
+        break;
+    default:
+        jit->failed = true;
+        break;
+    }
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Statements                                                  -*-
+// -*---------------------------------------------------------------*-
+static void _cln_jit_statement(Jit *jit, Ast *ast);
+
+// -*- jumps taken when the condition is false, two of them
+static void _cln_jit_branch(Jit *jit, Ast *cond, size_t *falses){
+    _cln_jit_expr(jit, cond);
+    size_t generic = _cln_jit_guard(jit, false);
+    _cln_x64_shift(jit, SHIFT_SHL, RAX, 16);
+    falses[0] = _cln_x64_jcc(jit, CC_E);
+    size_t taken = _cln_x64_jmp(jit);
+    _cln_x64_patch(jit, generic, jit->len);
+    _cln_x64_mov(jit, RDI, RAX);
+    _cln_x64_call(jit, _cln_jit_truth);
+    uint8_t bytes[] = {0x85, 0xc0};             // test eax, eax
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    falses[1] = _cln_x64_jcc(jit, CC_E);
+    _cln_x64_patch(jit, taken, jit->len);
+}
+
+// -*- loops let the collector run
+static void _cln_jit_safepoint(Jit *jit){
+    uint8_t bytes[] = {0x80, 0x38, 0x00};       // cmp byte [rax], 0
+    _cln_x64_imm(jit, RAX, (uint64_t)(uintptr_t)&clnGCRequested);
+    _cln_x64_bytes(jit, bytes, sizeof(bytes));
+    size_t idle = _cln_x64_jcc(jit, CC_E);
+    _cln_x64_call(jit, cln_gc_collect_pending);
+    _cln_x64_patch(jit, idle, jit->len);
+}
+
+// -*-
+static void _cln_jit_while(Jit *jit, Ast *ast){
+    size_t head = jit->len;
+    size_t falses[2];
+    _cln_jit_branch(jit, cln_ast_node(ast), falses);
+    _cln_jit_statement(jit, cln_ast_next(cln_ast_node(ast)));
+    _cln_jit_safepoint(jit);
+    _cln_x64_jmp_to(jit, head);
+    _cln_x64_patch(jit, falses[0], jit->len);
+    _cln_x64_patch(jit, falses[1], jit->len);
+}
+
+// -*-
+static void _cln_jit_if(Jit *jit, Ast *ast){
+    Ast *cond = cln_ast_node(ast);
+    Ast *orelse = cln_ast_next(cln_ast_next(cond));
+    size_t falses[2];
+    _cln_jit_branch(jit, cond, falses);
+    _cln_jit_statement(jit, cln_ast_next(cond));
+    if(orelse){
+        size_t end = _cln_x64_jmp(jit);
+        _cln_x64_patch(jit, falses[0], jit->len);
+        _cln_x64_patch(jit, falses[1], jit->len);
+        _cln_jit_statement(jit, orelse);
+        _cln_x64_patch(jit, end, jit->len);
+    }else{
+        _cln_x64_patch(jit, falses[0], jit->len);
+        _cln_x64_patch(jit, falses[1], jit->len);
+    }
+}
+
+// -*-
+static void _cln_jit_return(Jit *jit, Ast *ast){
+    Ast *expr = cln_ast_node(ast);
+    int narg;
+    if(expr->akind == AST_CALL){
+        _cln_jit_args(jit, expr, &narg);
+        _cln_x64_call(jit, cln_jit_tail_call);
+    }else{
+        _cln_jit_expr(jit, expr);
+        _cln_x64_store(jit, RAX, RBX, _cln_jit_slot(CLN_RETURN_ID));
+    }
+    _cln_x64_epilogue(jit, CLN_JIT_DONE);
+}
+
+// -*-
+static void _cln_jit_statement(Jit *jit, Ast *ast){
+    Ast *lhs = cln_ast_node(ast);
+    jit->stmt = ast;
+    jit->effects = false;
+    jit->ntemp = 0;
+    switch(ast->akind){
+    case AST_ASSIGN:
+    case AST_LOCAL:
+        if(lhs->akind != AST_IDENT){
+            jit->failed = true;
+            break;
+        }
+        _cln_jit_expr(jit, cln_ast_next(lhs));
+        _cln_jit_store(jit, lhs);
+        break;
+    case AST_WHILE:
+        _cln_jit_while(jit, ast);
+        break;
+    case AST_IF:
+        _cln_jit_if(jit, ast);
+        break;
+    case AST_RETURN:
+        _cln_jit_return(jit, ast);
+        break;
+    case AST_PRINT:
+        _cln_jit_expr(jit, lhs);
+        _cln_x64_mov(jit, RDI, RAX);
+        _cln_x64_call(jit, _cln_jit_print);
+        break;
+    case AST_CALL:
+        _cln_jit_expr(jit, ast);
+        break;
+    case AST_EMPTY:
+        for(Ast *node = lhs; node && !jit->failed; node = cln_ast_next(node)){
+            _cln_jit_statement(jit, node);
+        }
+        break;
+    default:
+        jit->failed = true;
+        break;
+    }
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Installation                                                -*-
+// -*---------------------------------------------------------------*-
+typedef struct{
+    uint8_t *base;
+    size_t top;
+    size_t size;
+} JitChunk;
+
+static JitChunk clnJitChunk;
+static FILE *clnPerfMap;
+
+// -*- copies the code to executable memory, NULL when none can be mapped
+static void* _cln_jit_install(Jit *jit){
+    size_t len = (jit->len + 15) & ~(size_t)15;
+    if(clnJitChunk.top + len > clnJitChunk.size){
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t size = len > CLN_JIT_CHUNK_SIZE ? len : CLN_JIT_CHUNK_SIZE;
+        size = (size + page - 1) & ~(page - 1);
+        void *base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED){
+            return NULL;
+        }
+        clnJitChunk.base = (uint8_t*)base;
+        clnJitChunk.top = 0;
+        clnJitChunk.size = size;
+    }else if(mprotect(clnJitChunk.base, clnJitChunk.size, PROT_READ|PROT_WRITE)){
+        return NULL;
+    }
+    uint8_t *code = clnJitChunk.base + clnJitChunk.top;
+    memcpy(code, jit->code, jit->len);
+    clnJitChunk.top += len;
+    if(mprotect(clnJitChunk.base, clnJitChunk.size, PROT_READ|PROT_EXEC)){
+        return NULL;
+    }
+    return code;
+}
+
+// -*- /tmp/perf-<pid>.map lets perf name the generated code
+static void _cln_jit_perf_map(void *code, size_t len, const char *name){
+    static bool opened = false;
+    if(!opened){
+        char path[64];
+        opened = true;
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        clnPerfMap = fopen(path, "w");
+    }
+    if(clnPerfMap){
+        fprintf(clnPerfMap, "%lx %zx celine:%s\n", (unsigned long)(uintptr_t)code, len, name ? name : "<anonymous>");
+        fflush(clnPerfMap);
+    }
+}
+
+// -*- int entry(Value *slots, Ast **resume)
+static JitEntry _cln_jit_function(Ast *body, const char *name, Env **globals, Symtable *symtable, uint32_t *ntemp){
+    Jit jit;
+    memset(&jit, 0, sizeof(Jit));
+    jit.globals = globals;
+    jit.symtable = symtable;
+    jit.nslot = CLN_FRAME_NSLOT(body->aux);
+    if(body->aux & CLN_FRAME_CAPTURED){
+        return NULL;
+    }
+    uint8_t prologue[] = {
+        0x55,                   // push rbp
+        0x48, 0x89, 0xe5,       // mov rbp, rsp
+        0x53,                   // push rbx
+        0x56,                   // push rsi
+        0x48, 0x89, 0xfb,       // mov rbx, rdi
+    };
+    _cln_x64_bytes(&jit, prologue, sizeof(prologue));
+    _cln_jit_statement(&jit, body);
+    _cln_x64_epilogue(&jit, CLN_JIT_DONE);
+    // - one stub per statement bailed out to
+    for(size_t i=0; i < jit.nexit && !jit.failed; ++i){
+        Ast *stmt = jit.exits[i].stmt;
+        if(!stmt){
+            continue;
+        }
+        size_t stub = jit.len;
+        _cln_x64_load(&jit, RCX, RBP, -16);
+        _cln_x64_imm(&jit, RAX, (uint64_t)(uintptr_t)stmt);
+        _cln_x64_store(&jit, RAX, RCX, 0);
+        _cln_x64_epilogue(&jit, CLN_JIT_BAILOUT);
+        for(size_t j=i; j < jit.nexit; ++j){
+            if(jit.exits[j].stmt == stmt){
+                _cln_x64_patch(&jit, jit.exits[j].at, stub);
+                jit.exits[j].stmt = NULL;
+            }
+        }
+    }
+    void *code = jit.failed || jit.nslot + jit.maxtemp > 0xffff ? NULL : _cln_jit_install(&jit);
+    if(code){
+        *ntemp = jit.maxtemp;
+        _cln_jit_perf_map(code, jit.len, name);
+        if(clnOptions.verbose){
+            printf("jit: compiled %s, %zu bytes\n", name ? name : "<anonymous>", jit.len);
+        }
+    }
+    cln_dealloc(jit.code);
+    cln_dealloc(jit.exits);
+    return (JitEntry)code;
+}
+#endif
+
+// -*-
+JitCode* cln_jit_compile(Ast *body, const char *name, Env **globals, Symtable *symtable){
+    JitCode **slot = _cln_jit_cache_slot(body);
+    if(!*slot){
+        JitCode *jit = (JitCode*)cln_alloc(sizeof(JitCode));
+#ifdef CLN_JIT_X64
+        jit->entry = _cln_jit_function(body, name, globals, symtable, &jit->ntemp);
+#else
+        (void)name;
+        (void)globals;
+        (void)symtable;
+#endif
+        *slot = jit;
+    }
+    return *slot;
+}
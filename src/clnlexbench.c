@@ -0,0 +1,102 @@
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+
+#include "celine.h"
+
+// -*- Lexer throughput over a large synthetic module, the kind a code
+// -*- generator emits, with each scanner the CPU runs: `clnlexbench
+// -*- [file.cln]` lexes the given file instead.
+#define CLN_BENCH_SOURCE_SIZE   (16 << 20)
+#define CLN_BENCH_ROUNDS        5
+#define CLN_BENCH_FUNCTIONS     4096    // distinct names
+
+// -*- a module of CLN_BENCH_SOURCE_SIZE bytes or so
+static void _cln_bench_write_source(const char *filename){
+    FILE *stream = fopen(filename, "w");
+    if(!stream){
+        cln_panic("CelineError: cannot write %s\n", filename);
+    }
+    long size = 0;
+    for(int i=0; size < CLN_BENCH_SOURCE_SIZE; ++i){
+        int f = i % CLN_BENCH_FUNCTIONS;
+        size += fprintf(
+            stream,
+            "# generated step %d\n"
+            "def step%d(count, scale){\n"
+            "    local total = count * %d + scale;\n"
+            "    while(total >= %d and not total == 0){\n"
+            "        total = total - 1.25;\n"
+            "        table[%d] = \"label %d\";\n"
+            "    }\n"
+            "    if(total < -%d){ return step%d(total, @self.weight); }\n"
+            "    return total;\n"
+            "}\n",
+            i, f, i, i % 1000, f, i, i, (f + 1) % CLN_BENCH_FUNCTIONS
+        );
+    }
+    fclose(stream);
+}
+
+// -*- tokens of one pass over `filename`, 0 when `scanner` is not available
+static size_t _cln_bench_lex(const char *filename, const char *scanner, Symtable *symtable){
+    Lexer lexer;
+    size_t ntoken = 0;
+    cln_lexer_init(&lexer, filename, symtable);
+    if(!cln_lexer_use_scanner(&lexer, scanner)){
+        cln_lexer_destroy(&lexer);
+        return 0;
+    }
+    while(cln_lexer_nexttoken(&lexer).tkind != TOK_EOF){
+        ++ntoken;
+    }
+    cln_lexer_destroy(&lexer);
+    return ntoken;
+}
+
+// -*-
+int main(int argc, char **argv){
+    char generated[] = "/tmp/clnlexbench.XXXXXX.cln";
+    const char *filename = argc > 1 ? argv[1] : generated;
+    if(argc <= 1){
+        int fd = mkstemps(generated, 4);
+        if(fd < 0){
+            cln_panic("CelineError: cannot create a temporary file\n");
+        }
+        close(fd);
+        _cln_bench_write_source(generated);
+    }
+
+    FILE *stream = fopen(filename, "r");
+    if(!stream){
+        cln_panic("CelineError: cannot open %s\n", filename);
+    }
+    fseek(stream, 0, SEEK_END);
+    double megabytes = ftell(stream)/1e6;
+    fclose(stream);
+
+    const char *scanners[] = {"scalar", "sse2", "avx2"};
+    Symtable *symtable = cln_new_symtable();
+    for(size_t i=0; i < sizeof(scanners)/sizeof(scanners[0]); ++i){
+        size_t ntoken = 0;
+        double best = 0.0;
+        for(int round=0; round < CLN_BENCH_ROUNDS; ++round){
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            ntoken = _cln_bench_lex(filename, scanners[i], symtable);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+            if(megabytes/seconds > best){
+                best = megabytes/seconds;
+            }
+        }
+        if(ntoken){
+            printf("lexer (%s): %.1f MB, %zu tokens, %.1f MB/s\n", scanners[i], megabytes, ntoken, best);
+        }
+    }
+
+    if(argc <= 1){
+        remove(generated);
+    }
+    return 0;
+}
@@ -1,10 +1,24 @@
-#include<ctype.h>
 #include<string.h>
 
 #include "celine.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define CLN_LEXER_MMAP
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CLN_LEXER_SIMD
+#include<immintrin.h>
+#endif
+
 #define CLN_EOF             '\0'
-#define CLN_ARRAYLEN(arr)   (sizeof(arr)/sizeof(arr[0]))
+#define CLN_LEXER_READ_CHUNK    4096    // initial buffer of unmappable streams
+#define CLN_LEXER_PADDING       32      // zero bytes after the source, a vector load
+#define CLN_NUMBER_BUFLEN       64      // numbers are parsed from a copy this long
 
 /*
 -*- Prelude -*-
@@ -38,37 +52,347 @@ obj.attr = ...
 obj.prototype = ...
 
 */
-// -*-
-const char* clnKeywords[] = {
-    "and", "or", "not",
-    "while", "if", "else",
-    "call", "print", "readInt",
-    "def", "local", "return",
-    "array", "object", "import",
-    "new", "load"
+// -*- keywords, hashed at compile time on their first and last character
+// -*- and length; the coefficients leave no two of them in the same slot
+#define CLN_KEYWORDS                                \
+    CLN_KEYWORD("and", AND, 'a', 'd')               \
+    CLN_KEYWORD("or", OR, 'o', 'r')                 \
+    CLN_KEYWORD("not", NOT, 'n', 't')               \
+    CLN_KEYWORD("while", WHILE, 'w', 'e')           \
+    CLN_KEYWORD("if", IF, 'i', 'f')                 \
+    CLN_KEYWORD("else", ELSE, 'e', 'e')             \
+    CLN_KEYWORD("call", CALL, 'c', 'l')             \
+    CLN_KEYWORD("print", PRINT, 'p', 't')           \
+    CLN_KEYWORD("readInt", READ_INT, 'r', 't')      \
+    CLN_KEYWORD("input", INPUT, 'i', 't')           \
+    CLN_KEYWORD("def", DEF, 'd', 'f')               \
+    CLN_KEYWORD("local", LOCAL, 'l', 'l')           \
+    CLN_KEYWORD("return", RETURN, 'r', 'n')         \
+    CLN_KEYWORD("array", ARRAY, 'a', 'y')           \
+    CLN_KEYWORD("object", OBJECT, 'o', 't')         \
+    CLN_KEYWORD("import", IMPORT, 'i', 't')         \
+    CLN_KEYWORD("new", NEW, 'n', 'w')               \
+    CLN_KEYWORD("load", LOAD, 'l', 'd')
+
+#define CLN_KEYWORD_SLOTS       32
+#define CLN_KEYWORD_HASH(first, last, len) \
+    (((first)*4 + (last)*16 + (len)) & (CLN_KEYWORD_SLOTS - 1))
+
+typedef struct{
+    const char *name;       // NULL for an empty slot
+    size_t len;
+    enum TokenKind tkind;
+} Keyword;
+
+static const Keyword clnKeywordTable[CLN_KEYWORD_SLOTS] = {
+#define CLN_KEYWORD(name, kind, first, last) \
+    [CLN_KEYWORD_HASH(first, last, sizeof(name) - 1)] = {name, sizeof(name) - 1, TOK_##kind},
+    CLN_KEYWORDS
+#undef CLN_KEYWORD
 };
 
-enum TokenKind clnKeywordsKind[] = {
-    TOK_AND, TOK_OR, TOK_NOT,
-    TOK_WHILE, TOK_IF, TOK_ELSE,
-    TOK_CALL, TOK_PRINT, TOK_READ_INT,
-    TOK_INPUT, TOK_DEF, TOK_LOCAL,
-    TOK_ARRAY, TOK_OBJECT, TOK_IMPORT,
-    TOK_NEW, TOK_LOAD
+// -*- what a character starts, see clnCharClass
+enum CharClass{
+    CLN_CHAR_OTHER,         // invalid outside string literals and comments
+    CLN_CHAR_END,           // the NUL sentinel after the source
+    CLN_CHAR_SPACE,
+    CLN_CHAR_NEWLINE,
+    CLN_CHAR_COMMENT,       // up to the end of the line
+    CLN_CHAR_LETTER,        // [A-Za-z_]
+    CLN_CHAR_AT,            // '@' only leads an identifier
+    CLN_CHAR_DIGIT,
+    CLN_CHAR_SIGN,          // '+' or '-', may lead a number literal
+    CLN_CHAR_QUOTE,
+    CLN_CHAR_DOT,
+    CLN_CHAR_COMPARE,       // '=', '<' or '>', may be followed by '='
+    CLN_CHAR_PUNCT          // any other single character token
 };
 
-char clnDelimiters[] = {
-    ';', '=', '+', '-', '*', '/',
-    '(', ')', '[', ']', '{', '}',
-    ',', CLN_EOF
+#define CLN_CHAR_CLASS(c)                                                       \
+    ((c) == '\0' ? CLN_CHAR_END :                                               \
+     (c) == '\n' ? CLN_CHAR_NEWLINE :                                           \
+     (c) == ' ' || ((c) >= '\t' && (c) <= '\r') ? CLN_CHAR_SPACE :              \
+     (c) == CLN_COMMENT ? CLN_CHAR_COMMENT :                                    \
+     ((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || (c) == '_' ?   \
+        CLN_CHAR_LETTER :                                                       \
+     (c) == '@' ? CLN_CHAR_AT :                                                 \
+     (c) >= '0' && (c) <= '9' ? CLN_CHAR_DIGIT :                                \
+     (c) == '+' || (c) == '-' ? CLN_CHAR_SIGN :                                 \
+     (c) == '"' ? CLN_CHAR_QUOTE :                                              \
+     (c) == '.' ? CLN_CHAR_DOT :                                                \
+     (c) == '=' || (c) == '<' || (c) == '>' ? CLN_CHAR_COMPARE :                \
+     (c) == ';' || (c) == '*' || (c) == '/' || (c) == ',' ||                    \
+     (c) == '(' || (c) == ')' || (c) == '[' || (c) == ']' ||                    \
+     (c) == '{' || (c) == '}' ? CLN_CHAR_PUNCT : CLN_CHAR_OTHER)
+
+#define CLN_CHAR_ROW(r)                                                         \
+    CLN_CHAR_CLASS(r+0x0), CLN_CHAR_CLASS(r+0x1), CLN_CHAR_CLASS(r+0x2),        \
+    CLN_CHAR_CLASS(r+0x3), CLN_CHAR_CLASS(r+0x4), CLN_CHAR_CLASS(r+0x5),        \
+    CLN_CHAR_CLASS(r+0x6), CLN_CHAR_CLASS(r+0x7), CLN_CHAR_CLASS(r+0x8),        \
+    CLN_CHAR_CLASS(r+0x9), CLN_CHAR_CLASS(r+0xa), CLN_CHAR_CLASS(r+0xb),        \
+    CLN_CHAR_CLASS(r+0xc), CLN_CHAR_CLASS(r+0xd), CLN_CHAR_CLASS(r+0xe),        \
+    CLN_CHAR_CLASS(r+0xf)
+
+// -*- enum CharClass of every byte
+static const uint8_t clnCharClass[256] = {
+    CLN_CHAR_ROW(0x00), CLN_CHAR_ROW(0x10), CLN_CHAR_ROW(0x20), CLN_CHAR_ROW(0x30),
+    CLN_CHAR_ROW(0x40), CLN_CHAR_ROW(0x50), CLN_CHAR_ROW(0x60), CLN_CHAR_ROW(0x70),
+    CLN_CHAR_ROW(0x80), CLN_CHAR_ROW(0x90), CLN_CHAR_ROW(0xa0), CLN_CHAR_ROW(0xb0),
+    CLN_CHAR_ROW(0xc0), CLN_CHAR_ROW(0xd0), CLN_CHAR_ROW(0xe0), CLN_CHAR_ROW(0xf0)
+};
+
+// -*- the token of a character on its own, and followed by '='
+static const enum TokenKind clnCharTokens[256] = {
+    [';'] = TOK_SEMI, ['='] = TOK_ASSIGN, ['+'] = TOK_PLUS, ['-'] = TOK_MINUS,
+    ['*'] = TOK_STAR, ['/'] = TOK_SLASH, ['('] = TOK_LPAREN, [')'] = TOK_RPAREN,
+    ['['] = TOK_LSBRACKET, [']'] = TOK_RSBRACKET, ['{'] = TOK_LBRACE,
+    ['}'] = TOK_RBRACE, [','] = TOK_COMMA, ['<'] = TOK_LT, ['>'] = TOK_GT,
+    ['.'] = TOK_DOT
+};
+
+static const enum TokenKind clnCharEqTokens[256] = {
+    ['='] = TOK_EQ, ['<'] = TOK_LE, ['>'] = TOK_GE
+};
+
+// -*---------------------------------------------------------------*-
+// -*- Scanners                                                    -*-
+// -*---------------------------------------------------------------*-
+// -*- The runs of characters that make up most of a source are scanned
+// -*- by one of these, picked by what the CPU supports. The vector ones
+// -*- load past the NUL sentinel: the source is followed by at least
+// -*- CLN_LEXER_PADDING zero bytes.
+struct scanner{
+    const char *name;
+    // first character that is neither whitespace nor in a comment
+    const char* (*skip)(const char *p, uint32_t *lineno);
+    // first character out of [A-Za-z0-9_]
+    const char* (*ident)(const char *p);
+    // first '"' or the sentinel
+    const char* (*quote)(const char *p);
+};
+
+// -*-
+static const char* _cln_skip_scalar(const char *p, uint32_t *lineno){
+    for(;;){
+        switch(clnCharClass[(unsigned char)*p]){
+        case CLN_CHAR_NEWLINE:
+            ++*lineno;
+            // fall through
+        case CLN_CHAR_SPACE:
+            ++p;
+            break;
+        case CLN_CHAR_COMMENT:
+            while(*p != '\n' && *p != CLN_EOF){
+                ++p;
+            }
+            break;
+        default:
+            return p;
+        }
+    }
+}
+
+// -*-
+static const char* _cln_ident_scalar(const char *p){
+    while(clnCharClass[(unsigned char)*p] == CLN_CHAR_LETTER ||
+          clnCharClass[(unsigned char)*p] == CLN_CHAR_DIGIT){
+        ++p;
+    }
+    return p;
+}
+
+// -*-
+static const char* _cln_quote_scalar(const char *p){
+    while(*p != '\"' && *p != CLN_EOF){
+        ++p;
+    }
+    return p;
+}
+
+static const Scanner clnScanScalar = {
+    "scalar", _cln_skip_scalar, _cln_ident_scalar, _cln_quote_scalar
+};
+
+#ifdef CLN_LEXER_SIMD
+// -*- a bit per byte of `v` equal to `c`
+static inline uint32_t _cln_sse2_eq(__m128i v, char c){
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+// -*- a bit per byte of `v` in [lo, lo + n]
+static inline uint32_t _cln_sse2_in(__m128i v, char lo, char n){
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(n)), d));
+}
+
+// -*- ' ' and '\t'..'\r'
+static inline uint32_t _cln_sse2_space(__m128i v){
+    return _cln_sse2_eq(v, ' ') | _cln_sse2_in(v, '\t', '\r' - '\t');
+}
+
+// -*- [A-Za-z0-9_]
+static inline uint32_t _cln_sse2_ident(__m128i v){
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _cln_sse2_in(lower, 'a', 'z' - 'a') | _cln_sse2_in(v, '0', 9) | _cln_sse2_eq(v, '_');
+}
+
+// -*-
+static const char* _cln_skip_sse2(const char *p, uint32_t *lineno){
+    for(;;){
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        uint32_t space = _cln_sse2_space(v);
+        uint32_t newline = _cln_sse2_eq(v, '\n');
+        if(space == 0xffff){
+            *lineno += __builtin_popcount(newline);
+            p += 16;
+            continue;
+        }
+        int n = __builtin_ctz(~space);
+        *lineno += __builtin_popcount(newline & ((1u << n) - 1));
+        p += n;
+        if(*p != CLN_COMMENT){
+            return p;
+        }
+        for(;; p += 16){    // to the end of the line
+            v = _mm_loadu_si128((const __m128i*)p);
+            uint32_t end = _cln_sse2_eq(v, '\n') | _cln_sse2_eq(v, CLN_EOF);
+            if(end){
+                p += __builtin_ctz(end);
+                break;
+            }
+        }
+    }
+}
+
+// -*-
+static const char* _cln_ident_sse2(const char *p){
+    for(;; p += 16){
+        uint32_t ident = _cln_sse2_ident(_mm_loadu_si128((const __m128i*)p));
+        if(ident != 0xffff){
+            return p + __builtin_ctz(~ident);
+        }
+    }
+}
+
+// -*-
+static const char* _cln_quote_sse2(const char *p){
+    for(;; p += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        uint32_t end = _cln_sse2_eq(v, '\"') | _cln_sse2_eq(v, CLN_EOF);
+        if(end){
+            return p + __builtin_ctz(end);
+        }
+    }
+}
+
+static const Scanner clnScanSSE2 = {
+    "sse2", _cln_skip_sse2, _cln_ident_sse2, _cln_quote_sse2
 };
 
-enum TokenKind clnDelimitersKind[] = {
-    TOK_SEMI, TOK_ASSIGN, TOK_PLUS, TOK_MINUS,
-    TOK_STAR, TOK_SLASH, TOK_LBRACE, TOK_RBRACE,
-    TOK_LSBRACKET, TOK_RSBRACKET, TOK_LBRACE,
-    TOK_RBRACE, TOK_COMMA, TOK_EOF,
+// -*- the same 32 bytes at a time
+#define CLN_AVX2 __attribute__((target("avx2")))
+
+CLN_AVX2 static inline uint32_t _cln_avx2_eq(__m256i v, char c){
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+CLN_AVX2 static inline uint32_t _cln_avx2_in(__m256i v, char lo, char n){
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(n)), d));
+}
+
+CLN_AVX2 static inline uint32_t _cln_avx2_space(__m256i v){
+    return _cln_avx2_eq(v, ' ') | _cln_avx2_in(v, '\t', '\r' - '\t');
+}
+
+CLN_AVX2 static inline uint32_t _cln_avx2_ident(__m256i v){
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _cln_avx2_in(lower, 'a', 'z' - 'a') | _cln_avx2_in(v, '0', 9) | _cln_avx2_eq(v, '_');
+}
+
+// -*-
+CLN_AVX2 static const char* _cln_skip_avx2(const char *p, uint32_t *lineno){
+    for(;;){
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t space = _cln_avx2_space(v);
+        uint32_t newline = _cln_avx2_eq(v, '\n');
+        if(space == 0xffffffffu){
+            *lineno += __builtin_popcount(newline);
+            p += 32;
+            continue;
+        }
+        int n = __builtin_ctz(~space);
+        *lineno += __builtin_popcount(newline & ((1u << n) - 1));
+        p += n;
+        if(*p != CLN_COMMENT){
+            return p;
+        }
+        for(;; p += 32){    // to the end of the line
+            v = _mm256_loadu_si256((const __m256i*)p);
+            uint32_t end = _cln_avx2_eq(v, '\n') | _cln_avx2_eq(v, CLN_EOF);
+            if(end){
+                p += __builtin_ctz(end);
+                break;
+            }
+        }
+    }
+}
+
+// -*-
+CLN_AVX2 static const char* _cln_ident_avx2(const char *p){
+    for(;; p += 32){
+        uint32_t ident = _cln_avx2_ident(_mm256_loadu_si256((const __m256i*)p));
+        if(ident != 0xffffffffu){
+            return p + __builtin_ctz(~ident);
+        }
+    }
+}
+
+// -*-
+CLN_AVX2 static const char* _cln_quote_avx2(const char *p){
+    for(;; p += 32){
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t end = _cln_avx2_eq(v, '\"') | _cln_avx2_eq(v, CLN_EOF);
+        if(end){
+            return p + __builtin_ctz(end);
+        }
+    }
+}
+
+static const Scanner clnScanAVX2 = {
+    "avx2", _cln_skip_avx2, _cln_ident_avx2, _cln_quote_avx2
 };
+#endif
+
+// -*- the widest the CPU runs
+static const Scanner* _cln_best_scanner(){
+#ifdef CLN_LEXER_SIMD
+    if(__builtin_cpu_supports("avx2")){
+        return &clnScanAVX2;
+    }
+    return &clnScanSSE2;
+#else
+    return &clnScanScalar;
+#endif
+}
+
+// -*- "scalar", "sse2" or "avx2": false when this build or CPU lacks it
+bool cln_lexer_use_scanner(Lexer *lexer, const char *name){
+    const Scanner *scanners[] = {
+        &clnScanScalar,
+#ifdef CLN_LEXER_SIMD
+        &clnScanSSE2,
+        __builtin_cpu_supports("avx2") ? &clnScanAVX2 : NULL,
+#endif
+    };
+    for(size_t i=0; i < sizeof(scanners)/sizeof(scanners[0]); ++i){
+        if(scanners[i] && strcmp(scanners[i]->name, name)==0){
+            lexer->scan = scanners[i];
+            return true;
+        }
+    }
+    return false;
+}
 
 // -*---------------------------------------------------------------*-
 // -*- Ast                                                         -*-
@@ -83,237 +407,344 @@ const char* clnTokenNames[] = {
 // -*-
 // fail()
 static void _cln_fail(Lexer *lexer, const char *message){
-    fprintf(stderr, "CelineError: %s at [%d]\n", message, lexer->offset);
     cln_lexer_destroy(lexer);
-    exit(EXIT_FAILURE);
+    cln_panic("CelineError: %s at [%u]\n", message, lexer->pos);
 }
 
 // fail_with_invalid_symbol()
 static void _cln_fail_with_invalid_symbol(Lexer *lexer, char expected, char got){
-    fprintf(
-        stderr, "CelineError: expected '%c', got '%c' at [%d]\n",
-        expected, got, lexer->offset
-    );
     cln_lexer_destroy(lexer);
-    exit(EXIT_FAILURE);
+    cln_panic(
+        "CelineError: expected '%c', got '%c' at [%u]\n",
+        expected, got, lexer->pos
+    );
+}
+
+// -*- the whole file, followed by CLN_LEXER_PADDING zero bytes at least:
+// -*- the scanners stop on the sentinel instead of checking the size
+#ifdef CLN_LEXER_MMAP
+static bool _cln_lexer_map(Lexer *lexer, int fd, size_t size){
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t span = ((size + CLN_LEXER_PADDING)/page + 1)*page;
+    char *base = (char*)mmap(NULL, span, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED){
+        return false;
+    }
+    if(size && mmap(base, size, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(base, span);
+        return false;
+    }
+    lexer->source = base;
+    lexer->size = size;
+    lexer->mapped = span;
+    return true;
+}
+#endif
+
+// -*- fallback for streams that cannot be mapped
+static void _cln_lexer_read(Lexer *lexer, FILE *stream){
+    size_t cap = CLN_LEXER_READ_CHUNK;
+    size_t size = 0;
+    char *source = (char*)cln_alloc(cap);
+    size_t nread;
+    for(;;){
+        if(cap - size <= CLN_LEXER_PADDING){
+            cap *= 2;
+            source = (char*)realloc(source, cap);
+            if(!source){
+                cln_panic("CelineError: memory allocation failure\n");
+            }
+        }
+        nread = fread(source + size, sizeof(char), cap - size - CLN_LEXER_PADDING, stream);
+        if(!nread){
+            break;
+        }
+        size += nread;
+    }
+    memset(source + size, CLN_EOF, cap - size);
+    lexer->source = source;
+    lexer->size = size;
+    lexer->mapped = 0;
 }
 
 // -*-
 void cln_lexer_init(Lexer *lexer, const char *filename, Symtable *symtable){
-    lexer->stream = NULL;
+    lexer->source = NULL;
+    lexer->size = 0;
+    lexer->mapped = 0;
     lexer->pos = 0;
-    lexer->offset = 0;
     lexer->symtable = symtable;
-    memset(lexer->buffer, 0, sizeof(char)*CLN_BUFSIZE);
-    memset(lexer->token, 0, sizeof(char)*CLN_MAX_TOKLEN);
-    lexer->stream = fopen(filename, "r");
-    if(!lexer->stream){
-        _cln_fail(lexer, "Failed to open an input stream");
-    }
-    lexer->bufsize = fread(lexer->stream, sizeof(char), CLN_BUFSIZE, lexer->stream);
     lexer->lineno = 1;
     lexer->nextIsFieldName = false;
+    lexer->prevKind = TOK_UNKNOWN;
+    lexer->scan = _cln_best_scanner();
+    FILE *stream = fopen(filename, "r");
+    if(!stream){
+        _cln_fail(lexer, "Failed to open an input stream");
+    }
+#ifdef CLN_LEXER_MMAP
+    struct stat st;
+    if(fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode) &&
+       _cln_lexer_map(lexer, fileno(stream), (size_t)st.st_size)){
+        fclose(stream);
+        return;
+    }
+#endif
+    _cln_lexer_read(lexer, stream);
+    fclose(stream);
 }
 
 // nextchar()
 static char _cln_nextchar(Lexer *lexer){
-    return lexer->buffer[lexer->pos];
+    return lexer->source[lexer->pos];
 }
 
-// nextchar_and_advance()
-static char _cln_nextchar_and_advance(Lexer *lexer){
-    char c = _cln_nextchar(lexer);
-    if(lexer->pos == lexer->bufsize){
-        if(feof(lexer->stream)){
-            return CLN_EOF;
-        }else{
-            lexer->bufsize = fread(lexer->buffer, sizeof(char), CLN_BUFSIZE, lexer->stream);
-            lexer->pos = 0;
-        }
-    }
-    ++lexer->pos;
-    ++lexer->offset;
-    return c;
+// -*- enum CharClass
+static enum CharClass _cln_char_class(char c){
+    return (enum CharClass)clnCharClass[(unsigned char)c];
 }
 
 // advance_(head|pos)()
 static void _cln_advance_pos(Lexer *lexer){
     ++lexer->pos;
-    ++lexer->offset;
 }
 
-// skip_whitespace()
-static void _cln_skip_whitespace(Lexer *lexer){
-    bool comment = false;
-    char c;
-    while((c=_cln_nextchar(lexer)) && (isspace(c)||c==CLN_COMMENT || comment)){
-        if(c==CLN_COMMENT){
-            comment = true;
-        }
-        if(c=='\n'){
-            ++lexer->lineno;
-            comment = false;
-        }
-        _cln_advance_pos(lexer);
-    }
+// -*- whitespace or a comment
+static bool _cln_is_blank(char c){
+    enum CharClass cls = _cln_char_class(c);
+    return cls == CLN_CHAR_SPACE || cls == CLN_CHAR_NEWLINE || cls == CLN_CHAR_COMMENT;
 }
 
-// clear_(token|tokenBuffer)()
-static void _cln_clear_token(Lexer *lexer){
-    memset(lexer->token, '\0', sizeof(char)*CLN_MAX_TOKLEN);
+// skip_whitespace(): comments included; most tokens follow no or a single
+// -*- space, not worth a call to the scanner
+static void _cln_skip_whitespace(Lexer *lexer){
+    const char *p = lexer->source + lexer->pos;
+    if(*p == ' '){
+        ++p;
+    }
+    if(_cln_is_blank(*p)){
+        p = lexer->scan->skip(p, &lexer->lineno);
+    }
+    lexer->pos = p - lexer->source;
 }
 
-// readSymbols()
-static void _cln_read_symbol(Lexer *lexer, bool (*testfn)(char)){
-    _cln_clear_token(lexer);
-    int idx = 0;
+// readSymbols(): the token is the slice from `token->offset` to the
+// -*- first character failing `testfn`
+static void _cln_read_symbol_from(Lexer *lexer, Token *token, bool (*testfn)(char)){
     char c;
-    do{
-        c = _cln_nextchar(lexer);
-        if(!testfn(c)){ break; }
-        lexer->token[idx++] = c;
+    while((c = _cln_nextchar(lexer)) != CLN_EOF && testfn(c)){
         _cln_advance_pos(lexer);
-    }while(idx < CLN_MAX_TOKLEN);
-    lexer->token[idx] = '\0';
-
+    }
+    token->len = lexer->pos - token->offset;
 }
 
-// is_ident_symbol()
-static bool _cln_is_ident_symbol(char c){
-    return isalnum(c) || c == '_';
+// -*- keeps the current character whatever it is, e.g. a sign or '@'
+static void _cln_read_symbol_with_lead(Lexer *lexer, Token *token, bool (*testfn)(char)){
+    token->offset = lexer->pos;
+    _cln_advance_pos(lexer);
+    _cln_read_symbol_from(lexer, token, testfn);
 }
 
 // ::is_number()
 static bool _cln_is_number_symbol(char c){
-    return isdigit(c) || c == '.' || c == 'e' || c == '+' || c == '-';
+    return _cln_char_class(c) == CLN_CHAR_DIGIT || c == '.' || c == 'e';
 }
 
-// -*-
-static bool _cln_is_not_string_end(char c){
-    return c != '\"';
+// -*- the token runs to the first character `scan` stops at
+static void _cln_read_scanned(Lexer *lexer, Token *token, const char* (*scan)(const char*)){
+    lexer->pos = scan(lexer->source + lexer->pos) - lexer->source;
+    token->len = lexer->pos - token->offset;
 }
 
 // read_ident()
-static void _cln_read_symbol_tillws(Lexer *lexer){
-    _cln_read_symbol(lexer, _cln_is_ident_symbol);
+static void _cln_read_symbol_tillws(Lexer *lexer, Token *token){
+    token->offset = lexer->pos;
+    _cln_read_scanned(lexer, token, lexer->scan->ident);
 }
 
-// read_string_literal()
-static void _cln_read_string_literal(Lexer *lexer){
-    _cln_read_symbol(lexer, _cln_is_not_string_end);
+// -*- the lead may be '@'
+static void _cln_read_ident(Lexer *lexer, Token *token){
+    token->offset = lexer->pos;
+    _cln_advance_pos(lexer);
+    _cln_read_scanned(lexer, token, lexer->scan->ident);
+}
+
+// read_string_literal(): the slice leaves out the quotes
+static void _cln_read_string_literal(Lexer *lexer, Token *token){
+    token->offset = lexer->pos;
+    _cln_read_scanned(lexer, token, lexer->scan->quote);
+    if(_cln_nextchar(lexer) == CLN_EOF){
+        _cln_fail(lexer, "unterminated string literal");
+    }
 }
 
 // read_number_literal()
-static void _cln_read_number_literal(Lexer *lexer){
-    _cln_read_symbol(lexer, _cln_is_number_symbol);
+static void _cln_read_number_literal(Lexer *lexer, Token *token){
+    _cln_read_symbol_with_lead(lexer, token, _cln_is_number_symbol);
 }
 
-// get_keyword_token()
-enum TokenKind _cln_get_keyword_token(char *cstr){
-    size_t len = CLN_ARRAYLEN(clnKeywords);
-    for(size_t i=0; i < len; ++i){
-        if(strcmp(clnKeywords[i], cstr)==0){
-            return clnKeywordsKind[i];
-        }
+// -*- a NUL terminated copy of the token's text
+char* cln_lexer_token_cstr(Lexer *lexer, const Token *token){
+    char *str = (char*)cln_alloc(sizeof(char)*(token->len + 1));
+    memcpy(str, lexer->source + token->offset, token->len);
+    return str;
+}
+
+// -*- a leading sign is part of the literal only where no operand precedes it
+static bool _cln_follows_operand(Lexer *lexer){
+    switch(lexer->prevKind){
+    case TOK_IDENT:
+    case TOK_INTEGER:
+    case TOK_FLOAT:
+    case TOK_STRING:
+    case TOK_FIELD:
+    case TOK_RPAREN:
+    case TOK_RSBRACKET:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// get_keyword_token(): `len` is at least 1
+enum TokenKind _cln_get_keyword_token(const char *str, size_t len){
+    const Keyword *keyword = &clnKeywordTable[
+        CLN_KEYWORD_HASH((unsigned char)str[0], (unsigned char)str[len-1], len)
+    ];
+    if(keyword->len == len && memcmp(keyword->name, str, len)==0){
+        return keyword->tkind;
     }
     return TOK_UNKNOWN;
 }
 
-// -*-
+// -*- a number literal, its sign included
+static void _cln_lex_number(Lexer *lexer, Token *token){
+    _cln_read_number_literal(lexer, token);
+    // the literal is not followed by a terminator in the source
+    char buf[CLN_NUMBER_BUFLEN];
+    char *num = token->len < sizeof(buf) ? buf : (char*)cln_alloc(token->len + 1);
+    memcpy(num, lexer->source + token->offset, token->len);
+    num[token->len] = '\0';
+    if(memchr(num, '.', token->len) == NULL){
+        token->val.integer = atol(num);
+        token->tkind  = TOK_INTEGER;
+    }else{
+        token->val.real = strtod(num, NULL);
+        token->tkind = TOK_FLOAT;
+    }
+    if(num != buf){
+        cln_dealloc(num);
+    }
+}
+
+// -*- ident or keyword: [@A-Za-z_][A-Za-z0-9_]*
+static void _cln_lex_ident(Lexer *lexer, Token *token){
+    _cln_read_ident(lexer, token);
+    const char *str = lexer->source + token->offset;
+    enum TokenKind tkind = _cln_get_keyword_token(str, token->len);
+    if(tkind == TOK_UNKNOWN){   // ident
+        token->tkind = TOK_IDENT;
+        token->val.symbol = cln_get_symbol_slice(lexer->symtable, str, token->len);
+    }else{                      // keyword
+        token->tkind = tkind;
+    }
+}
+
+// -*- dispatched on the class of the first character
 Token cln_lexer_nexttoken(Lexer *lexer){
     _cln_skip_whitespace(lexer);
     Token token;
     token.lineno = lexer->lineno;
+    token.offset = lexer->pos;
+    token.len = 0;
+    token.val.integer = 0;
     char c = _cln_nextchar(lexer);
-    uint32_t pos = lexer->pos;
-    uint32_t offset = lexer->offset;
 
     if(lexer->nextIsFieldName){
-        _cln_read_symbol_tillws(lexer);
-        char *str = (char*)cln_alloc(sizeof(char)*(strlen(lexer->token)+1));
-        strcpy(str, lexer->token);
+        _cln_read_symbol_tillws(lexer, &token);
         token.tkind = TOK_FIELD;
-        token.obj = cln_new_string(str);
         lexer->nextIsFieldName = false;
-    }else if(c=='_' || isalpha(c)){ // ident or keyword: [A-Za-b_]+[A-Za-b0-9_]*
-        _cln_read_symbol_tillws(lexer);
-        enum TokenKind tkind = _cln_get_keyword_token(lexer->token);
-        if(tkind == TOK_UNKNOWN){   // ident
-            uint32_t idx = cln_get_symbol_index(lexer->symtable, lexer->token);
-            token.tkind = tkind;
-            token.obj = cln_new_integer(idx);
-        }else{                      // keyword
-            token.tkind = tkind;
-        }
-    }else if(((c=='-'|| c=='+') && (isdigit(_cln_nextchar(lexer))))){ // number literal
-        lexer->pos = pos;
-        lexer->offset = offset;
-        _cln_read_number_literal(lexer);
-        char *end = strchr(lexer->token, '.');
-        if(end == NULL){
-            token.obj = cln_new_integer(atol(lexer->token));
-            token.tkind  = TOK_INTEGER;
+        lexer->prevKind = token.tkind;
+        return token;
+    }
+
+    switch(_cln_char_class(c)){
+    case CLN_CHAR_LETTER:
+    case CLN_CHAR_AT:
+        _cln_lex_ident(lexer, &token);
+        break;
+    case CLN_CHAR_DIGIT:
+        _cln_lex_number(lexer, &token);
+        break;
+    case CLN_CHAR_SIGN:
+        // a leading sign is part of the literal only where no operand precedes it
+        if(!_cln_follows_operand(lexer) &&
+           _cln_char_class(lexer->source[lexer->pos+1]) == CLN_CHAR_DIGIT){
+            _cln_lex_number(lexer, &token);
         }else{
-            char *ptr = NULL;
-            double num = strtod(lexer->token, &ptr);
-            token.obj = cln_new_float(num);
-            token.tkind = TOK_FLOAT;
+            _cln_advance_pos(lexer);
+            token.tkind = clnCharTokens[(unsigned char)c];
         }
-    }else if(c=='\"'){  // string literal
+        break;
+    case CLN_CHAR_QUOTE:    // string literal
         _cln_advance_pos(lexer);
-        _cln_read_string_literal(lexer);
-        char *str = (char*)cln_alloc(sizeof(char)*(strlen(lexer->token)+1));
-        strcpy(str, lexer->token);
+        _cln_read_string_literal(lexer, &token);
         token.tkind = TOK_STRING;
-        token.obj = cln_new_string(str);
-        _cln_advance_pos(lexer);
-    }else if(c=='='){ // = | ==
         _cln_advance_pos(lexer);
-        c = _cln_nextchar_and_advance(lexer);
-        if(c == '='){
-            token.tkind = TOK_EQ;
-        }else{
-            token.tkind = TOK_ASSIGN;
-        }
-    }else if(c=='<'){
-        _cln_advance_pos(lexer);
-        c = _cln_nextchar_and_advance(lexer);
-        if(c=='='){
-            token.tkind = TOK_LE;
-        }else{
-            token.tkind = TOK_LT;
-        }
-    }else if(c=='>'){
+        break;
+    case CLN_CHAR_COMPARE:  // = == < <= > >=
         _cln_advance_pos(lexer);
-        c = _cln_nextchar_and_advance(lexer);
-        if(c=='='){
-            token.tkind = TOK_GE;
+        if(_cln_nextchar(lexer) == '='){
+            _cln_advance_pos(lexer);
+            token.tkind = clnCharEqTokens[(unsigned char)c];
         }else{
-            token.tkind = TOK_GT;
+            token.tkind = clnCharTokens[(unsigned char)c];
         }
-    }else if(c=='.'){ // field
+        break;
+    case CLN_CHAR_DOT:      // field
         _cln_advance_pos(lexer);
         lexer->nextIsFieldName = true;
         token.tkind = TOK_DOT;
-    }else{  // DELIMITER | OP
-        bool found = false;
-        for(int i=0; i < CLN_ARRAYLEN(clnDelimiters); ++i){
-            if(c==clnDelimiters[i]){
-                found = true;
-                _cln_advance_pos(lexer);
-                token.tkind = clnDelimitersKind[i];
-            }
-        }
-        if(!found){
-            _cln_fail_with_invalid_symbol(lexer, '?', c);
-        }
+        break;
+    case CLN_CHAR_PUNCT:
+        _cln_advance_pos(lexer);
+        token.tkind = clnCharTokens[(unsigned char)c];
+        break;
+    case CLN_CHAR_END:      // the sentinel is never stepped over
+        token.tkind = TOK_EOF;
+        break;
+    default:
+        _cln_fail_with_invalid_symbol(lexer, '?', c);
+        break;
     }
 
+    if(token.tkind != TOK_STRING){
+        token.len = lexer->pos - token.offset;
+    }
+    lexer->prevKind = token.tkind;
     return token;
 }
 
 // -*-
 void cln_lexer_destroy(Lexer *lexer){
-    fclose(lexer->stream);
+#ifdef CLN_LEXER_MMAP
+    if(lexer->mapped){
+        munmap((void*)lexer->source, lexer->mapped);
+        lexer->source = NULL;
+    }
+#endif
+    cln_dealloc((void*)lexer->source);
+    lexer->source = NULL;
+}
+
+// -*- continue at `offset`, the start of a token on line `lineno`
+void cln_lexer_seek(Lexer *lexer, uint32_t offset, uint32_t lineno){
+    if(offset > lexer->size){
+        _cln_fail(lexer, "Seek past the end of the source");
+    }
+    lexer->pos = offset;
+    lexer->lineno = lineno;
+    lexer->nextIsFieldName = false;
+    lexer->prevKind = TOK_UNKNOWN;
 }
 // bool cln_lexer_has_nextotken(Lexer *lexer);
\ No newline at end of file
@@ -1,20 +1,74 @@
 #include<assert.h>
-#include<errno.h>
 #include<string.h>
 #include "celine.h"
 
-#define CLN_EVALOP(op)                                      \
-    lhs = _cln_eval_expr(ast->node, env, symtable);         \
-    cln_checktype(lhs, TY_INTEGER);                         \
-    rhs = _cln_eval_expr(ast->node->next, env, symtable);   \
-    cln_checktype(rhs, TY_INTEGER);                         \
-    return cln_new_integer((long)((lhs->val.integer) op (rhs->val.integer)))
+// -*- `quick` of ADD..GE and INDEX nodes: operand types seen by the first
+// -*- executions pick a specialized variant, a failed guard sends the node
+// -*- back to CLN_QUICK_NONE to be observed again
+#define CLN_QUICK_NONE          0   // generic, specializes on the next run
+#define CLN_QUICK_INT           1   // immediate integer operands
+#define CLN_QUICK_VARS          2   // ... read straight from variables and literals
+#define CLN_QUICK_GENERIC       3   // guards failed too often, stays generic
+#define CLN_QUICK_MAX_MISSES    8
+
+// -*- `aux` of a WHILE node, once analysed
+#define CLN_LOOP_GENERIC        0x01
+#define CLN_LOOP_COUNTED        0x02    // while(i < n){ ...; i = i + c; }
+#define CLN_LOOP_CALLS          0x04    // the body calls functions
+#define CLN_LOOP_READS          0x08    // the body reads the counter
 
 // -*---------------------------------------------------------------*-
 // -*- Parser                                                      -*-
 // -*---------------------------------------------------------------*-
-// -*- Object* _cln_eval_expr() -*-
-static Object* _cln_eval_expr(Ast *ast, Env *env, Symtable *symtable);
+// -*- Value _cln_eval_expr() -*-
+static Value _cln_eval_expr(Ast *ast, Env *env, Symtable *symtable);
+static bool _cln_eval_block(Ast *ast, Env *env, Symtable *symtable);
+static bool _cln_eval_statement(Ast *ast, Env *env, Symtable *symtable);
+static bool _cln_eval_while(Ast *ast, Env *env, Symtable *symtable);
+static Value _cln_eval_get_field(Ast *ast, Env *env, Symtable *symtable);
+static Value _cln_eval_def(Ast *ast, Env *env, Symtable *symtable);
+
+static Env *clnGlobals;
+static Symtable *clnSymtable;
+
+// -*- Value* _cln_lookup(): the slot a resolved variable reference names
+static Value* _cln_lookup(Ast *ast, Env *env){
+    if(ast->aux == CLN_BIND_GLOBAL){
+        return &clnGlobals->slots[cln_as_integer(ast->obj)];
+    }
+    return &cln_env_up(env, CLN_BIND_DEPTH(ast->aux))->slots[CLN_BIND_SLOT(ast->aux)];
+}
+
+// -*- Value _cln_eval_unset(): a global read before it is set, unless a
+// -*- lazy import left its def to be bound now
+static Value _cln_eval_unset(uint32_t id){
+    Ast *program = cln_module_lazy_def(id, clnSymtable);
+    if(program){
+        // - no safepoint: the reader may hold values no root knows of
+        clnGlobals->slots[id] = _cln_eval_def(cln_ast_node(program), clnGlobals, clnSymtable);
+    }
+    if(!clnGlobals->slots[id]){
+        cln_panic("CelineError: %s is not initialized\n", clnSymtable->symbols[id]);
+    }
+    return clnGlobals->slots[id];
+}
+
+// -*-
+Value cln_jit_global(uint32_t id){
+    return _cln_eval_unset(id);
+}
+
+// -*- Value _cln_eval_var()
+static Value _cln_eval_var(Ast *ast, Env *env, Symtable *symtable){
+    Value self = *_cln_lookup(ast, env);
+    if(!self){
+        if(ast->aux == CLN_BIND_GLOBAL){
+            return _cln_eval_unset(cln_as_integer(ast->obj));
+        }
+        cln_panic("CelineError: %s is not initialized\n", symtable->symbols[cln_as_integer(ast->obj)]);
+    }
+    return self;
+}
 
 // -*- void _cln_narg_error()
 static void _cln_narg_error(Object *fun){
@@ -24,233 +78,467 @@ static void _cln_narg_error(Object *fun){
     );
 }
 
-// -*- Object* _cln_eval_call()
-static Object* _cln_eval_call(Env* env, Object *fun, Ast* arglist, Object *owner, Symtable *symtable){
+// -*- `return f(...)` in a function: the callee, @self and arguments
+// -*- are on the gc root stack from `base`, for the running call to take
+// -*- over once its frame is gone
+static struct{
+    bool pending;
+    size_t base;
+    int narg;
+} clnTailCall;
+
+// -*- int _cln_eval_args(): pushes the callee, @self and the arguments on
+// -*- the gc root stack
+static int _cln_eval_args(Env* env, Value callee, Ast* arglist, Value owner, Symtable *symtable){
     int narg = 0;
-    cln_checktype(fun, TY_FUN);
-    Env *local = cln_new_env();
-    local->parent = env;
-    Object **args = (Object**)cln_alloc(sizeof(Object*)*fun->val.fun.narg);
-    for(Ast *arg = arglist->next; arg; arg = arg->next){
+    cln_checktype(callee, TY_FUN);
+    Object *fun = cln_as_object(callee);
+    cln_gc_push_root(callee);
+    cln_gc_push_root(owner);
+    for(Ast *arg = cln_ast_node(arglist); arg; arg = cln_ast_next(arg)){
         if(narg==fun->val.fun.narg){
             _cln_narg_error(fun);
         }
-        args[narg++] = _cln_eval_expr(arg, env, symtable);
+        cln_gc_push_root(_cln_eval_expr(arg, env, symtable));
+        ++narg;
     }
     if(narg < fun->val.fun.narg){
         _cln_narg_error(fun);
     }
-    for(narg=0; narg < fun->val.fun.narg; ++narg){
-        cln_env_put(local, fun->val.fun.args[narg], args[narg]);
+    return narg;
+}
+
+// -*- JitCode* _cln_hot_code(): the machine code of `fun`, once it has
+// -*- been called often enough and could be compiled
+static JitCode* _cln_hot_code(Object *fun){
+    if(!fun->val.fun.jit){
+        if(!clnOptions.jitThreshold || ++fun->val.fun.calls < clnOptions.jitThreshold){
+            return NULL;
+        }
+        fun->val.fun.jit = cln_jit_compile(fun->val.fun.code, fun->val.fun.name, &clnGlobals, clnSymtable);
     }
-    cln_env_put(local, CLN_RETURN_ID, NULL);
-    cln_env_put(local, CLN_SELF_ID, owner);
-    cln_eval(fun->val.fun.code, local, symtable);
-    Object *result = local->idents[CLN_RETURN_ID];
-    cln_dealloc(args);
-    cln_dealloc(local);
-    return result;
+    return fun->val.fun.jit->entry ? fun->val.fun.jit : NULL;
 }
 
-// -*- Object** _cln_resolve_index()
-static Object** _cln_resolve_index(Ast *ast, Env *env, Symtable *symtable){
-    int i = ast->obj->val.integer;
-    Object *index = _cln_eval_expr(ast->node, env, symtable);
-    cln_checktype(index, TY_INTEGER);
-    Object* self = cln_env_get(env, i);
-    cln_checktype(self, TY_ARRAY);
-    if(index->val.integer >= self->val.array.len){
-        cln_panic(
-            "Array index out of bounds: %d out of %d\n",
-            index->val.integer, self->val.array.len
-        );
+// -*- bool _cln_holds(): `at` is `ast` or one of its statements
+static bool _cln_holds(Ast *ast, Ast *at){
+    if(ast == at){
+        return true;
     }
+    for(Ast *node = cln_ast_node(ast); node; node = cln_ast_next(node)){
+        if(_cln_holds(node, at)){
+            return true;
+        }
+    }
+    return false;
+}
 
-    return &self->val.array.data[index->val.integer];
+// -*- bool _cln_eval_resume(): runs the statement `ast` from the statement
+// -*- `at` inside it on, where machine code bailed out
+static bool _cln_eval_resume(Ast *ast, Ast *at, Env *env, Symtable *symtable){
+    Ast *node;
+    if(ast == at){
+        return _cln_eval_statement(ast, env, symtable);
+    }
+    switch(ast->akind){
+    case AST_EMPTY:
+        for(node = cln_ast_node(ast); !_cln_holds(node, at); node = cln_ast_next(node));
+        if(_cln_eval_resume(node, at, env, symtable)){
+            return true;
+        }
+        return cln_ast_next(node) ? _cln_eval_block(cln_ast_next(node), env, symtable) : false;
+    case AST_WHILE:
+        if(_cln_eval_resume(cln_ast_next(cln_ast_node(ast)), at, env, symtable)){
+            return true;
+        }
+        return _cln_eval_while(ast, env, symtable);
+    default:    // AST_IF
+        node = cln_ast_next(cln_ast_node(ast));
+        if(!_cln_holds(node, at)){
+            node = cln_ast_next(node);
+        }
+        return _cln_eval_resume(node, at, env, symtable);
+    }
 }
 
-// -*- void _cln_eval_set_field()
-static void _cln_eval_set_field(Ast *ast, Env *env, Object *obj){
-    int i = ast->obj->val.integer;
-    Object *self = cln_env_get(env, i);
-    cln_checktype(ast->node->obj, TY_STRING);
-    cln_set_field(self, ast->node->obj->val.cstr, obj);
+// -*- Value _cln_run_call(): the callee, @self and `narg` arguments are on
+// -*- the gc root stack from `mark`, until the callee env holds them. Tail
+// -*- calls reuse the C frame and the place of the frame they replace.
+static Value _cln_run_call(size_t mark, int narg, Symtable *symtable){
+    for(;;){
+        Object *fun = cln_as_object(clnGCRoots.values[mark]);
+        Ast *body = fun->val.fun.code;
+        JitCode *jit = _cln_hot_code(fun);
+        Env *local = cln_new_frame(jit ? body->aux + jit->ntemp : body->aux, fun->val.fun.closure);
+        memcpy(local->slots + CLN_ARGS_SLOT, clnGCRoots.values + mark + 2, sizeof(Value)*narg);
+        local->slots[CLN_SELF_ID] = clnGCRoots.values[mark + 1];
+        cln_gc_push_env(local);
+        if(!jit){
+            _cln_eval_block(body, local, symtable);
+        }else{
+            Ast *resume;
+            if(jit->entry(local->slots, &resume) == CLN_JIT_BAILOUT){
+                if(++jit->bailouts == CLN_JIT_MAX_BAILOUTS){
+                    jit->entry = NULL;
+                }
+                _cln_eval_resume(body, resume, local, symtable);
+            }
+        }
+        cln_gc_pop_env();
+        if(!clnTailCall.pending){
+            cln_gc_pop_roots(mark);
+            Value result = local->slots[CLN_RETURN_ID];
+            cln_free_frame(local);
+            return result;
+        }
+        clnTailCall.pending = false;
+        narg = clnTailCall.narg;
+        memmove(clnGCRoots.values + mark, clnGCRoots.values + clnTailCall.base, sizeof(Value)*(narg + 2));
+        cln_gc_pop_roots(mark + 2 + narg);
+        cln_free_frame(local);
+    }
 }
 
-// -*- Object* _cln_eval_get_field()
-static Object* _cln_eval_get_field(Ast *ast, Env *env){
-    int i = ast->obj->val.integer;
-    Object *self = cln_env_get(env, i);
-    cln_checktype(ast->node->obj, TY_STRING);
-    return cln_get_field(self, ast->node->obj->val.cstr);
+// -*- Value _cln_eval_call()
+static Value _cln_eval_call(Env* env, Value callee, Ast* arglist, Value owner, Symtable *symtable){
+    size_t mark = cln_gc_root_mark();
+    int narg = _cln_eval_args(env, callee, arglist, owner, symtable);
+    return _cln_run_call(mark, narg, symtable);
 }
 
-// -*- Object* _cln_eval_def()
-static Object* _cln_eval_def(Ast *ast){
-    int* fargs = (int*)cln_alloc(sizeof(int)*CLN_BUILTIN_MAXARGS);
-    int argc = 0;
-    for(Ast* arg=ast->node; arg; arg = arg->next){
-        fargs[argc++] = arg->obj->val.integer;
+// -*- int _cln_push_args(): the callee and arguments computed by machine code
+static int _cln_push_args(Value *values, int narg){
+    cln_checktype(values[0], TY_FUN);
+    Object *fun = cln_as_object(values[0]);
+    if(narg != fun->val.fun.narg){
+        _cln_narg_error(fun);
     }
+    cln_gc_push_root(values[0]);
+    cln_gc_push_root(CLN_NIL);
+    for(int i=1; i <= narg; ++i){
+        cln_gc_push_root(values[i]);
+    }
+    return narg;
+}
 
-    assert(ast->node);
-    return cln_new_fun(fargs, argc, ast->node->next);
+// -*-
+Value cln_jit_call(Value *values, int narg){
+    size_t mark = cln_gc_root_mark();
+    return _cln_run_call(mark, _cln_push_args(values, narg), clnSymtable);
 }
 
 // -*-
-static void _cln_readlong(long *num){
-    char buf[64] = {0};
-    char *rv = fgets(buf, sizeof(buf), stdin);
-    if(rv == NULL){
-        cln_panic("CelineError: error reading number from standard input\n");
+void cln_jit_tail_call(Value *values, int narg){
+    clnTailCall.base = cln_gc_root_mark();
+    clnTailCall.narg = _cln_push_args(values, narg);
+    clnTailCall.pending = true;
+}
+
+// -*- void _cln_eval_tail_call(): `return f(...)` and `return obj.m(...)`
+static void _cln_eval_tail_call(Ast *ast, Env *env, Symtable *symtable){
+    size_t base = cln_gc_root_mark();
+    if(ast->akind == AST_CALL){
+        clnTailCall.narg = _cln_eval_args(
+            env, _cln_eval_var(ast, env, symtable),
+            cln_ast_node(ast), CLN_NIL, symtable
+        );
+    }else{
+        clnTailCall.narg = _cln_eval_args(
+            env, _cln_eval_get_field(cln_ast_node(ast), env, symtable),
+            cln_ast_next(cln_ast_node(ast)), _cln_eval_var(cln_ast_node(ast), env, symtable),
+            symtable
+        );
     }
-    char *ptr;
-    *num = strtol(buf, &ptr, 10);
-    if(errno == EINVAL || errno==ERANGE){
-        cln_panic("CelineError: error reading number from standard input\n");
+    clnTailCall.base = base;
+    clnTailCall.pending = true;
+}
+
+// -*- void _cln_despecialize(): a guard of the node's variant failed
+static void _cln_despecialize(Ast *ast){
+    if(ast->misses < CLN_QUICK_MAX_MISSES){
+        ++ast->misses;
     }
-    return;
+    ast->quick = ast->misses < CLN_QUICK_MAX_MISSES ? CLN_QUICK_NONE : CLN_QUICK_GENERIC;
 }
 
-// -*-
-static void _cln_readfloat(double *num){
-    char buf[64] = {0};
-    char *rv = fgets(buf, sizeof(buf), stdin);
-    if(rv == NULL){
-        cln_panic("CelineError: error reading number from standard input\n");
+// -*- bool _cln_quick_operand(): variables and immediate literals are read
+// -*- without going through _cln_eval_expr()
+static bool _cln_quick_operand(Ast *ast){
+    return ast->akind == AST_IDENT || (ast->akind == AST_INTEGER && cln_is_integer(ast->obj));
+}
+
+// -*- Value _cln_binop()
+static Value _cln_binop(enum AstKind akind, long lhs, long rhs){
+    switch(akind){
+    case AST_ADD:
+        return cln_new_integer(lhs + rhs);
+    case AST_SUB:
+        return cln_new_integer(lhs - rhs);
+    case AST_MUL:
+        return cln_new_integer(lhs * rhs);
+    case AST_DIV:
+        return cln_new_integer(lhs / rhs);
+    case AST_AND:
+        return cln_new_integer(lhs && rhs);
+    case AST_OR:
+        return cln_new_integer(lhs || rhs);
+    case AST_LT:
+        return cln_new_integer(lhs < rhs);
+    case AST_EQ:
+        return cln_new_integer(lhs == rhs);
+    case AST_GT:
+        return cln_new_integer(lhs > rhs);
+    case AST_LE:
+        return cln_new_integer(lhs <= rhs);
+    default:
+        return cln_new_integer(lhs >= rhs);
+    }
+}
+
+// -*- Value _cln_eval_binop_rhs(): the generic path once the left operand
+// -*- is known; operands the inference proved to be integers are not checked
+static Value _cln_eval_binop_rhs(Ast *ast, Value lhs, Env *env, Symtable *symtable){
+    Ast *left = cln_ast_node(ast);
+    Ast *right = cln_ast_next(left);
+    if(!cln_ast_proven(left, TY_INTEGER)){
+        cln_checktype(lhs, TY_INTEGER);
+    }
+    size_t mark = cln_gc_root_mark();
+    cln_gc_push_root(lhs);
+    Value rhs = _cln_eval_expr(right, env, symtable);
+    cln_gc_pop_roots(mark);
+    if(!cln_ast_proven(right, TY_INTEGER)){
+        cln_checktype(rhs, TY_INTEGER);
     }
-    char *ptr;
-    *num = strtod(buf, &ptr);
-    if(errno==ERANGE){
-        cln_panic("CelineError: error reading number from standard input\n");
+    if(ast->quick == CLN_QUICK_NONE && cln_is_integer(lhs) && cln_is_integer(rhs)){
+        ast->quick = _cln_quick_operand(left) && _cln_quick_operand(right) ? CLN_QUICK_VARS : CLN_QUICK_INT;
     }
-    return;
+    return _cln_binop(ast->akind, cln_as_integer(lhs), cln_as_integer(rhs));
 }
 
-// -*-
-static void _cln_readstring(char **str){
-    char buf[256];
-    memset(buf, '\0', sizeof(buf));
-    char *rv = fgets(buf, sizeof(buf), stdin);
-    if(rv == NULL || errno==EBADF){
-        cln_panic("CelineError: error reading number from standard input\n");
+// -*- Value _cln_eval_binop(): ADD..GE, see CLN_QUICK_*
+static Value _cln_eval_binop(Ast *ast, Env *env, Symtable *symtable){
+    Ast *left = cln_ast_node(ast);
+    Ast *right = cln_ast_next(left);
+    Value lhs;
+    Value rhs;
+    switch(ast->quick){
+    case CLN_QUICK_VARS:
+        lhs = left->akind == AST_IDENT ? *_cln_lookup(left, env) : left->obj;
+        rhs = right->akind == AST_IDENT ? *_cln_lookup(right, env) : right->obj;
+        if(cln_is_integer(lhs) && cln_is_integer(rhs)){
+            return _cln_binop(ast->akind, cln_as_integer(lhs), cln_as_integer(rhs));
+        }
+        // reading the operands again has no side effect
+        _cln_despecialize(ast);
+        break;
+    case CLN_QUICK_INT:
+        lhs = _cln_eval_expr(left, env, symtable);
+        if(!cln_is_integer(lhs)){
+            _cln_despecialize(ast);
+            return _cln_eval_binop_rhs(ast, lhs, env, symtable);
+        }
+        // an immediate needs no root
+        rhs = _cln_eval_expr(right, env, symtable);
+        if(!cln_is_integer(rhs)){
+            _cln_despecialize(ast);
+            cln_checktype(rhs, TY_INTEGER);
+        }
+        return _cln_binop(ast->akind, cln_as_integer(lhs), cln_as_integer(rhs));
+    default:
+        break;
+    }
+    return _cln_eval_binop_rhs(ast, _cln_eval_expr(left, env, symtable), env, symtable);
+}
+
+// -*- Value* _cln_resolve_index(): the INDEX node is proven TY_ARRAY when
+// -*- its variable is; CLN_QUICK_INT guards an array, an immediate index
+// -*- and the bounds at once
+static Value* _cln_resolve_index(Ast *ast, Env *env, Object **owner, Symtable *symtable){
+    Value index = _cln_eval_expr(cln_ast_node(ast), env, symtable);
+    Value array;
+    if(ast->quick == CLN_QUICK_INT){
+        array = *_cln_lookup(ast, env);
+        if(cln_is_integer(index) && cln_is_object(array) && cln_as_object(array)->type == TY_ARRAY &&
+           (uint64_t)cln_as_integer(index) < cln_as_object(array)->val.array.len){
+            *owner = cln_as_object(array);
+            return &cln_as_object(array)->val.array.data[cln_as_integer(index)];
+        }
+        _cln_despecialize(ast);
     }
-    *str = strdup(buf);
-    return;
+    if(!cln_ast_proven(cln_ast_node(ast), TY_INTEGER)){
+        cln_checktype(index, TY_INTEGER);
+    }
+    array = _cln_eval_var(ast, env, symtable);
+    if(!cln_ast_proven(ast, TY_ARRAY)){
+        cln_checktype(array, TY_ARRAY);
+    }
+    Object *self = cln_as_object(array);
+    long idx = cln_as_integer(index);
+    if(idx >= self->val.array.len){
+        cln_panic(
+            "Array index out of bounds: %ld out of %zu\n",
+            idx, self->val.array.len
+        );
+    }
+    if(ast->quick == CLN_QUICK_NONE && cln_is_integer(index) && idx >= 0){
+        ast->quick = CLN_QUICK_INT;
+    }
+
+    *owner = self;
+    return &self->val.array.data[idx];
 }
 
+// -*- the inline cache of a field site, made on its first run: `aux` of
+// -*- the field name is the cache + 1
+static FieldCache* _cln_field_site(Ast *name){
+    if(!name->aux){
+        cln_checktype(name->obj, TY_STRING);
+        name->aux = cln_new_field_cache(cln_atom(cln_as_object(name->obj)->val.cstr)) + 1;
+    }
+    return cln_field_cache(name->aux-1);
+}
 
-// -*- Object* _cln_eval_expr()
-static Object* _cln_eval_expr(Ast *ast, Env *env, Symtable *symtable){
-    Object *lhs;
-    Object *rhs;
-    Object *self;
-    Object *index;
-    Object *len;
+// -*- void _cln_eval_set_field()
+static void _cln_eval_set_field(Ast *ast, Env *env, Value obj, Symtable *symtable){
+    Object *self = cln_checkobject(_cln_eval_var(ast, env, symtable));
+    cln_set_field_cached(self, _cln_field_site(cln_ast_node(ast)), obj);
+}
+
+// -*- Value _cln_eval_get_field()
+static Value _cln_eval_get_field(Ast *ast, Env *env, Symtable *symtable){
+    Object *self = cln_checkobject(_cln_eval_var(ast, env, symtable));
+    return cln_get_field_cached(self, _cln_field_site(cln_ast_node(ast)));
+}
+
+// -*- Value _cln_eval_def()
+static Value _cln_eval_def(Ast *ast, Env *env, Symtable *symtable){
+    int argc = 0;
+    for(Ast* arg=cln_ast_node(cln_ast_node(ast)); arg; arg = cln_ast_next(arg)){
+        if(argc == CLN_BUILTIN_MAXARGS){
+            cln_panic("CelineError: too many parameters, maximum is %d\n", CLN_BUILTIN_MAXARGS);
+        }
+        ++argc;
+    }
+
+    assert(cln_ast_node(ast));
+    Object *fun = cln_new_fun(argc, cln_ast_next(cln_ast_node(ast)));
+    fun->val.fun.closure = cln_closure_env(env);
+    if(ast->obj){
+        fun->val.fun.name = symtable->symbols[cln_as_integer(ast->obj)];
+    }
+    return cln_object_value(fun);
+}
+
+// -*- Value _cln_eval_expr()
+static Value _cln_eval_expr(Ast *ast, Env *env, Symtable *symtable){
+    Value self;
+    Value len;
+    Object *owner;
     long inum;
     double fnum;
     int idx;
     char *str = NULL;
     switch(ast->akind){
     case AST_IDENT:
-        return cln_env_get(env, ast->obj->val.integer);
+        return _cln_eval_var(ast, env, symtable);
+    case AST_INTEGER:
+    case AST_FLOAT:
+    case AST_STRING:
+        return ast->obj;
     case AST_READ_INT:
         printf("icln>> ");
-        _cln_readlong(&inum);
+        cln_readlong(&inum);
         return cln_new_integer(inum);
     case AST_INPUT:
         printf("icln>> ");
-        _cln_readstring(&str);
-        return cln_new_string(str);
+        cln_readstring(&str);
+        return cln_object_value(cln_new_string(str));
     case AST_ARRAY:
-        len = _cln_eval_expr(ast->node, env, symtable);
-        cln_checktype(len, TY_INTEGER);
-        return cln_new_array(len->val.integer);
+        len = _cln_eval_expr(cln_ast_node(ast), env, symtable);
+        if(!cln_ast_proven(cln_ast_node(ast), TY_INTEGER)){
+            cln_checktype(len, TY_INTEGER);
+        }
+        return cln_object_value(cln_new_array(cln_as_integer(len)));
     case AST_OBJECT:
-        return cln_new();
+        return cln_object_value(cln_new());
     case AST_INDEX:
-        return *_cln_resolve_index(ast, env, symtable);
+        return *_cln_resolve_index(ast, env, &owner, symtable);
     case AST_FIELD:
-        self = _cln_eval_get_field(ast, env);
+        self = _cln_eval_get_field(ast, env, symtable);
         if(!self){
-            cln_panic("CelineError: unknown field: %s\n", ast->node->obj->val.cstr);
+            cln_panic("CelineError: unknown field: %s\n", cln_as_object(cln_ast_node(ast)->obj)->val.cstr);
         }
         return self;
     case AST_DEF:
-        return _cln_eval_def(ast);
+        return _cln_eval_def(ast, env, symtable);
     case AST_CALL:
         return _cln_eval_call(
-            env, cln_env_get(env, ast->obj->val.integer),
-            ast->node, NULL, symtable
+            env, _cln_eval_var(ast, env, symtable),
+            cln_ast_node(ast), CLN_NIL, symtable
         );
     case AST_NEW:{
-            Object *obj = cln_new();
-            Object *ctor = cln_env_get(env, ast->node->obj->val.integer);
-            _cln_eval_call(env, ctor, ast->node->node, obj, symtable);
-            cln_set_field(obj, CLN_PROTOTYPE, cln_get_field_generic(ctor, CLN_PROTOTYPE, false));
-            return obj;
+            Value ctor = _cln_eval_var(cln_ast_node(ast), env, symtable);
+            Object *obj = cln_new_instance(ctor);
+            _cln_eval_call(env, ctor, cln_ast_node(cln_ast_node(ast)), cln_object_value(obj), symtable);
+            cln_finish_instance(ctor, obj);
+            return cln_object_value(obj);
         }//
     case AST_MCALL:
         return _cln_eval_call(
-            env, _cln_eval_get_field(ast, env),
-            ast->node->next, cln_env_get(env, ast->node->obj->val.integer),
+            env, _cln_eval_get_field(cln_ast_node(ast), env, symtable),
+            cln_ast_next(cln_ast_node(ast)), _cln_eval_var(cln_ast_node(ast), env, symtable),
             symtable
         );
     case AST_ADD:
-        CLN_EVALOP(+);
     case AST_SUB:
-        CLN_EVALOP(-);
     case AST_MUL:
-        CLN_EVALOP(*);
     case AST_DIV:
-        CLN_EVALOP(/);
     case AST_AND:
-        CLN_EVALOP(&&);
     case AST_OR:
-        CLN_EVALOP(||);
-    case AST_NOT:
-        self = _cln_eval_expr(ast->node, env, symtable);
-        cln_checktype(self, TY_INTEGER);
-        return cln_new_integer((long)(!self->val.integer));
     case AST_LT:
-        CLN_EVALOP(<);
     case AST_EQ:
-        CLN_EVALOP(==);
     case AST_GT:
-        CLN_EVALOP(>);
     case AST_LE:
-        CLN_EVALOP(<=);
     case AST_GE:
-        CLN_EVALOP(>=);
+        return _cln_eval_binop(ast, env, symtable);
+    case AST_NOT:
+        self = _cln_eval_expr(cln_ast_node(ast), env, symtable);
+        if(!cln_ast_proven(cln_ast_node(ast), TY_INTEGER)){
+            cln_checktype(self, TY_INTEGER);
+        }
+        return cln_new_integer((long)(!cln_as_integer(self)));
     default:
         fprintf(
             stderr, "CelineError: unexpected syntax error: %s\n",
             clnAstKindNames[ast->akind]
         );
-        return NULL;
+        return CLN_NIL;
     }
 }
 
-// -*- void _cln_eval_assign()
-static void _cln_eval_assign(Ast *ast, Env *env, int local, Symtable *symtable){
-    Ast *lhs = ast->node;
-    int i = lhs->obj->val.integer;
-    Object *self = _cln_eval_expr(lhs->next, env, symtable);
-    Object *index;
-    Object **item;
+// -*- void _cln_eval_assign(): `local` and plain assignments only differ
+// -*- in the slot the resolver picked
+static void _cln_eval_assign(Ast *ast, Env *env, Symtable *symtable){
+    Ast *lhs = cln_ast_node(ast);
+    Value self = _cln_eval_expr(cln_ast_next(lhs), env, symtable);
+    Value *item;
+    Object *owner;
+    size_t mark;
     switch(lhs->akind){
     case AST_IDENT:
-        if(local){ cln_env_put(env, i, self); }
-        else{
-            cln_env_update(env, i, self);
-        }
+        *_cln_lookup(lhs, env) = self;
         break;
     case AST_INDEX:
-        item = _cln_resolve_index(lhs, env, symtable);
+        mark = cln_gc_root_mark();
+        cln_gc_push_root(self);
+        item = _cln_resolve_index(lhs, env, &owner, symtable);
+        cln_gc_pop_roots(mark);
         *item = self;
+        cln_gc_barrier(owner, self);
         break;
     case AST_FIELD:
-        _cln_eval_set_field(lhs, env, self);
+        _cln_eval_set_field(lhs, env, self, symtable);
         break;
     default:
         cln_panic("CelineError: syntax error: %d\n", lhs->akind);
@@ -258,91 +546,272 @@ static void _cln_eval_assign(Ast *ast, Env *env, int local, Symtable *symtable){
     }
 }
 
-// -*- void _cln_eval_statement()
-static void _cln_eval_statement(Ast *ast, Env *env, Symtable *symtable){
-    Object *self;
-    Object *cond;
+// -*---------------------------------------------------------------*-
+// -*- Counted loops                                               -*-
+// -*---------------------------------------------------------------*-
+// -*- while(i < n){ ...; i = i + c; } where the last statement is the only
+// -*- one assigning `i`, and nothing assigns `n`, runs on a native counter.
+// -*- `i` is only stored back each iteration when something could observe
+// -*- it: the body reads it, or it is not a private local of the frame.
+
+// -*- same variable, binding included
+static bool _cln_same_var(Ast *ast, Ast *var){
+    return ast->obj == var->obj && ast->aux == var->aux;
+}
+
+// -*- i + c, c + i, i - c
+static bool _cln_loop_step(Ast *ast, Ast *counter, long *step){
+    Ast *lhs = cln_ast_node(ast);
+    Ast *rhs = lhs ? cln_ast_next(lhs) : NULL;
+    switch(ast->akind){
+    case AST_ADD:
+        if(rhs->akind == AST_IDENT && lhs->akind == AST_INTEGER){
+            Ast *swap = lhs;
+            lhs = rhs;
+            rhs = swap;
+        }
+        // fall through
+    case AST_SUB:
+        if(lhs->akind != AST_IDENT || !_cln_same_var(lhs, counter) || rhs->akind != AST_INTEGER){
+            return false;
+        }
+        *step = ast->akind == AST_ADD ? cln_as_integer(rhs->obj) : -cln_as_integer(rhs->obj);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// -*- false when the statements may change `counter` or `limit` other
+// -*- than through `step`
+static bool _cln_loop_scan(Ast *ast, Ast *counter, Ast *limit, Ast *step, uint32_t *flags){
+    for(; ast; ast = cln_ast_next(ast)){
+        if(ast == step){
+            continue;
+        }
+        switch(ast->akind){
+        case AST_ASSIGN:
+        case AST_LOCAL:
+            if(cln_ast_node(ast)->akind == AST_IDENT &&
+                    (_cln_same_var(cln_ast_node(ast), counter) || (limit && _cln_same_var(cln_ast_node(ast), limit)))){
+                return false;
+            }
+            break;
+        case AST_DEF:
+        case AST_IMPORT:
+        case AST_LOAD:
+            return false;
+        case AST_CALL:
+        case AST_MCALL:
+        case AST_NEW:
+            *flags |= CLN_LOOP_CALLS;
+            break;
+        case AST_IDENT:
+        case AST_INDEX:
+        case AST_FIELD:
+            if(_cln_same_var(ast, counter)){
+                *flags |= CLN_LOOP_READS;
+            }
+            break;
+        default:
+            break;
+        }
+        if(!_cln_loop_scan(cln_ast_node(ast), counter, limit, step, flags)){
+            return false;
+        }
+    }
+    return true;
+}
+
+// -*- CLN_LOOP_* of a WHILE node
+static uint32_t _cln_loop_analyse(Ast *ast){
+    Ast *cond = cln_ast_node(ast);
+    Ast *body = cln_ast_next(cond);
+    long step;
+    if(cond->akind != AST_LT && cond->akind != AST_LE && cond->akind != AST_GT && cond->akind != AST_GE){
+        return CLN_LOOP_GENERIC;
+    }
+    Ast *counter = cln_ast_node(cond);
+    Ast *limit = cln_ast_next(counter);
+    if(counter->akind != AST_IDENT || !(limit->akind == AST_INTEGER ||
+            (limit->akind == AST_IDENT && !_cln_same_var(limit, counter)))){
+        return CLN_LOOP_GENERIC;
+    }
+    if(body->akind != AST_EMPTY || !body->node){
+        return CLN_LOOP_GENERIC;
+    }
+    Ast *last = body + body->last;
+    if(last->akind != AST_ASSIGN || !_cln_same_var(cln_ast_node(last), counter) ||
+            !_cln_loop_step(cln_ast_next(cln_ast_node(last)), counter, &step)){
+        return CLN_LOOP_GENERIC;
+    }
+    uint32_t flags = CLN_LOOP_COUNTED;
+    if(!_cln_loop_scan(cln_ast_node(body), counter, limit->akind == AST_IDENT ? limit : NULL, last, &flags)){
+        return CLN_LOOP_GENERIC;
+    }
+    return flags;
+}
+
+// -*- a literal, or a local no other frame nor function can see
+static bool _cln_loop_private(Ast *var, Env *env){
+    return var->akind == AST_INTEGER ||
+        (var->aux != CLN_BIND_GLOBAL && CLN_BIND_DEPTH(var->aux) == 0 && !(env->gcflags & CLN_GC_CAPTURED));
+}
+
+// -*- bool _cln_eval_while()
+static bool _cln_eval_while(Ast *ast, Env *env, Symtable *symtable){
+    if(!ast->aux){
+        ast->aux = _cln_loop_analyse(ast);
+    }
+    Ast *cond = cln_ast_node(ast);
+    Ast *body = cln_ast_next(cond);
+    if(ast->aux & CLN_LOOP_COUNTED){
+        Ast *counter = cln_ast_node(cond);
+        Ast *limit = cln_ast_next(counter);
+        Ast *last = body + body->last;
+        Value *slot = _cln_lookup(counter, env);
+        Value bound = limit->akind == AST_INTEGER ? limit->obj : *_cln_lookup(limit, env);
+        bool isolated = _cln_loop_private(counter, env) && _cln_loop_private(limit, env);
+        if(cln_is_integer(*slot) && cln_is_integer(bound) && (isolated || !(ast->aux & CLN_LOOP_CALLS))){
+            bool eager = (ast->aux & CLN_LOOP_READS) || !_cln_loop_private(counter, env);
+            long i = cln_as_integer(*slot);
+            long n = cln_as_integer(bound);
+            long step;
+            _cln_loop_step(cln_ast_next(cln_ast_node(last)), counter, &step);
+            for(;;){
+                switch(cond->akind){
+                case AST_LT:
+                    if(!(i < n)){ goto done; }
+                    break;
+                case AST_LE:
+                    if(!(i <= n)){ goto done; }
+                    break;
+                case AST_GT:
+                    if(!(i > n)){ goto done; }
+                    break;
+                default:
+                    if(!(i >= n)){ goto done; }
+                    break;
+                }
+                if(eager){
+                    *slot = cln_new_integer(i);
+                }
+                for(Ast *node = cln_ast_node(body); node != last; node = cln_ast_next(node)){
+                    cln_gc_safepoint();
+                    if(_cln_eval_statement(node, env, symtable)){
+                        return true;
+                    }
+                }
+                i += step;
+            }
+        done:
+            *slot = cln_new_integer(i);
+            return false;
+        }
+    }
+    while(cln_is_true(_cln_eval_expr(cond, env, symtable))){
+        if(_cln_eval_statement(body, env, symtable)){
+            return true;
+        }
+    }
+    return false;
+}
+
+// -*- bool _cln_eval_statement(): true once a `return` has been executed
+static bool _cln_eval_statement(Ast *ast, Env *env, Symtable *symtable){
+    Value self;
+    Value cond;
     char *repr;
-    int* fargs;
-    int argc;
-    Ast *args;
 
     switch(ast->akind){
     case AST_ASSIGN:
     case AST_LOCAL:
-        _cln_eval_assign(ast, env, ast->akind==AST_LOCAL, symtable);
+        _cln_eval_assign(ast, env, symtable);
         break;
     case AST_WHILE:
-        while(_cln_eval_expr(ast->node, env, symtable)->val.integer){
-            _cln_eval_statement(ast->node->next, env, symtable);
-        }
-        break;
+        return _cln_eval_while(ast, env, symtable);
     case AST_IF:
-        cond = _cln_eval_expr(ast->node, env, symtable);
-        if(cond->val.integer){
-            _cln_eval_statement(ast->node->next, env, symtable);
-        }else if(ast->node->next->next){
-            _cln_eval_statement(ast->node->next->next, env, symtable);
+        cond = _cln_eval_expr(cln_ast_node(ast), env, symtable);
+        if(cln_is_true(cond)){
+            return _cln_eval_statement(cln_ast_next(cln_ast_node(ast)), env, symtable);
+        }else if(cln_ast_next(cln_ast_next(cln_ast_node(ast)))){
+            return _cln_eval_statement(cln_ast_next(cln_ast_next(cln_ast_node(ast))), env, symtable);
         }
         break;
     case AST_PRINT:
-        self = _cln_eval_expr(ast->node, env, symtable);
+        self = _cln_eval_expr(cln_ast_node(ast), env, symtable);
         repr = cln_toString(self);
         printf("\n%s\n", repr);
         cln_dealloc(repr);
         break;
     case AST_RETURN:
-        cln_env_put(env, CLN_RETURN_ID, _cln_eval_expr(ast->node, env, symtable));
-        break;
+        if(env != clnGlobals && (cln_ast_node(ast)->akind == AST_CALL || cln_ast_node(ast)->akind == AST_MCALL)){
+            _cln_eval_tail_call(cln_ast_node(ast), env, symtable);
+            return true;
+        }
+        env->slots[CLN_RETURN_ID] = _cln_eval_expr(cln_ast_node(ast), env, symtable);
+        return true;
     case AST_DEF:
-        cln_env_put(env, ast->obj->val.integer, _cln_eval_def(ast));
+        self = _cln_eval_def(ast, env, symtable);
+        if(ast->obj){
+            *_cln_lookup(ast, env) = self;
+        }
         break;
     case AST_CALL:
-        _cln_eval_call(
-            env, cln_env_get(env, ast->obj->val.integer),
-            ast->node, NULL, symtable
-        );
-        break;
     case AST_MCALL:
-        _cln_eval_call(
-            env, _cln_eval_get_field(ast->node, env),
-            ast->node->next, ast->node->obj, symtable
-        );
+        _cln_eval_expr(ast, env, symtable);
         break;
     case AST_EMPTY:
-        cln_eval(ast->node, env, symtable);
-        break;
+        return _cln_eval_block(cln_ast_node(ast), env, symtable);
     case AST_IMPORT:{
-            Object *filename = ast->obj;
+            Value filename = ast->obj;
             cln_checktype(filename, TY_STRING);
-            Ast* module = cln_module_import(
-                filename->val.cstr, symtable
-            );
-            cln_eval(module, env, symtable);
+            const char *name = cln_as_object(filename)->val.cstr;
+            if(clnOptions.lazyImports && cln_module_import_lazy(name, symtable, clnGlobals)){
+                break;
+            }
+            Ast* module = cln_module_import(name, symtable);
+            cln_globals_reserve(clnGlobals, symtable->len);
+            cln_eval(module, clnGlobals, symtable);
         }//
         break;
     case AST_LOAD:{
-            Object *self = ast->obj;
+            Value self = ast->obj;
             cln_checktype(self, TY_STRING);
-            cln_module_load(self->val.cstr, symtable, env);
+            cln_module_load(cln_as_object(self)->val.cstr, symtable, clnGlobals);
         }//
         break;
     default:
         fprintf(stderr, "CelineError: syntax error: %s\n", clnAstKindNames[ast->akind]);
         break;
     }
+    return false;
 }
 
 // -*-
-void cln_eval(Ast *ast, Env *env, Symtable *symtable){
-    for(Ast *node=ast; node; node = node->next){
-        _cln_eval_statement(node, env, symtable);
+static bool _cln_eval_block(Ast *ast, Env *env, Symtable *symtable){
+    for(Ast *node=ast; node; node = cln_ast_next(node)){
+        cln_gc_safepoint();
+        if(_cln_eval_statement(node, env, symtable)){
+            return true;
+        }
     }
+    return false;
+}
+
+// -*- `env` holds the globals
+void cln_eval(Ast *ast, Env *env, Symtable *symtable){
+    clnGlobals = env;
+    clnSymtable = symtable;
+    _cln_eval_block(ast, env, symtable);
 }
 
 // -*-
 static char* _extract_folder(const char *path){
     const char *lastSlash = strrchr(path, '/');
+    if(!lastSlash){
+        return strdup("./");
+    }
     char* result = (char*)cln_alloc(sizeof(char)*(strlen(path)+1));
     const char* ptr = path;
     char* cursor = result;
@@ -354,26 +823,146 @@ static char* _extract_folder(const char *path){
     return result;
 }
 
+// -*-
+static void _cln_usage(const char *prog){
+    printf(
+        "usage: %s [options] filename\n"
+        "       %s --compile [options] filename...\n"
+        "  --compile      only write the .clnc cache of each file\n"
+        "  --no-cache     neither read nor write .clnc caches\n"
+        "  --ast          evaluate the syntax tree instead of compiling to bytecode\n"
+        "  --dump-code    disassemble the compiled bytecode\n"
+        "  --verbose      print the module directory, symbol table and syntax tree\n"
+        "  --gc-stats     print garbage collector and allocator statistics on exit\n"
+        "  --module-stats print module registry statistics on exit\n"
+        "  --lazy-imports parse an imported def when its name is first read\n"
+        "  --parse-jobs=N threads parsing the imports ahead, 1 to parse each on import\n"
+        "  --no-opt       do not optimize the syntax tree\n"
+        "  --dump-ast     print the syntax tree after optimization\n"
+        "  --jit=MODE     off, on, or threshold=N calls before the tree walker compiles a function\n",
+        prog, prog
+    );
+}
+
+// -*- --jit=off|on|threshold=N
+static void _cln_jit_option(const char *prog, const char *mode){
+    char *end;
+    if(strcmp(mode, "off")==0){
+        clnOptions.jitThreshold = 0;
+    }else if(strcmp(mode, "on")==0){
+        clnOptions.jitThreshold = CLN_JIT_THRESHOLD;
+    }else if(strncmp(mode, "threshold=", 10)==0){
+        long calls = strtol(mode + 10, &end, 10);
+        if(end == mode + 10 || *end || calls < 1 || calls > UINT32_MAX){
+            _cln_usage(prog);
+            cln_panic("CelineError: invalid jit threshold: %s\n", mode + 10);
+        }
+        clnOptions.jitThreshold = (uint32_t)calls;
+    }else{
+        _cln_usage(prog);
+        cln_panic("CelineError: unknown jit mode: %s\n", mode);
+    }
+}
+
+// -*- --parse-jobs=N
+static void _cln_parse_jobs_option(const char *prog, const char *jobs){
+    char *end;
+    long n = strtol(jobs, &end, 10);
+    if(end == jobs || *end || n < 1 || n > CLN_MAX_PARSE_JOBS){
+        _cln_usage(prog);
+        cln_panic("CelineError: invalid number of parse jobs: %s\n", jobs);
+    }
+    clnOptions.parseJobs = (uint32_t)n;
+}
+
 // -*---------------------------*-
 // -*-  M A I N   D R I V E R  -*-
 // -*---------------------------*-
 int main(int argc, char **argv){
-    if(argc < 2){
-        printf("usgae: %s filename\n", argv[0]);
+    const char *filename = NULL;
+    bool compile = false;
+    for(int i=1; i < argc; ++i){
+        if(strcmp(argv[i], "--compile")==0){
+            compile = true;
+        }else if(strcmp(argv[i], "--no-cache")==0){
+            clnOptions.noCache = true;
+        }else if(strcmp(argv[i], "--ast")==0){
+            clnOptions.treeWalker = true;
+        }else if(strcmp(argv[i], "--dump-code")==0){
+            clnOptions.dumpCode = true;
+        }else if(strcmp(argv[i], "--verbose")==0){
+            clnOptions.verbose = true;
+        }else if(strcmp(argv[i], "--gc-stats")==0){
+            clnOptions.gcStats = true;
+        }else if(strcmp(argv[i], "--module-stats")==0){
+            clnOptions.moduleStats = true;
+        }else if(strcmp(argv[i], "--lazy-imports")==0){
+            clnOptions.lazyImports = true;
+        }else if(strncmp(argv[i], "--parse-jobs=", 13)==0){
+            _cln_parse_jobs_option(argv[0], argv[i] + 13);
+        }else if(strcmp(argv[i], "--no-opt")==0){
+            clnOptions.noOptimize = true;
+        }else if(strcmp(argv[i], "--dump-ast")==0){
+            clnOptions.dumpAst = true;
+        }else if(strncmp(argv[i], "--jit=", 6)==0){
+            _cln_jit_option(argv[0], argv[i] + 6);
+        }else if(argv[i][0]=='-' && argv[i][1]=='-'){
+            _cln_usage(argv[0]);
+            cln_panic("CelineError: unknown option: %s\n", argv[i]);
+        }else{
+            filename = argv[i];
+        }
+    }
+    if(!filename){
+        _cln_usage(argv[0]);
         cln_panic("CelineError: input file missing\n");
     }
+    if(compile){
+        for(int i=1; i < argc; ++i){
+            if(argv[i][0]!='-' || argv[i][1]!='-'){
+                cln_cache_compile(argv[i]);
+            }
+        }
+        return 0;
+    }
 
-    char *moduledir = _extract_folder(argv[1]);
-    printf("module directory of '%s': %s\n", argv[1], moduledir);
+    char *moduledir = _extract_folder(filename);
+    if(clnOptions.verbose){
+        printf("module directory of '%s': %s\n", filename, moduledir);
+    }
     cln_module_addpath(moduledir);
     cln_dealloc(moduledir);
     cln_module_addpath("./");
     Symtable *symtable = cln_new_symtable();
-    Ast *ast = cln_parse(argv[1], symtable);
-    cln_dump(ast);
-    Env *env = cln_new_env();
-    cln_eval(ast, env, symtable);
+    Ast *ast = cln_parse_cached(filename, symtable);
+    if(clnOptions.verbose || clnOptions.dumpAst){
+        cln_dump(ast);
+    }
+    cln_module_prefetch(ast);
+    cln_resolve(ast, symtable, true);
+    if(!clnOptions.noOptimize){
+        cln_infer(ast, symtable, true);
+    }
+    Env *env = cln_new_globals(symtable->len);
+    cln_gc_push_env(env);
+    if(clnOptions.treeWalker){
+        cln_eval(ast, env, symtable);
+    }else{
+        Proto *proto = cln_compile(ast, symtable);
+        cln_ast_free(ast);
+        if(clnOptions.dumpCode){
+            cln_proto_dump(proto, symtable);
+        }
+        cln_vm_run(proto, env, symtable);
+    }
     printf("\n");
+    if(clnOptions.gcStats){
+        cln_gc_print_stats(stderr);
+        cln_slab_print_stats(stderr);
+    }
+    if(clnOptions.moduleStats){
+        cln_module_print_stats(stderr);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
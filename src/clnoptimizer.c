@@ -0,0 +1,267 @@
+#include<limits.h>
+
+#include "celine.h"
+
+// -*---------------------------------------------------------------*-
+// -*- Optimizer                                                   -*-
+// -*---------------------------------------------------------------*-
+// -*- Rewrites the tree in place, bottom up, before it is resolved.
+// -*- Only rewrites that keep the runtime behaviour are done: integer
+// -*- operators check their operand types, so identities only drop an
+// -*- operator whose other operand is known to be an integer, and a
+// -*- fold that would overflow or divide by zero is left to run.
+
+// -*- every operator of the language yields an integer
+static bool _cln_opt_is_integer(Ast *ast){
+    switch(ast->akind){
+    case AST_INTEGER:
+    case AST_ADD:
+    case AST_SUB:
+    case AST_MUL:
+    case AST_DIV:
+    case AST_AND:
+    case AST_OR:
+    case AST_NOT:
+    case AST_LT:
+    case AST_EQ:
+    case AST_GT:
+    case AST_LE:
+    case AST_GE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// -*- 0 or 1
+static bool _cln_opt_is_boolean(Ast *ast){
+    switch(ast->akind){
+    case AST_AND:
+    case AST_OR:
+    case AST_NOT:
+    case AST_LT:
+    case AST_EQ:
+    case AST_GT:
+    case AST_LE:
+    case AST_GE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// -*-
+static bool _cln_opt_is_literal(Ast *ast){
+    return ast->akind == AST_INTEGER || ast->akind == AST_FLOAT || ast->akind == AST_STRING;
+}
+
+// -*-
+static bool _cln_opt_is_const(Ast *ast, long num){
+    return ast->akind == AST_INTEGER && cln_as_integer(ast->obj) == num;
+}
+
+// -*-
+static void _cln_opt_set_integer(Ast *ast, long num){
+    ast->akind = AST_INTEGER;
+    ast->obj = cln_gc_permanent(cln_new_integer(num));
+    ast->node = 0;
+    ast->last = 0;
+}
+
+// -*- `ast` becomes `with`, one of its descendants, keeping its siblings
+static void _cln_opt_replace(Ast *ast, Ast *with){
+    Ast *node = cln_ast_node(with);
+    Ast *last = with->last ? with + with->last : NULL;
+    ast->akind = with->akind;
+    ast->obj = with->obj;
+    ast->aux = with->aux;
+    ast->node = node ? (int32_t)(node - ast) : 0;
+    ast->last = last ? (int32_t)(last - ast) : 0;
+}
+
+// -*- a statement doing nothing
+static void _cln_opt_remove(Ast *ast){
+    ast->akind = AST_EMPTY;
+    ast->obj = CLN_NONE;
+    ast->node = 0;
+    ast->last = 0;
+}
+
+// -*- `lhs op rhs` as the evaluator computes it, false when it traps
+static bool _cln_opt_fold(enum AstKind akind, long lhs, long rhs, long *result){
+    switch(akind){
+    case AST_ADD:
+        if((rhs > 0 && lhs > LONG_MAX - rhs) || (rhs < 0 && lhs < LONG_MIN - rhs)){
+            return false;
+        }
+        *result = lhs + rhs;
+        return true;
+    case AST_SUB:
+        if((rhs < 0 && lhs > LONG_MAX + rhs) || (rhs > 0 && lhs < LONG_MIN + rhs)){
+            return false;
+        }
+        *result = lhs - rhs;
+        return true;
+    case AST_MUL:
+        if(lhs && rhs){
+            if((lhs == -1 && rhs == LONG_MIN) || (rhs == -1 && lhs == LONG_MIN)){
+                return false;
+            }
+            long num = (long)((unsigned long)lhs * (unsigned long)rhs);
+            if(num / rhs != lhs){
+                return false;
+            }
+            *result = num;
+        }else{
+            *result = 0;
+        }
+        return true;
+    case AST_DIV:
+        if(rhs == 0 || (lhs == LONG_MIN && rhs == -1)){
+            return false;
+        }
+        *result = lhs / rhs;
+        return true;
+    case AST_AND:
+        *result = lhs && rhs;
+        return true;
+    case AST_OR:
+        *result = lhs || rhs;
+        return true;
+    case AST_LT:
+        *result = lhs < rhs;
+        return true;
+    case AST_EQ:
+        *result = lhs == rhs;
+        return true;
+    case AST_GT:
+        *result = lhs > rhs;
+        return true;
+    case AST_LE:
+        *result = lhs <= rhs;
+        return true;
+    case AST_GE:
+        *result = lhs >= rhs;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// -*- x+0, 0+x, x-0, x*1, 1*x, x/1 -> x
+static Ast* _cln_opt_identity(Ast *ast, Ast *lhs, Ast *rhs){
+    switch(ast->akind){
+    case AST_ADD:
+        if(_cln_opt_is_const(rhs, 0) && _cln_opt_is_integer(lhs)){
+            return lhs;
+        }
+        if(_cln_opt_is_const(lhs, 0) && _cln_opt_is_integer(rhs)){
+            return rhs;
+        }
+        break;
+    case AST_MUL:
+        if(_cln_opt_is_const(rhs, 1) && _cln_opt_is_integer(lhs)){
+            return lhs;
+        }
+        if(_cln_opt_is_const(lhs, 1) && _cln_opt_is_integer(rhs)){
+            return rhs;
+        }
+        break;
+    case AST_SUB:
+        if(_cln_opt_is_const(rhs, 0) && _cln_opt_is_integer(lhs)){
+            return lhs;
+        }
+        break;
+    case AST_DIV:
+        if(_cln_opt_is_const(rhs, 1) && _cln_opt_is_integer(lhs)){
+            return lhs;
+        }
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+// -*- not (a < b) -> a >= b, ...
+static bool _cln_opt_negate(Ast *ast){
+    switch(ast->akind){
+    case AST_LT:
+        ast->akind = AST_GE;
+        return true;
+    case AST_GE:
+        ast->akind = AST_LT;
+        return true;
+    case AST_GT:
+        ast->akind = AST_LE;
+        return true;
+    case AST_LE:
+        ast->akind = AST_GT;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// -*-
+static void _cln_optimize(Ast *ast){
+    for(Ast *node = cln_ast_node(ast); node; node = cln_ast_next(node)){
+        _cln_optimize(node);
+    }
+    Ast *lhs = cln_ast_node(ast);
+    Ast *rhs = lhs ? cln_ast_next(lhs) : NULL;
+    Ast *with;
+    long num;
+    switch(ast->akind){
+    case AST_ADD:
+    case AST_SUB:
+    case AST_MUL:
+    case AST_DIV:
+    case AST_AND:
+    case AST_OR:
+    case AST_LT:
+    case AST_EQ:
+    case AST_GT:
+    case AST_LE:
+    case AST_GE:
+        if(lhs->akind == AST_INTEGER && rhs->akind == AST_INTEGER &&
+                _cln_opt_fold(ast->akind, cln_as_integer(lhs->obj), cln_as_integer(rhs->obj), &num)){
+            _cln_opt_set_integer(ast, num);
+        }else if((with = _cln_opt_identity(ast, lhs, rhs))){
+            _cln_opt_replace(ast, with);
+        }
+        break;
+    case AST_NOT:
+        if(lhs->akind == AST_INTEGER){
+            _cln_opt_set_integer(ast, !cln_as_integer(lhs->obj));
+        }else if(lhs->akind == AST_NOT && _cln_opt_is_boolean(cln_ast_node(lhs))){
+            _cln_opt_replace(ast, cln_ast_node(lhs));
+        }else if(_cln_opt_negate(lhs)){
+            _cln_opt_replace(ast, lhs);
+        }
+        break;
+    case AST_IF:
+        if(_cln_opt_is_literal(lhs)){
+            if(cln_is_true(lhs->obj)){
+                _cln_opt_replace(ast, rhs);
+            }else if(cln_ast_next(rhs)){
+                _cln_opt_replace(ast, cln_ast_next(rhs));
+            }else{
+                _cln_opt_remove(ast);
+            }
+        }
+        break;
+    case AST_WHILE:
+        if(_cln_opt_is_literal(lhs) && !cln_is_true(lhs->obj)){
+            _cln_opt_remove(ast);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// -*-
+void cln_optimize(Ast *root){
+    _cln_optimize(root);
+}
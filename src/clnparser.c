@@ -6,17 +6,17 @@ typedef struct {
     Lexer *lexer;
     Token currentToken;
     Token nextToken;
+    AstArena arena;             // nodes are referred to by index until the tree is done
+    bool detached;              // see cln_parse_detached()
 } Parser;
 
 // fail_with_unexpected_token()
 static void _cln_fail_with_unexpected_token(Parser *parser, int got, int needed){
-    fprintf(
-        stderr,
+    cln_panic(
         "CelineError: unexpected token at line %s:%d: \"%s\", needed \"%s\"\n",
         parser->filename, parser->currentToken.lineno,
         clnTokenNames[got], clnTokenNames[needed]
     );
-    exit(EXIT_FAILURE);
 }
 
 // fail_with_parsing_error()
@@ -32,63 +32,218 @@ static void _cln_advance(Parser *parser){
     }
 }
 
+// -*- a constant of a detached tree, outside of the collector's heap
+static Value _cln_detached_constant(enum Type type){
+    Object *self = (Object*)cln_alloc(sizeof(Object));
+    self->type = type;
+    return cln_object_value(self);
+}
+
+// -*- the constant a token stands for, only made once the token is part
+// -*- of the tree
+static Value _cln_token_value(Parser *parser, const Token *token){
+    Value self;
+    switch(token->tkind){
+    case TOK_IDENT:
+        return cln_new_integer(token->val.symbol);
+    case TOK_INTEGER:
+        if(!parser->detached){
+            return cln_gc_permanent(cln_new_integer(token->val.integer));
+        }
+        if(token->val.integer >= CLN_INTEGER_MIN && token->val.integer <= CLN_INTEGER_MAX){
+            return cln_new_integer(token->val.integer);
+        }
+        self = _cln_detached_constant(TY_INTEGER);
+        cln_as_object(self)->val.integer = token->val.integer;
+        return self;
+    case TOK_FLOAT:
+        return cln_new_float(token->val.real);
+    case TOK_STRING:
+    case TOK_FIELD:
+        if(!parser->detached){
+            return cln_gc_permanent(cln_object_value(
+                cln_new_string(cln_lexer_token_cstr(parser->lexer, token))
+            ));
+        }
+        self = _cln_detached_constant(TY_STRING);
+        cln_as_object(self)->val.cstr = cln_lexer_token_cstr(parser->lexer, token);
+        return self;
+    default:
+        return CLN_NIL;
+    }
+}
+
 // match()
-static Object* _cln_match(Parser *parser, int expectToken){
+static Value _cln_match(Parser *parser, int expectToken){
     if(parser->currentToken.tkind != expectToken){
         _cln_fail_with_unexpected_token(
             parser, parser->currentToken.tkind, expectToken
         );
     }
-    Object *obj = parser->currentToken.obj;
+    Value obj = _cln_token_value(parser, &parser->currentToken);
     _cln_advance(parser);
     return obj;
 }
 // 
 
 // -*-
-static Ast* _cln_parse_program(Parser *parser);
-static Ast* _cln_parse_oplist(Parser *parser);
-static Ast* _cln_parse_block(Parser *parser);
-static Ast* _cln_parse_condition(Parser *parser);
-static Ast* _cln_parse_logical_expr(Parser *parser);
-static Ast* _cln_parse_op(Parser *parser);
-
-static Ast* _cln_parse_array_indexing(Parser *parser);
-static Ast* _cln_parse_field(Parser *parser);
-
-static Ast* _cln_parse_assign(Parser *parser);
-static Ast* _cln_parse_while(Parser *parser);
-static Ast* _cln_parse_if(Parser *parser);
-static Ast* _cln_parse_call(Parser *parser);
-
-static Ast* _cln_parse_arglist(Parser *parser);
-static Ast* _cln_parse_expr(Parser *parser);
-static Ast* _cln_parse_arith_expr(Parser *parser);
-static Ast* _cln_parse_term(Parser *parser);
-static Ast* _cln_parse_value(Parser *parser);
-static Ast* _cln_parse_print(Parser *parser);
-static Ast* _cln_parse_def(Parser *parser);
-static Ast* _cln_parse_return(Parser *parser);
-static Ast* _cln_parse_import(Parser *parser);
-static Ast* _cln_parse_load(Parser *parser);
-
-static Ast* _cln_parse_array(Parser *parser);
-static Ast* _cln_parse_object(Parser *parser);
+static uint32_t _cln_parse_program(Parser *parser);
+static uint32_t _cln_parse_oplist(Parser *parser);
+static uint32_t _cln_parse_block(Parser *parser);
+static uint32_t _cln_parse_condition(Parser *parser);
+static uint32_t _cln_parse_logical_expr(Parser *parser);
+static uint32_t _cln_parse_op(Parser *parser);
+
+static uint32_t _cln_parse_array_indexing(Parser *parser);
+
+static uint32_t _cln_parse_assign(Parser *parser);
+static uint32_t _cln_parse_while(Parser *parser);
+static uint32_t _cln_parse_if(Parser *parser);
+static uint32_t _cln_parse_call(Parser *parser);
+
+static uint32_t _cln_parse_arglist(Parser *parser);
+static uint32_t _cln_parse_expr(Parser *parser);
+static uint32_t _cln_parse_arith_expr(Parser *parser);
+static uint32_t _cln_parse_term(Parser *parser);
+static uint32_t _cln_parse_value(Parser *parser);
+static uint32_t _cln_parse_print(Parser *parser);
+static uint32_t _cln_parse_def(Parser *parser);
+static uint32_t _cln_parse_return(Parser *parser);
+static uint32_t _cln_parse_import(Parser *parser);
+static uint32_t _cln_parse_load(Parser *parser);
+
+static uint32_t _cln_parse_array(Parser *parser);
+static uint32_t _cln_parse_object(Parser *parser);
 
 
 // -*-
-Ast* cln_parse(const char* filename, Symtable *symtable){
+static Ast* _cln_parse_file(const char* filename, Symtable *symtable, bool detached){
     Parser parser;
     parser.filename = filename;
+    parser.detached = detached;
     parser.lexer = (Lexer*)cln_alloc(sizeof(Lexer));
     cln_lexer_init(parser.lexer, filename, symtable);
-    Ast *ast = _cln_parse_program(&parser);
-    printf("Symbol ID table: \n");
-    for(int i=0; i < symtable->len; ++i){
-        printf("%d = %s\n", i, symtable->symbols[i]);
+    cln_ast_arena_init(&parser.arena);
+    _cln_parse_program(&parser);
+    cln_lexer_destroy(parser.lexer);
+    cln_dealloc(parser.lexer);
+    return cln_ast_arena_finish(&parser.arena);
+}
+
+// -*-
+Ast* cln_parse(const char* filename, Symtable *symtable){
+    Ast *root = _cln_parse_file(filename, symtable, false);
+    if(clnOptions.verbose){
+        printf("Symbol ID table: \n");
+        for(int i=0; i < symtable->len; ++i){
+            printf("%d = %s\n", i, symtable->symbols[i]);
+        }
+    }
+    return root;
+}
+
+// -*- touches nothing but `own`, the tree and the source: safe on any thread
+Ast* cln_parse_detached(const char *filename, Symtable *own){
+    return _cln_parse_file(filename, own, true);
+}
+
+// -*-
+static void _cln_attach(Ast *ast, const uint32_t *ids){
+    for(Ast *node = ast; node; node = cln_ast_next(node)){
+        Value obj = node->obj;
+        if(cln_is_object(obj)){
+            Object *constant = cln_as_object(obj);
+            node->obj = cln_gc_permanent(
+                constant->type == TY_INTEGER ?
+                cln_new_integer(constant->val.integer) :
+                cln_object_value(cln_new_string(constant->val.cstr))
+            );
+            cln_dealloc(constant);
+        }else if(cln_is_integer(obj) && node->akind != AST_INTEGER){
+            node->obj = cln_new_integer(ids[cln_as_integer(obj)]);
+        }
+        _cln_attach(cln_ast_node(node), ids);
     }
+}
+
+// -*- symbols are interned in the order the lexer met them, so the ids
+// -*- are those cln_parse() would have given
+void cln_ast_attach(Ast *root, Symtable *own, Symtable *symtable){
+    uint32_t *ids = (uint32_t*)cln_alloc(sizeof(uint32_t)*own->len);
+    for(uint32_t id=0; id < own->len; ++id){
+        ids[id] = cln_get_symbol_index(symtable, own->symbols[id]);
+    }
+    _cln_attach(root, ids);
+    cln_dealloc(ids);
+}
+
+// -*- the named defs of a module made of nothing else, found without
+// -*- building their tree; false when any other statement is at the top
+// -*- level or a body is not closed
+bool cln_parse_defs(const char *filename, Symtable *symtable, ModuleDef **defs, uint32_t *ndef){
+    Lexer lexer;
+    uint32_t len = 0;
+    uint32_t cap = 0;
+    ModuleDef *found = NULL;
+    bool onlyDefs = true;
+    cln_lexer_init(&lexer, filename, symtable);
+    Token token = cln_lexer_nexttoken(&lexer);
+    while(token.tkind != TOK_EOF){
+        Token name = cln_lexer_nexttoken(&lexer);
+        if(token.tkind != TOK_DEF || name.tkind != TOK_IDENT){
+            onlyDefs = false;
+            break;
+        }
+        if(len == cap){
+            cap = cap ? 2*cap : 16;
+            found = (ModuleDef*)realloc(found, sizeof(ModuleDef)*cap);
+            if(!found){
+                cln_panic("CelineError: memory allocation failure\n");
+            }
+        }
+        found[len++] = (ModuleDef){name.val.symbol, token.offset, token.lineno};
+        // - the parameters, then the body up to its closing brace
+        uint32_t depth = 0;
+        do{
+            token = cln_lexer_nexttoken(&lexer);
+            if(token.tkind == TOK_LBRACE){
+                ++depth;
+            }else if(token.tkind == TOK_RBRACE && depth){
+                --depth;
+            }
+        }while(token.tkind != TOK_EOF && (depth || token.tkind != TOK_RBRACE));
+        if(token.tkind == TOK_EOF){
+            onlyDefs = false;
+            break;
+        }
+        token = cln_lexer_nexttoken(&lexer);
+    }
+    cln_lexer_destroy(&lexer);
+    if(!onlyDefs){
+        free(found);
+        return false;
+    }
+    *defs = found;
+    *ndef = len;
+    return true;
+}
+
+// -*- the program made of the single def statement cln_parse_defs() found
+Ast* cln_parse_def(const char *filename, Symtable *symtable, const ModuleDef *def){
+    Parser parser;
+    parser.filename = filename;
+    parser.detached = false;
+    parser.lexer = (Lexer*)cln_alloc(sizeof(Lexer));
+    cln_lexer_init(parser.lexer, filename, symtable);
+    cln_lexer_seek(parser.lexer, def->offset, def->lineno);
+    cln_ast_arena_init(&parser.arena);
+    uint32_t root = cln_new_ast(&parser.arena, AST_EMPTY, CLN_NONE);
+    parser.nextToken = cln_lexer_nexttoken(parser.lexer);
+    _cln_advance(&parser);
+    cln_ast_add_node(&parser.arena, root, _cln_parse_def(&parser));
+    cln_lexer_destroy(parser.lexer);
     cln_dealloc(parser.lexer);
-    return ast;
+    return cln_ast_arena_finish(&parser.arena);
 }
 
 // -*-
@@ -97,27 +252,27 @@ expr | statement
 expr | statement
 ....
 */
-static Ast* _cln_parse_program(Parser *parser){
-    // parser->nextToken = cln_lexer_nexttoken(parser->lexer);
-    // _cln_advance(parser);
-    // return _cln_parse_oplist(parser);
-    return _cln_parse_op(parser);
+// -*- the top level block is the first node of the arena, the tree root
+static uint32_t _cln_parse_program(Parser *parser){
+    parser->nextToken = cln_lexer_nexttoken(parser->lexer);
+    _cln_advance(parser);
+    return _cln_parse_oplist(parser);
 }
 
 // -*-
-static Ast* _cln_parse_oplist(Parser *parser){
-    Ast *ast = cln_new_ast(AST_EMPTY, CLN_NONE);
-    while(parser->currentToken.tkind != TOK_RBRACE || parser->currentToken.tkind != TOK_EOF){ // XXX
-        Ast *node = _cln_parse_op(parser);
-        cln_ast_add_node(ast, node);
+static uint32_t _cln_parse_oplist(Parser *parser){
+    uint32_t ast = cln_new_ast(&parser->arena, AST_EMPTY, CLN_NONE);
+    while(parser->currentToken.tkind != TOK_RBRACE && parser->currentToken.tkind != TOK_EOF){
+        uint32_t node = _cln_parse_op(parser);
+        cln_ast_add_node(&parser->arena, ast, node);
     }
 
     return ast;
 }
 
 // -*-
-static Ast* _cln_parse_op(Parser *parser){
-    Ast *ast = NULL;
+static uint32_t _cln_parse_op(Parser *parser){
+    uint32_t ast = 0;
     switch(parser->currentToken.tkind){
     case TOK_LBRACE: // { ...
         return _cln_parse_block(parser);
@@ -162,41 +317,29 @@ static Ast* _cln_parse_op(Parser *parser){
 }
 
 // -*-
-static Ast* _cln_parse_block(Parser *parser){
+static uint32_t _cln_parse_block(Parser *parser){
     // { ... }
     _cln_match(parser, TOK_LBRACE);
-    Ast *ast = _cln_parse_oplist(parser);
+    uint32_t ast = _cln_parse_oplist(parser);
     _cln_match(parser, TOK_RBRACE);
     return ast;
 }
 
 // -*-
-static Ast* _cln_parse_array_indexing(Parser *parser){
-    Object *ident = _cln_match(parser, TOK_IDENT);
+static uint32_t _cln_parse_array_indexing(Parser *parser){
+    Value ident = _cln_match(parser, TOK_IDENT);
     _cln_match(parser, TOK_LSBRACKET); // [
-    Ast *index = _cln_parse_expr(parser);
+    uint32_t index = _cln_parse_expr(parser);
     _cln_match(parser, TOK_RSBRACKET);
     //! @todo : we should check that "index is integer object"
-    Ast *ast = cln_new_ast(AST_INDEX, ident);
-    cln_ast_add_node(ast, index);
-    return ast;
-}
-
-// -*- ident.ident === ident.field 
-static Ast* _cln_parse_field(Parser *parser){
-    Object *ident = _cln_match(parser, TOK_IDENT);
-    _cln_match(parser, TOK_DOT);
-    Object *field = _cln_match(parser, TOK_FIELD);
-    Ast *ast = cln_new_ast(AST_FIELD, ident);
-    //! @note: ORIGINAL :: cln_ast_add_node(ast, cln_new_ast(AST_CONSTANT, field));
-    //! @todo: cln_ast_add_node(ast, cln_new_ast(AST_SYMBOL, field));
-    cln_ast_add_node(ast, cln_new_ast(AST_IDENT, field));
+    uint32_t ast = cln_new_ast(&parser->arena, AST_INDEX, ident);
+    cln_ast_add_node(&parser->arena, ast, index);
     return ast;
 }
 
 // -*-
-static Ast* _cln_parse_assign(Parser *parser){
-    Ast *lhs = NULL;
+static uint32_t _cln_parse_assign(Parser *parser){
+    uint32_t lhs = 0;
     enum AstKind akind = AST_ASSIGN;
     if(parser->currentToken.tkind == TOK_LOCAL){ // local
         _cln_match(parser, TOK_LOCAL);
@@ -206,86 +349,89 @@ static Ast* _cln_parse_assign(Parser *parser){
     if(parser->nextToken.tkind == TOK_LSBRACKET){ // ident[
         lhs = _cln_parse_array_indexing(parser);
     }else if(parser->nextToken.tkind == TOK_DOT){ // ident.
-        lhs = _cln_parse_field(parser);
+        lhs = _cln_parse_value(parser);
+        if(parser->arena.nodes[lhs].akind == AST_MCALL){ // ident.field(...) as a statement
+            return lhs;
+        }
     }else{ // ident
-        Object *ident = _cln_match(parser, TOK_IDENT);
-        lhs = cln_new_ast(AST_IDENT, ident);
+        Value ident = _cln_match(parser, TOK_IDENT);
+        lhs = cln_new_ast(&parser->arena, AST_IDENT, ident);
     }
     // lhs =
     _cln_match(parser, TOK_ASSIGN);
     // [local] (ident\.?\[?idx\]?) = expr
-    Ast *expr = _cln_parse_expr(parser);
-    Ast *ast = cln_new_ast(akind, CLN_NONE);
-    cln_ast_add_node(ast, lhs);
-    cln_ast_add_node(ast, expr);
+    uint32_t expr = _cln_parse_expr(parser);
+    uint32_t ast = cln_new_ast(&parser->arena, akind, CLN_NONE);
+    cln_ast_add_node(&parser->arena, ast, lhs);
+    cln_ast_add_node(&parser->arena, ast, expr);
     return ast;
 }
 
 // -*- print '(' expr ')'
-static Ast* _cln_parse_print(Parser *parser){
+static uint32_t _cln_parse_print(Parser *parser){
     _cln_match(parser, TOK_PRINT);          // print
     _cln_match(parser, TOK_LPAREN);         // (
-    Ast *expr = _cln_parse_expr(parser);    // expr
+    uint32_t expr = _cln_parse_expr(parser);    // expr
     _cln_match(parser, TOK_RPAREN);         // )
-    Ast *ast = cln_new_ast(AST_PRINT, CLN_NONE);
-    ast->node = expr;
+    uint32_t ast = cln_new_ast(&parser->arena, AST_PRINT, CLN_NONE);
+    cln_ast_add_node(&parser->arena, ast, expr);
     return ast;
 }
 
 // -*- def name(arglist){...}
-static Ast* _cln_parse_def(Parser *parser){
+static uint32_t _cln_parse_def(Parser *parser){
     _cln_match(parser, TOK_DEF);
-    Object *name = NULL;
+    Value name = CLN_NONE;
     if(parser->currentToken.tkind == TOK_IDENT){
         name = _cln_match(parser, TOK_IDENT);
     }
     // name == NULL -> anonymous
     // name != NULL -> named function
-    Ast *fun = cln_new_ast(AST_DEF, name);      // fname
+    uint32_t fun = cln_new_ast(&parser->arena, AST_DEF, name);      // fname
     _cln_match(parser, TOK_LPAREN);             // (
-    Ast *arglist = _cln_parse_arglist(parser);  // args
+    uint32_t arglist = _cln_parse_arglist(parser);  // args
     _cln_match(parser, TOK_RPAREN);             // )
-    Ast *body = _cln_parse_block(parser);       // { body }
+    uint32_t body = _cln_parse_block(parser);       // { body }
 
-    cln_ast_add_node(fun, arglist);
-    cln_ast_add_node(fun, body);
+    cln_ast_add_node(&parser->arena, fun, arglist);
+    cln_ast_add_node(&parser->arena, fun, body);
     return fun;
 }
 
 // -*- while '(' cond ')' { body }
-static Ast* _cln_parse_while(Parser *parser){
+static uint32_t _cln_parse_while(Parser *parser){
     _cln_match(parser, TOK_WHILE);
-    Ast *ast = cln_new_ast(AST_WHILE, CLN_NONE);        // while
+    uint32_t ast = cln_new_ast(&parser->arena, AST_WHILE, CLN_NONE);        // while
     _cln_match(parser, TOK_LPAREN);                     // (
-    Ast *cond = _cln_parse_condition(parser);           // cond
+    uint32_t cond = _cln_parse_condition(parser);           // cond
     _cln_match(parser, TOK_RPAREN);                     // )
     //! @note: change from parse_op() to parse_block()
-    Ast* body = _cln_parse_block(parser);               // { body }
-    cln_ast_add_node(ast, cond);
-    cln_ast_add_node(ast, body);
+    uint32_t body = _cln_parse_block(parser);               // { body }
+    cln_ast_add_node(&parser->arena, ast, cond);
+    cln_ast_add_node(&parser->arena, ast, body);
 
     return ast; 
 }
 
 // -*- not expr
-static Ast* _cln_parse_condition(Parser *parser){
+static uint32_t _cln_parse_condition(Parser *parser){
     if(parser->currentToken.tkind == TOK_NOT){
-        Ast *cond = cln_new_ast(AST_NOT, CLN_NONE);
+        uint32_t cond = cln_new_ast(&parser->arena, AST_NOT, CLN_NONE);
         _cln_match(parser, TOK_NOT);
-        cln_ast_add_node(cond, _cln_parse_logical_expr(parser));
+        cln_ast_add_node(&parser->arena, cond, _cln_parse_logical_expr(parser));
         return cond;
     }else{ // lhs op rhs
-        Ast *lhs = _cln_parse_logical_expr(parser);
+        uint32_t lhs = _cln_parse_logical_expr(parser);
         enum TokenKind kind = parser->currentToken.tkind;
-        Ast *rhs;
+        uint32_t rhs;
         if(kind == TOK_AND || kind == TOK_OR){
             _cln_match(parser, kind);
             rhs = _cln_parse_condition(parser);
-            Ast *cond = cln_new_ast(
+            uint32_t cond = cln_new_ast(&parser->arena, 
                 kind == TOK_AND ? AST_AND : AST_OR, CLN_NONE
             );
-            cln_ast_add_node(cond, lhs);
-            cln_ast_add_node(cond, rhs);
+            cln_ast_add_node(&parser->arena, cond, lhs);
+            cln_ast_add_node(&parser->arena, cond, rhs);
             return cond;
         }
         return lhs;
@@ -293,75 +439,75 @@ static Ast* _cln_parse_condition(Parser *parser){
 }
 
 // -*- <, >, <=, >=, ==,
-static Ast* _cln_parse_logical_expr(Parser *parser){
-    Ast *val = _cln_parse_value(parser);
-    Ast *ast = NULL;
+static uint32_t _cln_parse_logical_expr(Parser *parser){
+    uint32_t val = _cln_parse_arith_expr(parser);
+    uint32_t ast = 0;
     switch(parser->currentToken.tkind){
     case TOK_LT:
-        ast = cln_new_ast(AST_LT, CLN_NONE);
+        ast = cln_new_ast(&parser->arena, AST_LT, CLN_NONE);
         break;
     case TOK_EQ:
-        ast = cln_new_ast(AST_EQ, CLN_NONE);
+        ast = cln_new_ast(&parser->arena, AST_EQ, CLN_NONE);
         break;
     case TOK_GT:
-        ast = cln_new_ast(AST_GT, CLN_NONE);
+        ast = cln_new_ast(&parser->arena, AST_GT, CLN_NONE);
         break;
     case TOK_LE:
-        ast = cln_new_ast(AST_LE, CLN_NONE);
+        ast = cln_new_ast(&parser->arena, AST_LE, CLN_NONE);
         break;
     case TOK_GE:
-        ast = cln_new_ast(AST_GE, CLN_NONE);
+        ast = cln_new_ast(&parser->arena, AST_GE, CLN_NONE);
         break;
     default:
         return val;
     }
 
     _cln_advance(parser);
-    Ast *rhs = _cln_parse_value(parser);
-    cln_ast_add_node(ast, val);
-    cln_ast_add_node(ast, rhs);
+    uint32_t rhs = _cln_parse_arith_expr(parser);
+    cln_ast_add_node(&parser->arena, ast, val);
+    cln_ast_add_node(&parser->arena, ast, rhs);
 
     return ast;
 }
 
 // -*- if (cond) {}
-static Ast* _cln_parse_if(Parser *parser){
+static uint32_t _cln_parse_if(Parser *parser){
     _cln_match(parser, TOK_IF);                     // if
-    Ast *ast = cln_new_ast(AST_IF, CLN_NONE);
+    uint32_t ast = cln_new_ast(&parser->arena, AST_IF, CLN_NONE);
     _cln_match(parser, TOK_LPAREN);                 // (
-    Ast *cond = _cln_parse_condition(parser);       // cond
+    uint32_t cond = _cln_parse_condition(parser);       // cond
     _cln_match(parser, TOK_RPAREN);                 // )
-    Ast *body = _cln_parse_block(parser);           // { body }
-    cln_ast_add_node(ast, cond);
-    cln_ast_add_node(ast, body);
+    uint32_t body = _cln_parse_block(parser);           // { body }
+    cln_ast_add_node(&parser->arena, ast, cond);
+    cln_ast_add_node(&parser->arena, ast, body);
     // - else{ body}
     if(parser->currentToken.tkind == TOK_ELSE){
         _cln_match(parser, TOK_ELSE);
-        Ast *alt = _cln_parse_block(parser);
-        cln_ast_add_node(ast, alt);
+        uint32_t alt = _cln_parse_block(parser);
+        cln_ast_add_node(&parser->arena, ast, alt);
     }
 
     return ast;
 }
 
 // -*- fname(args)
-static Ast* _cln_parse_call(Parser *parser){
-    Object *ident = _cln_match(parser, TOK_IDENT);  // fname
-    Ast *fun = cln_new_ast(AST_CALL, ident);
+static uint32_t _cln_parse_call(Parser *parser){
+    Value ident = _cln_match(parser, TOK_IDENT);  // fname
+    uint32_t fun = cln_new_ast(&parser->arena, AST_CALL, ident);
     _cln_match(parser, TOK_LPAREN);                 // (
-    Ast *args = _cln_parse_arglist(parser);          // args
+    uint32_t args = _cln_parse_arglist(parser);          // args
     _cln_match(parser, TOK_RPAREN);                 // )
-    cln_ast_add_node(fun, args);
+    cln_ast_add_node(&parser->arena, fun, args);
     return fun;
 }
 
 // -*-
-static Ast* _cln_parse_arglist(Parser *parser){
+static uint32_t _cln_parse_arglist(Parser *parser){
     // - arg1, arg2, ...
-    Ast *args = cln_new_ast(AST_EMPTY, CLN_NONE);
+    uint32_t args = cln_new_ast(&parser->arena, AST_EMPTY, CLN_NONE);
     while(parser->currentToken.tkind != TOK_RPAREN){
-        Ast *arg = _cln_parse_value(parser);
-        cln_ast_add_node(args, arg);
+        uint32_t arg = _cln_parse_expr(parser);
+        cln_ast_add_node(&parser->arena, args, arg);
         if(parser->currentToken.tkind != TOK_RPAREN){
             _cln_match(parser, TOK_COMMA);
         }
@@ -371,14 +517,14 @@ static Ast* _cln_parse_arglist(Parser *parser){
 }
 
 // -*-
-static Ast* _cln_parse_expr(Parser *parser){
+static uint32_t _cln_parse_expr(Parser *parser){
     switch(parser->currentToken.tkind){
     case TOK_READ_INT:
         _cln_match(parser, TOK_READ_INT);
-        return cln_new_ast(AST_READ_INT, CLN_NONE);
+        return cln_new_ast(&parser->arena, AST_READ_INT, CLN_NONE);
     case TOK_INPUT:
         _cln_match(parser, TOK_INPUT);
-        return cln_new_ast(AST_INPUT, CLN_NONE);
+        return cln_new_ast(&parser->arena, AST_INPUT, CLN_NONE);
     case TOK_ARRAY:
         return _cln_parse_array(parser);
     case TOK_OBJECT:
@@ -391,42 +537,42 @@ static Ast* _cln_parse_expr(Parser *parser){
     }
     // -*-
     cln_panic("CelineError: runtime error");
-    return NULL;
+    return 0;
 }
 
 // -*-
-static Ast* _cln_parse_arith_expr(Parser *parser){
-    Ast* term = _cln_parse_term(parser);
+static uint32_t _cln_parse_arith_expr(Parser *parser){
+    uint32_t term = _cln_parse_term(parser);
     if(parser->currentToken.tkind == TOK_PLUS){
         _cln_match(parser, TOK_PLUS);
-        Ast *expr = cln_new_ast(AST_ADD, CLN_NONE);
-        cln_ast_add_node(expr, term);
-        cln_ast_add_node(expr, _cln_parse_arith_expr(parser));
+        uint32_t expr = cln_new_ast(&parser->arena, AST_ADD, CLN_NONE);
+        cln_ast_add_node(&parser->arena, expr, term);
+        cln_ast_add_node(&parser->arena, expr, _cln_parse_arith_expr(parser));
         return expr;
     }else if(parser->currentToken.tkind == TOK_MINUS){
         _cln_match(parser, TOK_MINUS);
-        Ast *expr = cln_new_ast(AST_SUB, CLN_NONE);
-        cln_ast_add_node(expr, term);
-        cln_ast_add_node(expr, _cln_parse_arith_expr(parser));
+        uint32_t expr = cln_new_ast(&parser->arena, AST_SUB, CLN_NONE);
+        cln_ast_add_node(&parser->arena, expr, term);
+        cln_ast_add_node(&parser->arena, expr, _cln_parse_arith_expr(parser));
         return expr;
     }
     return term;
 }
 
 // -*-
-static Ast* _cln_parse_term(Parser *parser){
-    Ast *val = _cln_parse_value(parser);
+static uint32_t _cln_parse_term(Parser *parser){
+    uint32_t val = _cln_parse_value(parser);
     if(parser->currentToken.tkind == TOK_STAR){ // x * y
         _cln_match(parser, TOK_STAR);
-        Ast *expr = cln_new_ast(AST_MUL, CLN_NONE);
-        cln_ast_add_node(expr, val);
-        cln_ast_add_node(expr, _cln_parse_term(parser));
+        uint32_t expr = cln_new_ast(&parser->arena, AST_MUL, CLN_NONE);
+        cln_ast_add_node(&parser->arena, expr, val);
+        cln_ast_add_node(&parser->arena, expr, _cln_parse_term(parser));
         return expr;
     }else if(parser->currentToken.tkind == TOK_SLASH){ // x / y
         _cln_match(parser, TOK_SLASH);
-        Ast *expr = cln_new_ast(AST_DIV, CLN_NONE);
-        cln_ast_add_node(expr, val);
-        cln_ast_add_node(expr, _cln_parse_term(parser));
+        uint32_t expr = cln_new_ast(&parser->arena, AST_DIV, CLN_NONE);
+        cln_ast_add_node(&parser->arena, expr, val);
+        cln_ast_add_node(&parser->arena, expr, _cln_parse_term(parser));
         return expr;
     }
 
@@ -435,50 +581,51 @@ static Ast* _cln_parse_term(Parser *parser){
 
 // -*-
 //! @todo: change this parse_atom()
-static Ast* _cln_parse_value(Parser *parser){
-    Ast *ast;
+static uint32_t _cln_parse_value(Parser *parser){
+    uint32_t ast;
     bool isAtom = (
         parser->currentToken.tkind==TOK_INTEGER ||
         parser->currentToken.tkind==TOK_FLOAT ||
         parser->currentToken.tkind==TOK_STRING
     );
     if(isAtom){
-        if(parser->currentToken.tkind==TOK_INTEGER){
-            ast = cln_new_ast(AST_INTEGER, parser->currentToken.obj);
-        }else if(parser->currentToken.tkind==TOK_FLOAT){
-            ast = cln_new_ast(AST_FLOAT, parser->currentToken.obj);
+        enum TokenKind kind = parser->currentToken.tkind;
+        Value obj = _cln_match(parser, kind);
+        if(kind==TOK_INTEGER){
+            ast = cln_new_ast(&parser->arena, AST_INTEGER, obj);
+        }else if(kind==TOK_FLOAT){
+            ast = cln_new_ast(&parser->arena, AST_FLOAT, obj);
         }else{
-            ast = cln_new_ast(AST_STRING, parser->currentToken.obj);
+            ast = cln_new_ast(&parser->arena, AST_STRING, obj);
         }
-        _cln_match(parser, parser->currentToken.tkind);
     }else{
         if(parser->nextToken.tkind==TOK_LPAREN){
             return _cln_parse_call(parser);
         }
-        Object *ident = _cln_match(parser, TOK_IDENT);
+        Value ident = _cln_match(parser, TOK_IDENT);
         if(parser->currentToken.tkind==TOK_LSBRACKET){
             _cln_match(parser, TOK_LSBRACKET);
-            Ast* idxExpr = _cln_parse_expr(parser);
+            uint32_t idxExpr = _cln_parse_expr(parser);
             _cln_match(parser, TOK_RSBRACKET);
-            ast = cln_new_ast(AST_INDEX, ident);
-            cln_ast_add_node(ast, idxExpr);
+            ast = cln_new_ast(&parser->arena, AST_INDEX, ident);
+            cln_ast_add_node(&parser->arena, ast, idxExpr);
         }else if(parser->currentToken.tkind==TOK_DOT){
             _cln_match(parser, TOK_DOT);
-            Object *field = _cln_match(parser, TOK_FIELD);
+            Value field = _cln_match(parser, TOK_FIELD);
             if(parser->currentToken.tkind==TOK_LPAREN){
-                ast = cln_new_ast(AST_MCALL, CLN_NONE);
-                Ast *fieldIdent = cln_new_ast(AST_FIELD, ident);
-                cln_ast_add_node(fieldIdent, cln_new_ast(AST_IDENT, field));
-                cln_ast_add_node(ast, fieldIdent);
+                ast = cln_new_ast(&parser->arena, AST_MCALL, CLN_NONE);
+                uint32_t fieldIdent = cln_new_ast(&parser->arena, AST_FIELD, ident);
+                cln_ast_add_node(&parser->arena, fieldIdent, cln_new_ast(&parser->arena, AST_IDENT, field));
+                cln_ast_add_node(&parser->arena, ast, fieldIdent);
                 _cln_match(parser, TOK_LPAREN);
-                cln_ast_add_node(ast, _cln_parse_arglist(parser));
+                cln_ast_add_node(&parser->arena, ast, _cln_parse_arglist(parser));
                 _cln_match(parser, TOK_RPAREN);
             }else{
-                ast = cln_new_ast(AST_FIELD, ident);
-                cln_ast_add_node(ast, cln_new_ast(AST_IDENT, field));
+                ast = cln_new_ast(&parser->arena, AST_FIELD, ident);
+                cln_ast_add_node(&parser->arena, ast, cln_new_ast(&parser->arena, AST_IDENT, field));
             }
         }else{
-            ast = cln_new_ast(AST_IDENT, ident);
+            ast = cln_new_ast(&parser->arena, AST_IDENT, ident);
         }
     }
 
@@ -486,46 +633,46 @@ static Ast* _cln_parse_value(Parser *parser){
 }
 
 // -*-
-static Ast* _cln_parse_return(Parser *parser){
+static uint32_t _cln_parse_return(Parser *parser){
     _cln_match(parser, TOK_RETURN);
-    Ast *ast = cln_new_ast(AST_RETURN, CLN_NONE);
-    Ast *expr = _cln_parse_expr(parser);
-    cln_ast_add_node(ast, expr);
+    uint32_t ast = cln_new_ast(&parser->arena, AST_RETURN, CLN_NONE);
+    uint32_t expr = _cln_parse_expr(parser);
+    cln_ast_add_node(&parser->arena, ast, expr);
     return ast;
 }
 
 // -*- array[3]
-static Ast* _cln_parse_array(Parser *parser){
+static uint32_t _cln_parse_array(Parser *parser){
     _cln_match(parser, TOK_ARRAY);
     _cln_match(parser, TOK_LSBRACKET);
-    Ast *len = _cln_parse_expr(parser);
+    uint32_t len = _cln_parse_expr(parser);
     _cln_match(parser, TOK_RSBRACKET);
-    Ast *ast = cln_new_ast(AST_ARRAY, CLN_NONE);
-    cln_ast_add_node(ast, len);
+    uint32_t ast = cln_new_ast(&parser->arena, AST_ARRAY, CLN_NONE);
+    cln_ast_add_node(&parser->arena, ast, len);
     return ast;
 }
 
 // -*-
-static Ast* _cln_parse_object(Parser *parser){
+static uint32_t _cln_parse_object(Parser *parser){
     if(parser->currentToken.tkind==TOK_OBJECT){
         _cln_match(parser, TOK_OBJECT);
-        return cln_new_ast(AST_OBJECT, CLN_NONE);
+        return cln_new_ast(&parser->arena, AST_OBJECT, CLN_NONE);
     }
     _cln_match(parser, TOK_NEW);
-    Ast *ctor = _cln_parse_call(parser);
-    Ast *ast = cln_new_ast(AST_NEW, CLN_NONE);
-    cln_ast_add_node(ast, ctor);
+    uint32_t ctor = _cln_parse_call(parser);
+    uint32_t ast = cln_new_ast(&parser->arena, AST_NEW, CLN_NONE);
+    cln_ast_add_node(&parser->arena, ast, ctor);
     return ast;
 }
 
 // -*-
-static Ast* _cln_parse_import(Parser *parser){
+static uint32_t _cln_parse_import(Parser *parser){
     _cln_match(parser, TOK_IMPORT);
-    return cln_new_ast(AST_IMPORT, _cln_match(parser, TOK_STRING));
+    return cln_new_ast(&parser->arena, AST_IMPORT, _cln_match(parser, TOK_STRING));
 }
 
 // -*-
-static Ast* _cln_parse_load(Parser *parser){
+static uint32_t _cln_parse_load(Parser *parser){
     _cln_match(parser, TOK_LOAD);
-    return cln_new_ast(AST_LOAD, _cln_match(parser, TOK_STRING));
+    return cln_new_ast(&parser->arena, AST_LOAD, _cln_match(parser, TOK_STRING));
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include<string.h>
+
+#include "celine.h"
+
+#define CLN_SCOPE_INITIAL_CAPACITY      16
+
+// -*---------------------------------------------------------------*-
+// -*- Scopes                                                      -*-
+// -*---------------------------------------------------------------*-
+// -*- A function body binds its parameters, its `local` names, the
+// -*- functions it defines and every name it assigns that no enclosing
+// -*- function nor the top level binds. The top level binds globals.
+typedef struct scope{
+    struct scope *parent;       // enclosing function
+    uint32_t *symbols;          // symbol id held by each frame slot
+    uint32_t nslot;
+    uint32_t slotcap;
+    bool captured;              // a nested function reaches into the frame
+} Scope;
+
+typedef struct{
+    Symtable *symtable;
+    Scope *scope;               // innermost function, NULL at the top level
+    bool *globals;              // symbol ids bound at the top level
+    bool strict;
+} Resolver;
+
+// -*-
+static int _cln_scope_find(Scope *scope, uint32_t id){
+    for(uint32_t slot=0; slot < scope->nslot; ++slot){
+        if(scope->symbols[slot] == id){
+            return (int)slot;
+        }
+    }
+    return -1;
+}
+
+// -*-
+static uint32_t _cln_scope_declare(Scope *scope, uint32_t id){
+    int found = _cln_scope_find(scope, id);
+    if(found >= 0){
+        return (uint32_t)found;
+    }
+    if(scope->nslot == CLN_MAX_LOCALS){
+        cln_panic("CelineError: too many local variables, maximum is %d\n", CLN_MAX_LOCALS);
+    }
+    if(scope->nslot == scope->slotcap){
+        scope->slotcap = scope->slotcap ? 2*scope->slotcap : CLN_SCOPE_INITIAL_CAPACITY;
+        scope->symbols = (uint32_t*)realloc(scope->symbols, sizeof(uint32_t)*scope->slotcap);
+        if(!scope->symbols){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    scope->symbols[scope->nslot] = id;
+    return scope->nslot++;
+}
+
+// -*- bound by an enclosing function or the top level
+static bool _cln_is_visible(Resolver *resolver, uint32_t id){
+    for(Scope *scope = resolver->scope; scope; scope = scope->parent){
+        if(_cln_scope_find(scope, id) >= 0){
+            return true;
+        }
+    }
+    return resolver->globals[id];
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Declarations                                                -*-
+// -*---------------------------------------------------------------*-
+// -*-
+static void _cln_declare(Resolver *resolver, Value name, bool local){
+    uint32_t id = cln_as_integer(name);
+    if(!resolver->scope){
+        resolver->globals[id] = true;
+    }else if(local || !_cln_is_visible(resolver, id)){
+        _cln_scope_declare(resolver->scope, id);
+    }
+}
+
+// -*- nested function bodies are declared when they are resolved
+static void _cln_declare_statement(Resolver *resolver, Ast *ast){
+    Ast *node;
+    switch(ast->akind){
+    case AST_ASSIGN:
+    case AST_LOCAL:
+        if(cln_ast_node(ast)->akind == AST_IDENT){
+            _cln_declare(resolver, cln_ast_node(ast)->obj, ast->akind==AST_LOCAL);
+        }
+        break;
+    case AST_DEF:
+        if(ast->obj){
+            _cln_declare(resolver, ast->obj, true);
+        }
+        break;
+    case AST_WHILE:
+    case AST_IF:
+        for(node = cln_ast_next(cln_ast_node(ast)); node; node = cln_ast_next(node)){
+            _cln_declare_statement(resolver, node);
+        }
+        break;
+    case AST_EMPTY:
+        for(node = cln_ast_node(ast); node; node = cln_ast_next(node)){
+            _cln_declare_statement(resolver, node);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// -*- imported code defines globals this unit cannot see
+static bool _cln_imports(Ast *ast){
+    for(Ast *node = ast; node; node = cln_ast_next(node)){
+        if(node->akind == AST_IMPORT || node->akind == AST_LOAD || _cln_imports(cln_ast_node(node))){
+            return true;
+        }
+    }
+    return false;
+}
+
+// -*---------------------------------------------------------------*-
+// -*- References                                                  -*-
+// -*---------------------------------------------------------------*-
+static void _cln_resolve_expr(Resolver *resolver, Ast *ast);
+static void _cln_resolve_statement(Resolver *resolver, Ast *ast);
+
+// -*- `ast->obj` is the symbol id, the binding goes to `aux`
+static void _cln_resolve_ref(Resolver *resolver, Ast *ast){
+    uint32_t id = cln_as_integer(ast->obj);
+    uint32_t depth = 0;
+    for(Scope *scope = resolver->scope; scope; scope = scope->parent, ++depth){
+        int slot = _cln_scope_find(scope, id);
+        if(slot < 0){
+            continue;
+        }
+        if(depth > CLN_MAX_NESTING){
+            cln_panic("CelineError: functions nested too deeply, maximum is %d\n", CLN_MAX_NESTING);
+        }
+        // - every frame on the way must stay reachable once its call returns
+        Scope *outer = resolver->scope;
+        for(uint32_t i=0; i < depth; ++i){
+            outer = outer->parent;
+            outer->captured = true;
+        }
+        ast->aux = CLN_BIND_LOCAL(depth, slot);
+        return;
+    }
+    if(resolver->strict && !resolver->globals[id]){
+        cln_panic("CelineError: undefined variable: %s\n", resolver->symtable->symbols[id]);
+    }
+    ast->aux = CLN_BIND_GLOBAL;
+}
+
+// -*- def (arglist){ body }
+static void _cln_resolve_function(Resolver *resolver, Ast *ast){
+    Scope scope = {.parent = resolver->scope};
+    _cln_scope_declare(&scope, CLN_RETURN_ID);
+    _cln_scope_declare(&scope, CLN_SELF_ID);
+    for(Ast *arg = cln_ast_node(cln_ast_node(ast)); arg; arg = cln_ast_next(arg)){
+        if(arg->akind != AST_IDENT){
+            cln_panic("CelineError: invalid parameter: %s\n", clnAstKindNames[arg->akind]);
+        }
+        uint32_t id = cln_as_integer(arg->obj);
+        if(_cln_scope_find(&scope, id) >= 0){
+            cln_panic("CelineError: duplicate parameter: %s\n", resolver->symtable->symbols[id]);
+        }
+        arg->aux = CLN_BIND_LOCAL(0, _cln_scope_declare(&scope, id));
+    }
+    Ast *body = cln_ast_next(cln_ast_node(ast));
+    resolver->scope = &scope;
+    _cln_declare_statement(resolver, body);
+    _cln_resolve_statement(resolver, body);
+    resolver->scope = scope.parent;
+    body->aux = CLN_FRAME(scope.nslot, scope.captured);
+    cln_dealloc(scope.symbols);
+}
+
+// -*-
+static void _cln_resolve_expr(Resolver *resolver, Ast *ast){
+    switch(ast->akind){
+    case AST_IDENT:
+    case AST_FIELD:
+        _cln_resolve_ref(resolver, ast);
+        break;
+    case AST_INDEX:
+        _cln_resolve_ref(resolver, ast);
+        _cln_resolve_expr(resolver, cln_ast_node(ast));
+        break;
+    case AST_CALL:
+        _cln_resolve_ref(resolver, ast);
+        for(Ast *arg = cln_ast_node(cln_ast_node(ast)); arg; arg = cln_ast_next(arg)){
+            _cln_resolve_expr(resolver, arg);
+        }
+        break;
+    case AST_NEW:
+        _cln_resolve_expr(resolver, cln_ast_node(ast));
+        break;
+    case AST_MCALL:
+        _cln_resolve_ref(resolver, cln_ast_node(ast));
+        for(Ast *arg = cln_ast_node(cln_ast_next(cln_ast_node(ast))); arg; arg = cln_ast_next(arg)){
+            _cln_resolve_expr(resolver, arg);
+        }
+        break;
+    case AST_DEF:
+        _cln_resolve_function(resolver, ast);
+        break;
+    default:
+        for(Ast *node = cln_ast_node(ast); node; node = cln_ast_next(node)){
+            _cln_resolve_expr(resolver, node);
+        }
+        break;
+    }
+}
+
+// -*-
+static void _cln_resolve_statement(Resolver *resolver, Ast *ast){
+    Ast *node;
+    switch(ast->akind){
+    case AST_ASSIGN:
+    case AST_LOCAL:
+        node = cln_ast_node(ast);
+        _cln_resolve_expr(resolver, cln_ast_next(node));
+        _cln_resolve_expr(resolver, node);
+        break;
+    case AST_WHILE:
+    case AST_IF:
+        _cln_resolve_expr(resolver, cln_ast_node(ast));
+        for(node = cln_ast_next(cln_ast_node(ast)); node; node = cln_ast_next(node)){
+            _cln_resolve_statement(resolver, node);
+        }
+        break;
+    case AST_DEF:
+        if(ast->obj){
+            _cln_resolve_ref(resolver, ast);
+        }
+        _cln_resolve_function(resolver, ast);
+        break;
+    case AST_EMPTY:
+        for(node = cln_ast_node(ast); node; node = cln_ast_next(node)){
+            _cln_resolve_statement(resolver, node);
+        }
+        break;
+    case AST_IMPORT:
+    case AST_LOAD:
+        break;
+    default:
+        _cln_resolve_expr(resolver, ast);
+        break;
+    }
+}
+
+// -*-
+void cln_resolve(Ast *root, Symtable *symtable, bool strict){
+    Resolver resolver;
+    resolver.symtable = symtable;
+    resolver.scope = NULL;
+    resolver.globals = (bool*)cln_alloc(sizeof(bool)*symtable->len);
+    resolver.strict = strict && !_cln_imports(root);
+    _cln_declare_statement(&resolver, root);
+    _cln_resolve_statement(&resolver, root);
+    cln_dealloc(resolver.globals);
+}
@@ -0,0 +1,148 @@
+#include<string.h>
+
+#include "celine.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CLN_SLAB_MMAP
+#include<sys/mman.h>
+#endif
+
+// -*- build with -DCLN_SLAB_MAX_SIZE=0 to hand every block to cln_alloc(),
+// -*- e.g. under a memory checker
+#ifndef CLN_SLAB_MAX_SIZE
+#define CLN_SLAB_MAX_SIZE       256     // larger blocks go to cln_alloc()
+#endif
+#define CLN_SLAB_GRAIN          16      // size classes are this many bytes apart
+#define CLN_SLAB_CHUNK_SIZE     (256 << 10)
+#define CLN_SLAB_NCLASS         (CLN_SLAB_MAX_SIZE/CLN_SLAB_GRAIN)
+
+// -*- a free block: the link lives in the block itself
+typedef struct slabblock{
+    struct slabblock *next;
+} SlabBlock;
+
+// -*- blocks of one size, bumped off the last chunk once none are free
+typedef struct{
+    SlabBlock *free;
+    char *top;                  // unused tail of the last chunk
+    char *end;
+    size_t live;                // blocks handed out
+    size_t nfree;               // blocks on the free list
+    size_t chunks;
+} SlabClass;
+
+static SlabClass clnSlabs[CLN_SLAB_NCLASS + 1];
+static size_t clnSlabLarge;     // live blocks over CLN_SLAB_MAX_SIZE
+
+// -*- class 0 also serves empty blocks
+static size_t _cln_slab_class(size_t size){
+    return size ? (size - 1)/CLN_SLAB_GRAIN : 0;
+}
+
+// -*- fresh chunks are zero-filled
+static char* _cln_slab_chunk(){
+#ifdef CLN_SLAB_MMAP
+    void *base = mmap(
+        NULL, CLN_SLAB_CHUNK_SIZE, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0
+    );
+    if(base == MAP_FAILED){
+        cln_panic("CelineError: memory allocation failure\n");
+    }
+    return (char*)base;
+#else
+    return (char*)cln_alloc(CLN_SLAB_CHUNK_SIZE);
+#endif
+}
+
+// -*- a zeroed block of `size` bytes
+void* cln_slab_alloc(size_t size){
+    if(size > CLN_SLAB_MAX_SIZE){
+        ++clnSlabLarge;
+        return cln_alloc(size);
+    }
+    size_t id = _cln_slab_class(size);
+    size_t blocksize = (id + 1)*CLN_SLAB_GRAIN;
+    SlabClass *slab = &clnSlabs[id];
+    void *ptr;
+    if(slab->free){
+        ptr = slab->free;
+        slab->free = slab->free->next;
+        --slab->nfree;
+        memset(ptr, 0, blocksize);
+    }else{
+        if((size_t)(slab->end - slab->top) < blocksize){
+            slab->top = _cln_slab_chunk();
+            slab->end = slab->top + CLN_SLAB_CHUNK_SIZE;
+            ++slab->chunks;
+        }
+        ptr = slab->top;
+        slab->top += blocksize;
+    }
+    ++slab->live;
+    return ptr;
+}
+
+// -*- `size` is the one the block was allocated with
+void cln_slab_free(void *ptr, size_t size){
+    if(!ptr){
+        return;
+    }
+    if(size > CLN_SLAB_MAX_SIZE){
+        --clnSlabLarge;
+        free(ptr);
+        return;
+    }
+    SlabClass *slab = &clnSlabs[_cln_slab_class(size)];
+    SlabBlock *block = (SlabBlock*)ptr;
+    block->next = slab->free;
+    slab->free = block;
+    --slab->live;
+    ++slab->nfree;
+}
+
+// -*- contents up to the smaller size are kept, the rest is zeroed
+void* cln_slab_realloc(void *ptr, size_t oldSize, size_t newSize){
+    if(!ptr){
+        return cln_slab_alloc(newSize);
+    }
+    if(oldSize > CLN_SLAB_MAX_SIZE && newSize > CLN_SLAB_MAX_SIZE){
+        char *grown = (char*)realloc(ptr, newSize);
+        if(!grown){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+        if(newSize > oldSize){
+            memset(grown + oldSize, 0, newSize - oldSize);
+        }
+        return grown;
+    }
+    if(oldSize <= CLN_SLAB_MAX_SIZE && newSize <= CLN_SLAB_MAX_SIZE &&
+       _cln_slab_class(oldSize) == _cln_slab_class(newSize)){
+        if(newSize < oldSize){
+            memset((char*)ptr + newSize, 0, oldSize - newSize);
+        }
+        return ptr;
+    }
+    void *block = cln_slab_alloc(newSize);
+    memcpy(block, ptr, oldSize < newSize ? oldSize : newSize);
+    cln_slab_free(ptr, oldSize);
+    return block;
+}
+
+// -*- occupancy of the mapped chunks, per size class
+void cln_slab_print_stats(FILE *stream){
+    for(size_t id=0; id < CLN_SLAB_NCLASS; ++id){
+        SlabClass *slab = &clnSlabs[id];
+        if(!slab->chunks){
+            continue;
+        }
+        size_t blocksize = (id + 1)*CLN_SLAB_GRAIN;
+        size_t mapped = slab->chunks*CLN_SLAB_CHUNK_SIZE;
+        fprintf(
+            stream, "slab: %3zu bytes: %zu live, %zu free, %zu KB mapped, %.1f%% occupied\n",
+            blocksize, slab->live, slab->nfree, mapped >> 10,
+            100.0*(double)(slab->live*blocksize)/(double)mapped
+        );
+    }
+    fprintf(stream, "slab: over %d bytes: %zu live\n", CLN_SLAB_MAX_SIZE, clnSlabLarge);
+}
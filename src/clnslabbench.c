@@ -0,0 +1,73 @@
+#include<string.h>
+#include<time.h>
+
+#include "celine.h"
+
+// -*- Allocation throughput of the slab allocator against the calloc/free
+// -*- wrapper it replaced: a working set of object, env and slot vector
+// -*- sized blocks is churned at random, the way the nursery turns over.
+#define CLN_BENCH_LIVE          (64 << 10)
+#define CLN_BENCH_OPS           (8 << 20)
+
+typedef struct{
+    void *ptr;
+    size_t size;
+} BenchBlock;
+
+static BenchBlock clnBenchBlocks[CLN_BENCH_LIVE];
+
+// -*-
+static size_t _cln_bench_size(uint32_t rand){
+    static const size_t sizes[] = {
+        sizeof(Object), sizeof(Object), sizeof(Object), sizeof(Object),
+        sizeof(Env) + 4*sizeof(Value), sizeof(Env) + 8*sizeof(Value),
+        4*sizeof(Value), 8*sizeof(Value)
+    };
+    return sizes[rand % (sizeof(sizes)/sizeof(sizes[0]))];
+}
+
+// -*-
+static void* _cln_bench_calloc(size_t size){
+    return cln_alloc(size);
+}
+
+// -*-
+static void _cln_bench_free(void *ptr, size_t size){
+    (void)size;
+    cln_dealloc(ptr);
+}
+
+// -*- million allocations per second
+static double _cln_bench_run(void* (*alloc)(size_t), void (*dealloc)(void*, size_t)){
+    struct timespec start, end;
+    uint32_t rand = 2463534242u;
+    memset(clnBenchBlocks, 0, sizeof(clnBenchBlocks));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t i=0; i < CLN_BENCH_OPS; ++i){
+        rand ^= rand << 13;
+        rand ^= rand >> 17;
+        rand ^= rand << 5;
+        BenchBlock *block = &clnBenchBlocks[rand % CLN_BENCH_LIVE];
+        dealloc(block->ptr, block->size);
+        block->size = _cln_bench_size(rand >> 16);
+        block->ptr = alloc(block->size);
+        *(uint32_t*)block->ptr = (uint32_t)i;
+    }
+    for(size_t i=0; i < CLN_BENCH_LIVE; ++i){
+        dealloc(clnBenchBlocks[i].ptr, clnBenchBlocks[i].size);
+        clnBenchBlocks[i].ptr = NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+    return CLN_BENCH_OPS/seconds/1e6;
+}
+
+// -*-
+int main(){
+    double calloced = _cln_bench_run(_cln_bench_calloc, _cln_bench_free);
+    double slabbed = _cln_bench_run(cln_slab_alloc, cln_slab_free);
+    printf("calloc/free: %8.1f M allocations/s\n", calloced);
+    printf("slab:        %8.1f M allocations/s (%.2fx)\n", slabbed, slabbed/calloced);
+    cln_slab_print_stats(stdout);
+    return 0;
+}
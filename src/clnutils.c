@@ -1,27 +1,141 @@
+#include<errno.h>
 #include<string.h>
 
 #include "celine.h"
 
 
+#define CLN_SYMTABLE_INITIAL_CAPACITY   256     // a power of two
+
+// -*- FNV-1a, of symbols and field names
+uint32_t cln_hash(const char *str, size_t len){
+    uint32_t hash = 2166136261u;
+    for(size_t i=0; i < len; ++i){
+        hash = (hash ^ (uint8_t)str[i])*16777619u;
+    }
+    return hash;
+}
+
+// -*- the index is kept at most half full
+static void _cln_symtable_rehash(Symtable *table, uint32_t size){
+    cln_dealloc(table->index);
+    table->index = (uint32_t*)cln_alloc(sizeof(uint32_t)*size);
+    table->mask = size - 1;
+    for(uint32_t id=0; id < table->len; ++id){
+        uint32_t pos = table->hashes[id] & table->mask;
+        while(table->index[pos]){
+            pos = (pos + 1) & table->mask;
+        }
+        table->index[pos] = id + 1;
+    }
+}
+
+// -*-
+static uint32_t _cln_symtable_add(Symtable *table, char *symbol, uint32_t hash){
+    if(table->len == table->cap){
+        table->cap *= 2;
+        table->symbols = (char**)realloc(table->symbols, sizeof(char*)*table->cap);
+        table->hashes = (uint32_t*)realloc(table->hashes, sizeof(uint32_t)*table->cap);
+        if(!table->symbols || !table->hashes){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    uint32_t id = table->len++;
+    table->symbols[id] = symbol;
+    table->hashes[id] = hash;
+    if(2*table->len > table->mask + 1){
+        _cln_symtable_rehash(table, 2*(table->mask + 1));
+    }else{
+        uint32_t pos = hash & table->mask;
+        while(table->index[pos]){
+            pos = (pos + 1) & table->mask;
+        }
+        table->index[pos] = id + 1;
+    }
+    return id;
+}
+
 // -*-
 Symtable* cln_new_symtable(){
     Symtable *symtable = (Symtable*)cln_alloc(sizeof(Symtable));
-    memset(symtable->symbols, 0, sizeof(char*)*CLN_MAX_NUMID);
-    symtable->symbols[CLN_RETURN_ID] = "@return";
-    symtable->symbols[CLN_SELF_ID] = "@self";
-    symtable->len = 2;
+    symtable->cap = CLN_SYMTABLE_INITIAL_CAPACITY;
+    symtable->symbols = (char**)cln_alloc(sizeof(char*)*symtable->cap);
+    symtable->hashes = (uint32_t*)cln_alloc(sizeof(uint32_t)*symtable->cap);
+    _cln_symtable_rehash(symtable, 2*CLN_SYMTABLE_INITIAL_CAPACITY);
+    _cln_symtable_add(symtable, "@return", cln_hash("@return", 7));
+    _cln_symtable_add(symtable, "@self", cln_hash("@self", 5));
     return symtable;
 }
 
+// -*-
+void cln_free_symtable(Symtable *table){
+    for(uint32_t id=CLN_SELF_ID + 1; id < table->len; ++id){
+        free(table->symbols[id]);
+    }
+    cln_dealloc(table->symbols);
+    cln_dealloc(table->hashes);
+    cln_dealloc(table->index);
+    cln_dealloc(table);
+}
+
 // -*-
 uint32_t cln_get_symbol_index(Symtable* table, const char* symbol){
-    for(uint32_t idx=0; idx < table->len; ++idx){
-        if(strcmp(symbol, table->symbols[idx])==0){
-            return idx;
+    return cln_get_symbol_slice(table, symbol, strlen(symbol));
+}
+
+// -*- `symbol` need not be NUL terminated, e.g. a token of the source
+uint32_t cln_get_symbol_slice(Symtable* table, const char* symbol, size_t len){
+    uint32_t hash = cln_hash(symbol, len);
+    for(uint32_t pos = hash & table->mask; table->index[pos]; pos = (pos + 1) & table->mask){
+        uint32_t id = table->index[pos] - 1;
+        if(table->hashes[id] == hash && strncmp(table->symbols[id], symbol, len)==0 &&
+           table->symbols[id][len]=='\0'){
+            return id;
         }
     }
-    uint32_t index = table->len;
-    table->symbols[index] = strdup(symbol);
-    table->len++;
-    return index;
-}
\ No newline at end of file
+    return _cln_symtable_add(table, strndup(symbol, len), hash);
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Input                                                       -*-
+// -*---------------------------------------------------------------*-
+// -*-
+void cln_readlong(long *num){
+    char buf[64] = {0};
+    char *rv = fgets(buf, sizeof(buf), stdin);
+    if(rv == NULL){
+        cln_panic("CelineError: error reading number from standard input\n");
+    }
+    char *ptr;
+    *num = strtol(buf, &ptr, 10);
+    if(errno == EINVAL || errno==ERANGE){
+        cln_panic("CelineError: error reading number from standard input\n");
+    }
+    return;
+}
+
+// -*-
+void cln_readfloat(double *num){
+    char buf[64] = {0};
+    char *rv = fgets(buf, sizeof(buf), stdin);
+    if(rv == NULL){
+        cln_panic("CelineError: error reading number from standard input\n");
+    }
+    char *ptr;
+    *num = strtod(buf, &ptr);
+    if(errno==ERANGE){
+        cln_panic("CelineError: error reading number from standard input\n");
+    }
+    return;
+}
+
+// -*-
+void cln_readstring(char **str){
+    char buf[256];
+    memset(buf, '\0', sizeof(buf));
+    char *rv = fgets(buf, sizeof(buf), stdin);
+    if(rv == NULL || errno==EBADF){
+        cln_panic("CelineError: error reading number from standard input\n");
+    }
+    *str = strdup(buf);
+    return;
+}
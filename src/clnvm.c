@@ -0,0 +1,521 @@
+#include<string.h>
+
+#include "celine.h"
+
+#define CLN_VM_INITIAL_STACK        1024
+#define CLN_VM_INITIAL_FRAMES       64
+
+#if defined(__GNUC__)
+#define CLN_VM_COMPUTED_GOTO
+#endif
+
+// -*---------------------------------------------------------------*-
+// -*- Frames                                                      -*-
+// -*---------------------------------------------------------------*-
+typedef enum{
+    FRAME_MAIN,         // entry chunk
+    FRAME_CALL,         // fun(...) and obj.method(...)
+    FRAME_NEW,          // new Ctor(...)
+    FRAME_IMPORT,       // module chunk, runs on the globals
+} FrameKind;
+
+typedef struct{
+    Proto *proto;
+    Instruction *pc;    // resume point while a callee runs
+    size_t base;        // index of R[0] in the register stack
+    Env *env;
+    int ret;            // caller register receiving the result, -1 to drop it
+    FrameKind kind;
+    Value self;         // object under construction (FRAME_NEW)
+    Value ctor;
+} CallFrame;
+
+typedef struct{
+    Value *stack;       // register windows, one per frame
+    size_t stacksize;
+    CallFrame *frames;
+    size_t nframe;
+    size_t framecap;
+} VM;
+
+static VM clnVM;
+
+// -*-
+static void _cln_vm_ensure_stack(size_t top){
+    if(top <= clnVM.stacksize){
+        return;
+    }
+    size_t size = clnVM.stacksize ? clnVM.stacksize : CLN_VM_INITIAL_STACK;
+    while(size < top){
+        size *= 2;
+    }
+    clnVM.stack = (Value*)realloc(clnVM.stack, sizeof(Value)*size);
+    if(!clnVM.stack){
+        cln_panic("CelineError: memory allocation failure\n");
+    }
+    memset(clnVM.stack + clnVM.stacksize, 0, sizeof(Value)*(size - clnVM.stacksize));
+    clnVM.stacksize = size;
+}
+
+// -*-
+static CallFrame* _cln_vm_push_frame(Proto *proto, Env *env, FrameKind kind, int ret){
+    size_t base = 0;
+    if(clnVM.nframe){
+        CallFrame *caller = &clnVM.frames[clnVM.nframe-1];
+        base = caller->base + caller->proto->nreg;
+    }
+    if(clnVM.nframe == clnVM.framecap){
+        clnVM.framecap = clnVM.framecap ? 2*clnVM.framecap : CLN_VM_INITIAL_FRAMES;
+        clnVM.frames = (CallFrame*)realloc(clnVM.frames, sizeof(CallFrame)*clnVM.framecap);
+        if(!clnVM.frames){
+            cln_panic("CelineError: memory allocation failure\n");
+        }
+    }
+    _cln_vm_ensure_stack(base + proto->nreg);
+    CallFrame *frame = &clnVM.frames[clnVM.nframe++];
+    frame->proto = proto;
+    frame->pc = proto->code;
+    frame->base = base;
+    frame->env = env;
+    frame->ret = ret;
+    frame->kind = kind;
+    frame->self = CLN_NIL;
+    frame->ctor = CLN_NIL;
+    return frame;
+}
+
+// -*- void _cln_narg_error()
+static void _cln_vm_narg_error(Object *fun){
+    cln_panic(
+        "CelineError: invalid number of arguments passed to function: expected %d\n",
+        fun->val.fun.narg
+    );
+}
+
+// -*- arguments are in the caller's registers [first, first+narg)
+static CallFrame* _cln_vm_enter(Value callee, int first, int narg, Value owner, int ret, FrameKind kind){
+    cln_checktype(callee, TY_FUN);
+    Object *fun = cln_as_object(callee);
+    if(narg != fun->val.fun.narg){
+        _cln_vm_narg_error(fun);
+    }
+    Proto *proto = fun->val.fun.proto;
+    if(!proto){
+        cln_panic("CelineError: function has no compiled code\n");
+    }
+    CallFrame *caller = &clnVM.frames[clnVM.nframe-1];
+    Env *local = cln_new_frame(proto->frame, fun->val.fun.closure);
+    memcpy(local->slots + CLN_ARGS_SLOT, clnVM.stack + caller->base + first, sizeof(Value)*narg);
+    local->slots[CLN_SELF_ID] = owner;
+    return _cln_vm_push_frame(proto, local, kind, ret);
+}
+
+// -*- `return f(...)`: the callee replaces the running frame, which is
+// -*- gone before the callee's frame is made. The arguments stay on the gc
+// -*- root stack meanwhile since the registers past the top window are
+// -*- cleared by a collection.
+static CallFrame* _cln_vm_tail(Value callee, int first, int narg, Value owner){
+    cln_checktype(callee, TY_FUN);
+    Object *fun = cln_as_object(callee);
+    if(narg != fun->val.fun.narg){
+        _cln_vm_narg_error(fun);
+    }
+    Proto *proto = fun->val.fun.proto;
+    if(!proto){
+        cln_panic("CelineError: function has no compiled code\n");
+    }
+    CallFrame done = clnVM.frames[--clnVM.nframe];
+    size_t mark = cln_gc_root_mark();
+    cln_gc_push_root(callee);
+    cln_gc_push_root(owner);
+    for(int i=0; i < narg; ++i){
+        cln_gc_push_root(clnVM.stack[done.base + first + i]);
+    }
+    cln_free_frame(done.env);
+    Env *local = cln_new_frame(proto->frame, fun->val.fun.closure);
+    memcpy(local->slots + CLN_ARGS_SLOT, clnGCRoots.values + mark + 2, sizeof(Value)*narg);
+    local->slots[CLN_SELF_ID] = owner;
+    cln_gc_pop_roots(mark);
+    return _cln_vm_push_frame(proto, local, FRAME_CALL, done.ret);
+}
+
+// -*- live registers, frame envs and objects under construction. The
+// -*- registers past the top window are cleared: a later frame reusing
+// -*- them must not expose objects this collection frees.
+void cln_vm_mark_roots(){
+    size_t top = 0;
+    if(clnVM.nframe){
+        CallFrame *frame = &clnVM.frames[clnVM.nframe-1];
+        top = frame->base + frame->proto->nreg;
+    }
+    for(size_t i=0; i < top; ++i){
+        cln_gc_mark(clnVM.stack[i]);
+    }
+    if(top < clnVM.stacksize){
+        memset(clnVM.stack + top, 0, sizeof(Value)*(clnVM.stacksize - top));
+    }
+    for(size_t i=0; i < clnVM.nframe; ++i){
+        cln_gc_mark_env(clnVM.frames[i].env);
+        cln_gc_mark(clnVM.frames[i].self);
+        cln_gc_mark(clnVM.frames[i].ctor);
+    }
+}
+
+// -*---------------------------------------------------------------*-
+// -*- Interpreter                                                 -*-
+// -*---------------------------------------------------------------*-
+#ifdef CLN_VM_COMPUTED_GOTO
+#define CLN_VM_DISPATCH(op)     goto *clnDispatch[op];
+#define CLN_VM_CASE(op)         L_OP_##op:
+#define CLN_VM_NEXT()           instr = *pc++; goto *clnDispatch[CLN_GET_OP(instr)]
+#else
+#define CLN_VM_DISPATCH(op)     switch(op)
+#define CLN_VM_CASE(op)         case OP_##op:
+#define CLN_VM_NEXT()           break
+#endif
+
+#define CLN_VM_LOAD_FRAME()                                 \
+    frame = &clnVM.frames[clnVM.nframe-1];                  \
+    pc = frame->pc;                                         \
+    R = clnVM.stack + frame->base;                          \
+    K = frame->proto->consts;                               \
+    env = frame->env
+
+// -*- `env` of the main chunk
+#define CLN_VM_GLOBALS()        clnVM.frames[entry].env
+
+#define CLN_VM_EVALOP(op)                                   \
+    lhs = R[CLN_GET_B(instr)];                              \
+    rhs = R[CLN_GET_C(instr)];                              \
+    if(!cln_is_integer(lhs) || !cln_is_integer(rhs)){       \
+        cln_checktype(lhs, TY_INTEGER);                     \
+        cln_checktype(rhs, TY_INTEGER);                     \
+    }                                                       \
+    R[CLN_GET_A(instr)] = cln_new_integer(                  \
+        (long)((cln_as_integer(lhs)) op (cln_as_integer(rhs))) \
+    )
+
+// -*-
+void cln_vm_run(Proto *proto, Env *env, Symtable *symtable){
+#ifdef CLN_VM_COMPUTED_GOTO
+    static const void *clnDispatch[] = {
+#define CLN_DEF(kind, name)     &&L_OP_##kind,
+        CLN_OPCODES
+#undef CLN_DEF
+    };
+#endif
+    size_t entry = clnVM.nframe;
+    CallFrame *frame;
+    Instruction *pc;
+    Instruction instr;
+    Value *R;
+    Value *K;
+    Value lhs;
+    Value rhs;
+    Value self;
+    Object *obj;
+    char *str;
+    long inum;
+
+    _cln_vm_push_frame(proto, env, FRAME_MAIN, -1);
+    CLN_VM_LOAD_FRAME();
+    for(;;){
+        instr = *pc++;
+        CLN_VM_DISPATCH(CLN_GET_OP(instr)){
+        CLN_VM_CASE(MOVE){
+            R[CLN_GET_A(instr)] = R[CLN_GET_B(instr)];
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(LOADK){
+            R[CLN_GET_A(instr)] = K[CLN_GET_BX(instr)];
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(GETVAR){
+            self = CLN_VM_GLOBALS()->slots[CLN_GET_BX(instr)];
+            if(!self){
+                Ast *program = cln_module_lazy_def(CLN_GET_BX(instr), symtable);
+                if(!program){
+                    cln_panic("CelineError: %s is not initialized\n", symtable->symbols[CLN_GET_BX(instr)]);
+                }
+                // - bind the def a lazy import left, then read again
+                Proto *code = cln_compile(program, symtable);
+                cln_ast_free(program);
+                frame->pc = pc - 1;
+                _cln_vm_push_frame(code, CLN_VM_GLOBALS(), FRAME_IMPORT, -1);
+                CLN_VM_LOAD_FRAME();
+                CLN_VM_NEXT();
+            }
+            R[CLN_GET_A(instr)] = self;
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(SETVAR){
+            CLN_VM_GLOBALS()->slots[CLN_GET_BX(instr)] = R[CLN_GET_A(instr)];
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(GETLOCAL){
+            self = cln_env_up(env, CLN_GET_C(instr))->slots[CLN_GET_B(instr)];
+            if(!self){
+                cln_panic("CelineError: local variable in slot %d is not initialized\n", CLN_GET_B(instr));
+            }
+            R[CLN_GET_A(instr)] = self;
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(SETLOCAL){
+            cln_env_up(env, CLN_GET_C(instr))->slots[CLN_GET_B(instr)] = R[CLN_GET_A(instr)];
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(ADD){
+            CLN_VM_EVALOP(+);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(SUB){
+            CLN_VM_EVALOP(-);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(MUL){
+            CLN_VM_EVALOP(*);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(DIV){
+            CLN_VM_EVALOP(/);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(AND){
+            CLN_VM_EVALOP(&&);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(OR){
+            CLN_VM_EVALOP(||);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(LT){
+            CLN_VM_EVALOP(<);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(EQ){
+            CLN_VM_EVALOP(==);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(GT){
+            CLN_VM_EVALOP(>);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(LE){
+            CLN_VM_EVALOP(<=);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(GE){
+            CLN_VM_EVALOP(>=);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(NOT){
+            self = R[CLN_GET_B(instr)];
+            cln_checktype(self, TY_INTEGER);
+            R[CLN_GET_A(instr)] = cln_new_integer((long)(!cln_as_integer(self)));
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(JMP){
+            pc += CLN_GET_SAX(instr);
+            if(CLN_GET_SAX(instr) < 0){
+                cln_gc_safepoint();
+            }
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(JMPIFNOT){
+            if(!cln_is_true(R[CLN_GET_A(instr)])){
+                pc += CLN_GET_SBX(instr);
+            }
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(READ_INT){
+            printf("icln>> ");
+            cln_readlong(&inum);
+            R[CLN_GET_A(instr)] = cln_new_integer(inum);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(INPUT){
+            printf("icln>> ");
+            cln_readstring(&str);
+            R[CLN_GET_A(instr)] = cln_object_value(cln_new_string(str));
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(NEWARRAY){
+            self = R[CLN_GET_B(instr)];
+            cln_checktype(self, TY_INTEGER);
+            R[CLN_GET_A(instr)] = cln_object_value(cln_new_array(cln_as_integer(self)));
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(NEWOBJECT){
+            R[CLN_GET_A(instr)] = cln_object_value(cln_new());
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(GETINDEX){
+            rhs = R[CLN_GET_C(instr)];
+            cln_checktype(rhs, TY_INTEGER);
+            self = R[CLN_GET_B(instr)];
+            cln_checktype(self, TY_ARRAY);
+            obj = cln_as_object(self);
+            inum = cln_as_integer(rhs);
+            if(inum >= obj->val.array.len){
+                cln_panic(
+                    "Array index out of bounds: %ld out of %zu\n",
+                    inum, obj->val.array.len
+                );
+            }
+            R[CLN_GET_A(instr)] = obj->val.array.data[inum];
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(SETINDEX){
+            rhs = R[CLN_GET_B(instr)];
+            cln_checktype(rhs, TY_INTEGER);
+            self = R[CLN_GET_A(instr)];
+            cln_checktype(self, TY_ARRAY);
+            obj = cln_as_object(self);
+            inum = cln_as_integer(rhs);
+            if(inum >= obj->val.array.len){
+                cln_panic(
+                    "Array index out of bounds: %ld out of %zu\n",
+                    inum, obj->val.array.len
+                );
+            }
+            obj->val.array.data[inum] = R[CLN_GET_C(instr)];
+            cln_gc_barrier(obj, R[CLN_GET_C(instr)]);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(GETFIELD){
+            FieldCache *cache = cln_field_cache(CLN_GET_AX(*pc++));
+            self = cln_get_field_cached(cln_checkobject(R[CLN_GET_B(instr)]), cache);
+            if(!self){
+                cln_panic("CelineError: unknown field: %s\n", cache->name->name);
+            }
+            R[CLN_GET_A(instr)] = self;
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(SETFIELD){
+            FieldCache *cache = cln_field_cache(CLN_GET_AX(*pc++));
+            cln_set_field_cached(cln_checkobject(R[CLN_GET_A(instr)]), cache, R[CLN_GET_B(instr)]);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(CLOSURE){
+            Proto *child = frame->proto->protos[CLN_GET_BX(instr)];
+            obj = cln_new_fun(child->narg, NULL);
+            obj->val.fun.proto = child;
+            obj->val.fun.closure = cln_closure_env(env);
+            R[CLN_GET_A(instr)] = cln_object_value(obj);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(CALL){
+            int base = CLN_GET_B(instr);
+            frame->pc = pc;
+            _cln_vm_enter(R[base], base+1, CLN_GET_C(instr), CLN_NIL, CLN_GET_A(instr), FRAME_CALL);
+            CLN_VM_LOAD_FRAME();
+            cln_gc_safepoint();
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(MCALL){
+            int base = CLN_GET_B(instr);
+            frame->pc = pc;
+            _cln_vm_enter(R[base], base+2, CLN_GET_C(instr), R[base+1], CLN_GET_A(instr), FRAME_CALL);
+            CLN_VM_LOAD_FRAME();
+            cln_gc_safepoint();
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(TAILCALL){
+            int base = CLN_GET_B(instr);
+            if(frame->kind != FRAME_CALL){  // a constructor still finishes its instance
+                frame->pc = pc;
+                _cln_vm_enter(R[base], base+1, CLN_GET_C(instr), CLN_NIL, CLN_GET_A(instr), FRAME_CALL);
+            }else{
+                _cln_vm_tail(R[base], base+1, CLN_GET_C(instr), CLN_NIL);
+            }
+            CLN_VM_LOAD_FRAME();
+            cln_gc_safepoint();
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(TAILMCALL){
+            int base = CLN_GET_B(instr);
+            if(frame->kind != FRAME_CALL){
+                frame->pc = pc;
+                _cln_vm_enter(R[base], base+2, CLN_GET_C(instr), R[base+1], CLN_GET_A(instr), FRAME_CALL);
+            }else{
+                _cln_vm_tail(R[base], base+2, CLN_GET_C(instr), R[base+1]);
+            }
+            CLN_VM_LOAD_FRAME();
+            cln_gc_safepoint();
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(NEW){
+            int base = CLN_GET_B(instr);
+            Value ctor = R[base];
+            self = cln_object_value(cln_new_instance(ctor));
+            frame->pc = pc;
+            frame = _cln_vm_enter(ctor, base+1, CLN_GET_C(instr), self, CLN_GET_A(instr), FRAME_NEW);
+            frame->self = self;
+            frame->ctor = ctor;
+            CLN_VM_LOAD_FRAME();
+            cln_gc_safepoint();
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(RETURN){
+            Value result = CLN_GET_B(instr) ? R[CLN_GET_A(instr)] : CLN_NIL;
+            CallFrame done = *frame;
+            --clnVM.nframe;
+            switch(done.kind){
+            case FRAME_NEW:
+                cln_finish_instance(done.ctor, cln_as_object(done.self));
+                result = done.self;
+                cln_free_frame(done.env);
+                break;
+            case FRAME_CALL:
+                cln_free_frame(done.env);
+                break;
+            default:    // module level `return`
+                if(CLN_GET_B(instr)){
+                    done.env->slots[CLN_RETURN_ID] = result;
+                }
+                break;
+            }
+            if(clnVM.nframe == entry){
+                return;
+            }
+            CLN_VM_LOAD_FRAME();
+            if(done.ret >= 0){
+                R[done.ret] = result;
+            }
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(PRINT){
+            str = cln_toString(R[CLN_GET_A(instr)]);
+            printf("\n%s\n", str);
+            cln_dealloc(str);
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(IMPORT){
+            const char *name = cln_as_object(K[CLN_GET_BX(instr)])->val.cstr;
+            if(clnOptions.lazyImports && cln_module_import_lazy(name, symtable, CLN_VM_GLOBALS())){
+                CLN_VM_NEXT();
+            }
+            Proto *code = cln_module_compile(name, symtable);
+            cln_globals_reserve(CLN_VM_GLOBALS(), symtable->len);
+            frame->pc = pc;
+            _cln_vm_push_frame(code, CLN_VM_GLOBALS(), FRAME_IMPORT, -1);
+            CLN_VM_LOAD_FRAME();
+            cln_gc_safepoint();
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(LOAD){
+            cln_module_load(cln_as_object(K[CLN_GET_BX(instr)])->val.cstr, symtable, CLN_VM_GLOBALS());
+            CLN_VM_NEXT();
+        }
+        CLN_VM_CASE(EXTRAARG){
+            cln_panic("CelineError: corrupted bytecode at %s\n", clnOpNames[OP_EXTRAARG]);
+            CLN_VM_NEXT();
+        }
+#ifndef CLN_VM_COMPUTED_GOTO
+        default:
+            cln_panic("CelineError: invalid opcode: %d\n", CLN_GET_OP(instr));
+            break;
+#endif
+        }
+    }
+}